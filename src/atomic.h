@@ -1,29 +1,415 @@
 #pragma once
 
-// Atomic operations on 32-bit integers.
+#include <stdbool.h>
+#include <stdint.h>
+
+// Atomic operations on 32-bit and 64-bit integers, pointers and 128-bit pairs.
+// All operations are compiler intrinsics defined here, so they inline at the call site.
+// Operations without an order argument are sequentially consistent,
+// except atomic_load and atomic_store which acquire and release.
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define atomic_inline __forceinline
+#define atomic_align16 __declspec(align(16))
+#else
+#define atomic_inline static inline __attribute__((always_inline))
+#define atomic_align16 __attribute__((aligned(16)))
+#endif
+
+// Memory ordering for the explicit variants.
+typedef enum atomic_order_t
+{
+	// Atomicity only; no ordering of surrounding memory operations.
+	k_atomic_relaxed,
+	// Later reads and writes can't move before this operation.
+	k_atomic_acquire,
+	// Earlier reads and writes can't move after this operation.
+	k_atomic_release,
+	// Acquire and release, plus one total order across all sequentially consistent operations.
+	k_atomic_seq_cst,
+} atomic_order_t;
+
+// Two 64-bit words updated together by atomic_compare_and_exchange_128().
+// Typically a pointer and a tag that changes on every update, to rule out ABA.
+typedef struct atomic_align16 atomic_pair_t
+{
+	uint64_t low;
+	uint64_t high;
+} atomic_pair_t;
+
+// The *_explicit operations below take the memory order; the plain ones further down use the defaults.
+// atomic_compare_and_exchange_128() stores exchange if *dest equals *compare and returns true;
+// otherwise it copies the current *dest into *compare and returns false.
+// atomic_pause() tells the CPU it is in a spin-wait loop.
+
+#if defined(_MSC_VER)
+
+// x64 read-modify-write instructions are full barriers, so every order maps to the same intrinsic.
+// Plain loads already acquire and plain stores already release; only the compiler must be held back.
+
+atomic_inline int atomic_fetch_add_explicit(int* address, int value, atomic_order_t order)
+{
+	return _InterlockedExchangeAdd((volatile long*)address, value);
+}
+
+atomic_inline int atomic_exchange_explicit(int* address, int value, atomic_order_t order)
+{
+	return _InterlockedExchange((volatile long*)address, value);
+}
+
+atomic_inline int atomic_compare_and_exchange_explicit(int* dest, int compare, int exchange, atomic_order_t order)
+{
+	return _InterlockedCompareExchange((volatile long*)dest, exchange, compare);
+}
+
+atomic_inline int atomic_load_explicit(int* address, atomic_order_t order)
+{
+	int value = *(volatile int*)address;
+	_ReadWriteBarrier();
+	return value;
+}
+
+atomic_inline void atomic_store_explicit(int* address, int value, atomic_order_t order)
+{
+	if (order == k_atomic_seq_cst)
+	{
+		_InterlockedExchange((volatile long*)address, value);
+		return;
+	}
+	_ReadWriteBarrier();
+	*(volatile int*)address = value;
+}
+
+atomic_inline int64_t atomic_fetch_add_64_explicit(int64_t* address, int64_t value, atomic_order_t order)
+{
+	return _InterlockedExchangeAdd64(address, value);
+}
+
+atomic_inline int64_t atomic_exchange_64_explicit(int64_t* address, int64_t value, atomic_order_t order)
+{
+	return _InterlockedExchange64(address, value);
+}
+
+atomic_inline int64_t atomic_compare_and_exchange_64_explicit(int64_t* dest, int64_t compare, int64_t exchange, atomic_order_t order)
+{
+	return _InterlockedCompareExchange64(dest, exchange, compare);
+}
+
+atomic_inline int64_t atomic_load_64_explicit(int64_t* address, atomic_order_t order)
+{
+	int64_t value = *(volatile int64_t*)address;
+	_ReadWriteBarrier();
+	return value;
+}
+
+atomic_inline void atomic_store_64_explicit(int64_t* address, int64_t value, atomic_order_t order)
+{
+	if (order == k_atomic_seq_cst)
+	{
+		_InterlockedExchange64(address, value);
+		return;
+	}
+	_ReadWriteBarrier();
+	*(volatile int64_t*)address = value;
+}
+
+atomic_inline void* atomic_exchange_ptr_explicit(void** address, void* value, atomic_order_t order)
+{
+	return _InterlockedExchangePointer(address, value);
+}
+
+atomic_inline void* atomic_compare_and_exchange_ptr_explicit(void** dest, void* compare, void* exchange, atomic_order_t order)
+{
+	return _InterlockedCompareExchangePointer(dest, exchange, compare);
+}
+
+atomic_inline void* atomic_load_ptr_explicit(void** address, atomic_order_t order)
+{
+	void* value = *(void* volatile*)address;
+	_ReadWriteBarrier();
+	return value;
+}
+
+atomic_inline void atomic_store_ptr_explicit(void** address, void* value, atomic_order_t order)
+{
+	if (order == k_atomic_seq_cst)
+	{
+		_InterlockedExchangePointer(address, value);
+		return;
+	}
+	_ReadWriteBarrier();
+	*(void* volatile*)address = value;
+}
+
+atomic_inline bool atomic_compare_and_exchange_128(atomic_pair_t* dest, atomic_pair_t* compare, atomic_pair_t exchange)
+{
+	return _InterlockedCompareExchange128((volatile int64_t*)dest,
+		(int64_t)exchange.high, (int64_t)exchange.low, (int64_t*)compare) != 0;
+}
+
+atomic_inline void atomic_fence(atomic_order_t order)
+{
+	if (order == k_atomic_seq_cst)
+	{
+		__faststorefence();
+	}
+	_ReadWriteBarrier();
+}
+
+atomic_inline void atomic_pause()
+{
+	_mm_pause();
+}
+
+#else
+
+// The compiler builtins behind C11 <stdatomic.h>, which can't be included here:
+// its atomic_load and atomic_store macros collide with this API.
+
+atomic_inline int atomic_builtin_order(atomic_order_t order)
+{
+	return order == k_atomic_relaxed ? __ATOMIC_RELAXED
+		: order == k_atomic_acquire ? __ATOMIC_ACQUIRE
+		: order == k_atomic_release ? __ATOMIC_RELEASE
+		: __ATOMIC_SEQ_CST;
+}
+
+// A failed compare-and-exchange may not release, so drop that half of the order for the failure case.
+atomic_inline int atomic_builtin_failure_order(atomic_order_t order)
+{
+	return order == k_atomic_seq_cst ? __ATOMIC_SEQ_CST
+		: order == k_atomic_acquire ? __ATOMIC_ACQUIRE
+		: __ATOMIC_RELAXED;
+}
+
+// Loads can't release and stores can't acquire; such requests are strengthened to seq_cst.
+atomic_inline int atomic_builtin_load_order(atomic_order_t order)
+{
+	return order == k_atomic_release ? __ATOMIC_SEQ_CST : atomic_builtin_order(order);
+}
+
+atomic_inline int atomic_builtin_store_order(atomic_order_t order)
+{
+	return order == k_atomic_acquire ? __ATOMIC_SEQ_CST : atomic_builtin_order(order);
+}
+
+atomic_inline int atomic_fetch_add_explicit(int* address, int value, atomic_order_t order)
+{
+	return __atomic_fetch_add(address, value, atomic_builtin_order(order));
+}
+
+atomic_inline int atomic_exchange_explicit(int* address, int value, atomic_order_t order)
+{
+	return __atomic_exchange_n(address, value, atomic_builtin_order(order));
+}
+
+atomic_inline int atomic_compare_and_exchange_explicit(int* dest, int compare, int exchange, atomic_order_t order)
+{
+	__atomic_compare_exchange_n(dest, &compare, exchange, false,
+		atomic_builtin_order(order), atomic_builtin_failure_order(order));
+	return compare;
+}
+
+atomic_inline int atomic_load_explicit(int* address, atomic_order_t order)
+{
+	return __atomic_load_n(address, atomic_builtin_load_order(order));
+}
+
+atomic_inline void atomic_store_explicit(int* address, int value, atomic_order_t order)
+{
+	__atomic_store_n(address, value, atomic_builtin_store_order(order));
+}
+
+atomic_inline int64_t atomic_fetch_add_64_explicit(int64_t* address, int64_t value, atomic_order_t order)
+{
+	return __atomic_fetch_add(address, value, atomic_builtin_order(order));
+}
+
+atomic_inline int64_t atomic_exchange_64_explicit(int64_t* address, int64_t value, atomic_order_t order)
+{
+	return __atomic_exchange_n(address, value, atomic_builtin_order(order));
+}
+
+atomic_inline int64_t atomic_compare_and_exchange_64_explicit(int64_t* dest, int64_t compare, int64_t exchange, atomic_order_t order)
+{
+	__atomic_compare_exchange_n(dest, &compare, exchange, false,
+		atomic_builtin_order(order), atomic_builtin_failure_order(order));
+	return compare;
+}
+
+atomic_inline int64_t atomic_load_64_explicit(int64_t* address, atomic_order_t order)
+{
+	return __atomic_load_n(address, atomic_builtin_load_order(order));
+}
+
+atomic_inline void atomic_store_64_explicit(int64_t* address, int64_t value, atomic_order_t order)
+{
+	__atomic_store_n(address, value, atomic_builtin_store_order(order));
+}
+
+atomic_inline void* atomic_exchange_ptr_explicit(void** address, void* value, atomic_order_t order)
+{
+	return __atomic_exchange_n(address, value, atomic_builtin_order(order));
+}
+
+atomic_inline void* atomic_compare_and_exchange_ptr_explicit(void** dest, void* compare, void* exchange, atomic_order_t order)
+{
+	__atomic_compare_exchange_n(dest, &compare, exchange, false,
+		atomic_builtin_order(order), atomic_builtin_failure_order(order));
+	return compare;
+}
+
+atomic_inline void* atomic_load_ptr_explicit(void** address, atomic_order_t order)
+{
+	return __atomic_load_n(address, atomic_builtin_load_order(order));
+}
+
+atomic_inline void atomic_store_ptr_explicit(void** address, void* value, atomic_order_t order)
+{
+	__atomic_store_n(address, value, atomic_builtin_store_order(order));
+}
+
+atomic_inline bool atomic_compare_and_exchange_128(atomic_pair_t* dest, atomic_pair_t* compare, atomic_pair_t exchange)
+{
+#if defined(__x86_64__)
+	// Spelled out so it inlines without -mcx16 or a call into libatomic.
+	bool success;
+	__asm__ __volatile__("lock cmpxchg16b %1"
+		: "=@ccz"(success), "+m"(*dest), "+a"(compare->low), "+d"(compare->high)
+		: "b"(exchange.low), "c"(exchange.high)
+		: "memory");
+	return success;
+#else
+	return __atomic_compare_exchange((unsigned __int128*)dest, (unsigned __int128*)compare,
+		(unsigned __int128*)&exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+atomic_inline void atomic_fence(atomic_order_t order)
+{
+	__atomic_thread_fence(atomic_builtin_order(order));
+}
+
+atomic_inline void atomic_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+#endif
 
 // Increment a number atomically.
 // Returns the old value of the number.
 // Performs the following operation atomically:
 //   int old_value = *address; (*address)++; return old_value;
-int atomic_increment(int* address);
+atomic_inline int atomic_increment(int* address)
+{
+	return atomic_fetch_add_explicit(address, 1, k_atomic_seq_cst);
+}
 
 // Decrement a number atomically.
 // Returns the old value of the number.
 // Performs the following operation atomically:
 //   int old_value = *address; (*address)--; return old_value;
-int atomic_decrement(int* address);
+atomic_inline int atomic_decrement(int* address)
+{
+	return atomic_fetch_add_explicit(address, -1, k_atomic_seq_cst);
+}
+
+// Add to a number atomically.
+// Returns the old value of the number.
+atomic_inline int atomic_fetch_add(int* address, int value)
+{
+	return atomic_fetch_add_explicit(address, value, k_atomic_seq_cst);
+}
+
+// Replace a number atomically.
+// Returns the old value of the number.
+atomic_inline int atomic_exchange(int* address, int value)
+{
+	return atomic_exchange_explicit(address, value, k_atomic_seq_cst);
+}
 
 // Compare two numbers atomically and assign if equal.
 // Returns the old value of the number.
 // Performs the following operation atomically:
 //   int old_value = *address; if (*address == compare) *address = exchange; return old_value;
-int atomic_compare_and_exchange(int* dest, int compare, int exchange);
+atomic_inline int atomic_compare_and_exchange(int* dest, int compare, int exchange)
+{
+	return atomic_compare_and_exchange_explicit(dest, compare, exchange, k_atomic_seq_cst);
+}
 
 // Reads an integer from an address.
 // All writes that occurred before the last atomic_store to this address are flushed.
-int atomic_load(int* address);
+atomic_inline int atomic_load(int* address)
+{
+	return atomic_load_explicit(address, k_atomic_acquire);
+}
 
 // Writes an integer.
 // Paired with an atomic_load, can guarantee ordering and visibility.
-void atomic_store(int* address, int value);
+atomic_inline void atomic_store(int* address, int value)
+{
+	atomic_store_explicit(address, value, k_atomic_release);
+}
+
+// 64-bit versions of the operations above. The address must be 8-byte aligned.
+atomic_inline int64_t atomic_increment_64(int64_t* address)
+{
+	return atomic_fetch_add_64_explicit(address, 1, k_atomic_seq_cst);
+}
+
+atomic_inline int64_t atomic_decrement_64(int64_t* address)
+{
+	return atomic_fetch_add_64_explicit(address, -1, k_atomic_seq_cst);
+}
+
+atomic_inline int64_t atomic_fetch_add_64(int64_t* address, int64_t value)
+{
+	return atomic_fetch_add_64_explicit(address, value, k_atomic_seq_cst);
+}
+
+atomic_inline int64_t atomic_exchange_64(int64_t* address, int64_t value)
+{
+	return atomic_exchange_64_explicit(address, value, k_atomic_seq_cst);
+}
+
+atomic_inline int64_t atomic_compare_and_exchange_64(int64_t* dest, int64_t compare, int64_t exchange)
+{
+	return atomic_compare_and_exchange_64_explicit(dest, compare, exchange, k_atomic_seq_cst);
+}
+
+atomic_inline int64_t atomic_load_64(int64_t* address)
+{
+	return atomic_load_64_explicit(address, k_atomic_acquire);
+}
+
+atomic_inline void atomic_store_64(int64_t* address, int64_t value)
+{
+	atomic_store_64_explicit(address, value, k_atomic_release);
+}
+
+// Pointer versions of the operations above.
+atomic_inline void* atomic_exchange_ptr(void** address, void* value)
+{
+	return atomic_exchange_ptr_explicit(address, value, k_atomic_seq_cst);
+}
+
+atomic_inline void* atomic_compare_and_exchange_ptr(void** dest, void* compare, void* exchange)
+{
+	return atomic_compare_and_exchange_ptr_explicit(dest, compare, exchange, k_atomic_seq_cst);
+}
+
+atomic_inline void* atomic_load_ptr(void** address)
+{
+	return atomic_load_ptr_explicit(address, k_atomic_acquire);
+}
+
+atomic_inline void atomic_store_ptr(void** address, void* value)
+{
+	atomic_store_ptr_explicit(address, value, k_atomic_release);
+}
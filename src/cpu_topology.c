@@ -0,0 +1,222 @@
+#include "cpu_topology.h"
+
+#include "heap.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+enum
+{
+	k_cpu_min_pinned_cores = 4,
+};
+
+static void add_core(cpu_topology_t* topology, uint64_t mask)
+{
+	for (int i = 0; i < topology->core_count; ++i)
+	{
+		if (topology->core_masks[i] == mask)
+		{
+			return;
+		}
+	}
+	if (mask && topology->core_count < k_cpu_max_processors)
+	{
+		topology->core_masks[topology->core_count++] = mask;
+	}
+}
+
+static void add_cache(cpu_topology_t* topology, const cpu_cache_t* cache)
+{
+	for (int i = 0; i < topology->cache_count; ++i)
+	{
+		const cpu_cache_t* other = &topology->caches[i];
+		if (other->level == cache->level && other->type == cache->type && other->processor_mask == cache->processor_mask)
+		{
+			return;
+		}
+	}
+	if (topology->cache_count < k_cpu_max_caches)
+	{
+		topology->caches[topology->cache_count++] = *cache;
+	}
+}
+
+#if defined(_WIN32)
+
+void cpu_topology_query(heap_t* heap, cpu_topology_t* topology)
+{
+	memset(topology, 0, sizeof(*topology));
+
+	// The first call fails with the size needed, which grows with the number of processors and caches.
+	DWORD length = 0;
+	if (GetLogicalProcessorInformation(NULL, &length) || GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+	{
+		return;
+	}
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION* info = heap_alloc(heap, length, 8);
+	if (!GetLogicalProcessorInformation(info, &length))
+	{
+		heap_free(heap, info);
+		return;
+	}
+
+	int count = (int)(length / sizeof(info[0]));
+	for (int i = 0; i < count; ++i)
+	{
+		if (info[i].Relationship == RelationProcessorCore)
+		{
+			add_core(topology, (uint64_t)info[i].ProcessorMask);
+		}
+		else if (info[i].Relationship == RelationCache)
+		{
+			const CACHE_DESCRIPTOR* descriptor = &info[i].Cache;
+			cpu_cache_t cache;
+			cache.level = descriptor->Level;
+			cache.type = descriptor->Type == CacheData ? k_cpu_cache_data
+				: descriptor->Type == CacheInstruction ? k_cpu_cache_instruction
+				: k_cpu_cache_unified;
+			cache.size = descriptor->Size;
+			cache.line_size = descriptor->LineSize;
+			cache.processor_mask = (uint64_t)info[i].ProcessorMask;
+			add_cache(topology, &cache);
+		}
+	}
+	heap_free(heap, info);
+
+	for (int i = 0; i < topology->core_count; ++i)
+	{
+		for (uint64_t mask = topology->core_masks[i]; mask; mask &= mask - 1)
+		{
+			topology->logical_count++;
+		}
+	}
+}
+
+#else
+
+// Read the first line of a sysfs file.
+static bool read_line(const char* path, char* line, size_t size)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+	{
+		return false;
+	}
+	bool success = fgets(line, (int)size, file) != NULL;
+	fclose(file);
+	return success;
+}
+
+// Parse a processor list such as "0-3,8,10-11" into a mask.
+static uint64_t parse_processor_list(const char* list)
+{
+	uint64_t mask = 0;
+	const char* p = list;
+	while (*p >= '0' && *p <= '9')
+	{
+		char* end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		if (*end == '-')
+		{
+			last = strtol(end + 1, &end, 10);
+		}
+		for (long i = first; i <= last && i < k_cpu_max_processors; ++i)
+		{
+			mask |= 1ull << i;
+		}
+		p = *end == ',' ? end + 1 : end;
+	}
+	return mask;
+}
+
+// Parse a size such as "48K" or "32M".
+static size_t parse_size(const char* text)
+{
+	char* end;
+	size_t size = (size_t)strtoull(text, &end, 10);
+	if (*end == 'K')
+	{
+		size *= 1024;
+	}
+	else if (*end == 'M')
+	{
+		size *= 1024 * 1024;
+	}
+	return size;
+}
+
+void cpu_topology_query(heap_t* heap, cpu_topology_t* topology)
+{
+	memset(topology, 0, sizeof(*topology));
+
+	int processor_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	topology->logical_count = processor_count < k_cpu_max_processors ? processor_count : k_cpu_max_processors;
+
+	char path[256];
+	char line[256];
+	for (int cpu = 0; cpu < topology->logical_count; ++cpu)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		add_core(topology, read_line(path, line, sizeof(line)) ? parse_processor_list(line) : 1ull << cpu);
+
+		for (int index = 0; ; ++index)
+		{
+			cpu_cache_t cache;
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+			if (!read_line(path, line, sizeof(line)))
+			{
+				break;
+			}
+			cache.level = atoi(line);
+
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, index);
+			read_line(path, line, sizeof(line));
+			cache.type = strncmp(line, "Data", 4) == 0 ? k_cpu_cache_data
+				: strncmp(line, "Instruction", 11) == 0 ? k_cpu_cache_instruction
+				: k_cpu_cache_unified;
+
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/size", cpu, index);
+			cache.size = read_line(path, line, sizeof(line)) ? parse_size(line) : 0;
+
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/coherency_line_size", cpu, index);
+			cache.line_size = read_line(path, line, sizeof(line)) ? atoi(line) : 0;
+
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+			cache.processor_mask = read_line(path, line, sizeof(line)) ? parse_processor_list(line) : 1ull << cpu;
+
+			add_cache(topology, &cache);
+		}
+	}
+}
+
+#endif
+
+void cpu_placement_default(const cpu_topology_t* topology, cpu_placement_t* placement)
+{
+	memset(placement, 0, sizeof(*placement));
+
+	if (topology->core_count < k_cpu_min_pinned_cores)
+	{
+		placement->worker_count = topology->logical_count > 1 ? topology->logical_count - 1 : 0;
+		return;
+	}
+
+	int last = topology->core_count - 1;
+	placement->main_mask = topology->core_masks[0];
+	placement->render_mask = topology->core_masks[1];
+	placement->io_mask = topology->core_masks[last];
+	for (int i = 2; i < last; ++i)
+	{
+		placement->worker_masks[placement->worker_count++] = topology->core_masks[i];
+	}
+}
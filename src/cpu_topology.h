@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct heap_t heap_t;
+
+// CPU topology and thread placement
+// Describes how logical processors group into physical cores and which caches they share,
+// and derives where the engine's threads should run.
+// Processor sets are bit masks over the first 64 logical processors.
+
+enum
+{
+	k_cpu_max_processors = 64,
+	k_cpu_max_caches = 64,
+};
+
+typedef enum cpu_cache_type_t
+{
+	k_cpu_cache_unified,
+	k_cpu_cache_data,
+	k_cpu_cache_instruction,
+} cpu_cache_type_t;
+
+// One cache, listed once no matter how many processors share it.
+typedef struct cpu_cache_t
+{
+	int level;
+	cpu_cache_type_t type;
+	size_t size;
+	int line_size;
+	// Logical processors sharing this cache.
+	uint64_t processor_mask;
+} cpu_cache_t;
+
+typedef struct cpu_topology_t
+{
+	int logical_count;
+	int core_count;
+	// For each physical core, its logical processors (SMT siblings).
+	uint64_t core_masks[k_cpu_max_processors];
+	int cache_count;
+	cpu_cache_t caches[k_cpu_max_caches];
+} cpu_topology_t;
+
+// Where each engine thread may run. A zero mask leaves a thread unrestricted.
+typedef struct cpu_placement_t
+{
+	// The game thread.
+	uint64_t main_mask;
+	uint64_t render_mask;
+	// File system, network and other mostly-blocked threads.
+	uint64_t io_mask;
+	int worker_count;
+	uint64_t worker_masks[k_cpu_max_processors];
+} cpu_placement_t;
+
+// Query the topology of the machine. Scratch memory is allocated out of the provided heap.
+void cpu_topology_query(heap_t* heap, cpu_topology_t* topology);
+
+// Build the default placement for a topology.
+// The game and render threads each get a physical core, I/O threads share the last core,
+// and each remaining core runs one job worker. With fewer than four cores,
+// nothing is pinned and there is a worker per spare logical processor.
+void cpu_placement_default(const cpu_topology_t* topology, cpu_placement_t* placement);
@@ -3,12 +3,15 @@
 #include "debug.h"
 #include "heap.h"
 
+#include <assert.h>
 #include <string.h>
 
 enum
 {
 	k_max_component_types = 64,
 	k_max_entities = 512,
+	k_max_observers = 16,
+	k_compact_moves_per_update = 16,
 };
 
 typedef enum entity_state_t
@@ -19,26 +22,54 @@ typedef enum entity_state_t
 	k_entity_pending_remove,
 } entity_state_t;
 
+typedef struct observer_t
+{
+	uint32_t event_mask;
+	uint64_t component_mask;
+	ecs_observer_callback_t callback;
+	void* user;
+} observer_t;
+
 typedef struct ecs_t
 {
 	heap_t* heap;
 	int global_sequence;
 
+	// Entity references name a handle, and each handle points at a storage slot.
+	// Compaction and sorting move entities between slots and patch the handle.
 	int sequences[k_max_entities];
+	int handle_slots[k_max_entities];
+
+	int slot_count;
+	int slot_handles[k_max_entities];
 	entity_state_t entity_states[k_max_entities];
 	uint64_t component_masks[k_max_entities];
 
 	void* components[k_max_component_types];
 	size_t component_type_sizes[k_max_component_types];
 	char component_type_names[k_max_component_types][32];
+
+	observer_t observers[k_max_observers];
+	int event_slots[k_max_entities];
+	ecs_entity_ref_t event_refs[k_max_entities];
 } ecs_t;
 
+static void dispatch_event(ecs_t* ecs, ecs_event_t event, int slot_count);
+static void trim_slot_count(ecs_t* ecs);
+static void move_slot(ecs_t* ecs, int from, int to);
+static void swap_slots(ecs_t* ecs, int a, int b);
+
 ecs_t* ecs_create(heap_t* heap)
 {
 	ecs_t* ecs = heap_alloc(heap, sizeof(ecs_t), 8);
 	memset(ecs, 0, sizeof(*ecs));
 	ecs->heap = heap;
 	ecs->global_sequence = 1;
+	for (int i = 0; i < k_max_entities; ++i)
+	{
+		ecs->handle_slots[i] = -1;
+		ecs->slot_handles[i] = -1;
+	}
 	return ecs;
 }
 
@@ -56,17 +87,61 @@ void ecs_destroy(ecs_t* ecs)
 
 void ecs_update(ecs_t* ecs)
 {
-	for (int i = 0; i < _countof(ecs->entity_states); ++i)
+	// Despawn is reported before the slots are released so observers can still read components.
+	int removed_count = 0;
+	for (int i = 0; i < ecs->slot_count; ++i)
+	{
+		if (ecs->entity_states[i] == k_entity_pending_remove)
+		{
+			ecs->event_slots[removed_count++] = i;
+		}
+	}
+	dispatch_event(ecs, k_ecs_event_despawn, removed_count);
+
+	int added_count = 0;
+	for (int i = 0; i < ecs->slot_count; ++i)
 	{
 		if (ecs->entity_states[i] == k_entity_pending_add)
 		{
 			ecs->entity_states[i] = k_entity_active;
+			ecs->event_slots[added_count++] = i;
 		}
 		else if (ecs->entity_states[i] == k_entity_pending_remove)
 		{
 			ecs->entity_states[i] = k_entity_unused;
+			ecs->handle_slots[ecs->slot_handles[i]] = -1;
+			ecs->slot_handles[i] = -1;
 		}
 	}
+	dispatch_event(ecs, k_ecs_event_spawn, added_count);
+
+	trim_slot_count(ecs);
+	ecs_compact(ecs, k_compact_moves_per_update);
+}
+
+int ecs_observer_add(ecs_t* ecs, uint32_t event_mask, uint64_t component_mask, ecs_observer_callback_t callback, void* user)
+{
+	for (int i = 0; i < _countof(ecs->observers); ++i)
+	{
+		if (ecs->observers[i].callback == NULL)
+		{
+			ecs->observers[i].event_mask = event_mask;
+			ecs->observers[i].component_mask = component_mask;
+			ecs->observers[i].callback = callback;
+			ecs->observers[i].user = user;
+			return i;
+		}
+	}
+	debug_print(k_print_warning, "Out of observers.");
+	return -1;
+}
+
+void ecs_observer_remove(ecs_t* ecs, int observer)
+{
+	if (observer >= 0 && observer < _countof(ecs->observers))
+	{
+		memset(&ecs->observers[observer], 0, sizeof(ecs->observers[observer]));
+	}
 }
 
 int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment)
@@ -94,14 +169,29 @@ size_t ecs_get_component_type_size(ecs_t* ecs, int component_type)
 
 ecs_entity_ref_t ecs_entity_add(ecs_t* ecs, uint64_t component_mask)
 {
-	for (int i = 0; i < _countof(ecs->entity_states); ++i)
+	// A handle is released in the same update that frees its slot, so a free slot implies a free handle.
+	for (int slot = 0; slot < _countof(ecs->entity_states); ++slot)
 	{
-		if (ecs->entity_states[i] == k_entity_unused)
+		if (ecs->entity_states[slot] == k_entity_unused)
 		{
-			ecs->entity_states[i] = k_entity_pending_add;
-			ecs->sequences[i] = ecs->global_sequence++;
-			ecs->component_masks[i] = component_mask;
-			return (ecs_entity_ref_t) { .entity = i, .sequence = ecs->sequences[i] };
+			for (int handle = 0; handle < _countof(ecs->handle_slots); ++handle)
+			{
+				if (ecs->handle_slots[handle] < 0)
+				{
+					ecs->handle_slots[handle] = slot;
+					ecs->sequences[handle] = ecs->global_sequence++;
+
+					ecs->slot_handles[slot] = handle;
+					ecs->entity_states[slot] = k_entity_pending_add;
+					ecs->component_masks[slot] = component_mask;
+					if (slot >= ecs->slot_count)
+					{
+						ecs->slot_count = slot + 1;
+					}
+					return (ecs_entity_ref_t) { .entity = handle, .sequence = ecs->sequences[handle] };
+				}
+			}
+			break;
 		}
 	}
 	debug_print(k_print_warning, "Out of entities.");
@@ -112,7 +202,7 @@ void ecs_entity_remove(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pending_add)
 {
 	if (ecs_is_entity_ref_valid(ecs, ref, allow_pending_add))
 	{
-		ecs->entity_states[ref.entity] = k_entity_pending_remove;
+		ecs->entity_states[ecs->handle_slots[ref.entity]] = k_entity_pending_remove;
 	}
 	else
 	{
@@ -123,8 +213,10 @@ void ecs_entity_remove(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pending_add)
 bool ecs_is_entity_ref_valid(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pending_add)
 {
 	return ref.entity >= 0 &&
+		ref.entity < k_max_entities &&
+		ecs->handle_slots[ref.entity] >= 0 &&
 		ecs->sequences[ref.entity] == ref.sequence &&
-		ecs->entity_states[ref.entity] >= (allow_pending_add ? k_entity_pending_add : k_entity_active);
+		ecs->entity_states[ecs->handle_slots[ref.entity]] >= (allow_pending_add ? k_entity_pending_add : k_entity_active);
 }
 
 void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type, bool allow_pending_add)
@@ -132,43 +224,219 @@ void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_t
 	if (ecs_is_entity_ref_valid(ecs, ref, allow_pending_add) && ecs->components[component_type])
 	{
 		char* components = ecs->components[component_type];
-		return &components[ecs->component_type_sizes[component_type] * ref.entity];
+		return &components[ecs->component_type_sizes[component_type] * ecs->handle_slots[ref.entity]];
 	}
 	return NULL;
 }
 
 ecs_query_t ecs_query_create(ecs_t* ecs, uint64_t mask)
 {
-	ecs_query_t query = { .component_mask = mask, .entity = -1 };
+	ecs_query_desc_t desc = { .required_mask = mask };
+	return ecs_query_create_desc(ecs, &desc);
+}
+
+ecs_query_t ecs_query_create_desc(ecs_t* ecs, const ecs_query_desc_t* desc)
+{
+	ecs_query_t query =
+	{
+		.component_mask = desc->required_mask,
+		.excluded_mask = desc->excluded_mask,
+		.optional_mask = desc->optional_mask,
+		.slot = -1,
+	};
 	ecs_query_next(ecs, &query);
 	return query;
 }
 
 bool ecs_query_is_valid(ecs_t* ecs, ecs_query_t* query)
 {
-	return query->entity >= 0;
+	return query->slot >= 0;
 }
 
 void ecs_query_next(ecs_t* ecs, ecs_query_t* query)
 {
-	for (int i = query->entity + 1; i < _countof(ecs->component_masks); ++i)
+	for (int i = query->slot + 1; i < ecs->slot_count; ++i)
 	{
-		if ((ecs->component_masks[i] & query->component_mask) == query->component_mask && ecs->entity_states[i] >= k_entity_active)
+		uint64_t mask = ecs->component_masks[i];
+		if ((mask & query->component_mask) == query->component_mask &&
+			(mask & query->excluded_mask) == 0 &&
+			ecs->entity_states[i] >= k_entity_active)
 		{
-			query->entity = i;
+			query->slot = i;
 			return;
 		}
 	}
-	query->entity = -1;
+	query->slot = -1;
 }
 
 void* ecs_query_get_component(ecs_t* ecs, ecs_query_t* query, int component_type)
 {
+	// Required components are known present; optional ones are checked against the entity.
+	uint64_t bit = 1ULL << component_type;
+	assert(((query->component_mask | query->optional_mask) & bit) != 0);
+	if ((query->component_mask & bit) == 0 && (ecs->component_masks[query->slot] & bit) == 0)
+	{
+		return NULL;
+	}
 	char* components = ecs->components[component_type];
-	return &components[ecs->component_type_sizes[component_type] * query->entity];
+	return &components[ecs->component_type_sizes[component_type] * query->slot];
 }
 
 ecs_entity_ref_t ecs_query_get_entity(ecs_t* ecs, ecs_query_t* query)
 {
-	return (ecs_entity_ref_t) { .entity = query->entity, .sequence = ecs->sequences[query->entity] };
+	int handle = ecs->slot_handles[query->slot];
+	return (ecs_entity_ref_t) { .entity = handle, .sequence = ecs->sequences[handle] };
+}
+
+int ecs_compact(ecs_t* ecs, int max_moves)
+{
+	int moves = 0;
+	int hole = 0;
+	while (moves < max_moves)
+	{
+		while (hole < ecs->slot_count && ecs->entity_states[hole] != k_entity_unused)
+		{
+			++hole;
+		}
+		if (hole >= ecs->slot_count)
+		{
+			break;
+		}
+
+		// The last slot is always in use after a trim.
+		move_slot(ecs, ecs->slot_count - 1, hole);
+		trim_slot_count(ecs);
+		++moves;
+	}
+	return moves;
+}
+
+static int compare_slots(ecs_t* ecs, int component_type, int a, int b, ecs_compare_callback_t compare, void* user)
+{
+	uint64_t bit = 1ULL << component_type;
+	bool has_a = (ecs->component_masks[a] & bit) != 0;
+	bool has_b = (ecs->component_masks[b] & bit) != 0;
+	if (has_a != has_b)
+	{
+		return has_a ? -1 : 1;
+	}
+	if (!has_a)
+	{
+		return 0;
+	}
+
+	char* components = ecs->components[component_type];
+	size_t size = ecs->component_type_sizes[component_type];
+	return compare(&components[size * a], &components[size * b], user);
+}
+
+void ecs_sort(ecs_t* ecs, int component_type, ecs_compare_callback_t compare, void* user)
+{
+	ecs_compact(ecs, k_max_entities);
+
+	// Insertion sort: stable, and close to linear when the order barely changes between frames.
+	for (int i = 1; i < ecs->slot_count; ++i)
+	{
+		for (int j = i; j > 0 && compare_slots(ecs, component_type, j - 1, j, compare, user) > 0; --j)
+		{
+			swap_slots(ecs, j - 1, j);
+		}
+	}
+}
+
+static void dispatch_event(ecs_t* ecs, ecs_event_t event, int slot_count)
+{
+	for (int o = 0; o < _countof(ecs->observers) && slot_count > 0; ++o)
+	{
+		observer_t* observer = &ecs->observers[o];
+		if (!observer->callback || !(observer->event_mask & event))
+		{
+			continue;
+		}
+
+		int count = 0;
+		for (int i = 0; i < slot_count; ++i)
+		{
+			int slot = ecs->event_slots[i];
+			if ((ecs->component_masks[slot] & observer->component_mask) == observer->component_mask)
+			{
+				int handle = ecs->slot_handles[slot];
+				ecs->event_refs[count++] = (ecs_entity_ref_t) { .entity = handle, .sequence = ecs->sequences[handle] };
+			}
+		}
+		if (count > 0)
+		{
+			observer->callback(ecs, event, ecs->event_refs, count, observer->user);
+		}
+	}
+}
+
+static void trim_slot_count(ecs_t* ecs)
+{
+	while (ecs->slot_count > 0 && ecs->entity_states[ecs->slot_count - 1] == k_entity_unused)
+	{
+		--ecs->slot_count;
+	}
+}
+
+static void move_slot(ecs_t* ecs, int from, int to)
+{
+	for (int i = 0; i < _countof(ecs->components); ++i)
+	{
+		if (ecs->components[i] && (ecs->component_masks[from] & (1ULL << i)))
+		{
+			char* components = ecs->components[i];
+			size_t size = ecs->component_type_sizes[i];
+			memcpy(&components[size * to], &components[size * from], size);
+		}
+	}
+
+	int handle = ecs->slot_handles[from];
+	ecs->handle_slots[handle] = to;
+	ecs->slot_handles[to] = handle;
+	ecs->entity_states[to] = ecs->entity_states[from];
+	ecs->component_masks[to] = ecs->component_masks[from];
+
+	ecs->slot_handles[from] = -1;
+	ecs->entity_states[from] = k_entity_unused;
+	ecs->component_masks[from] = 0;
+}
+
+static void swap_slots(ecs_t* ecs, int a, int b)
+{
+	uint64_t mask = ecs->component_masks[a] | ecs->component_masks[b];
+	for (int i = 0; i < _countof(ecs->components); ++i)
+	{
+		if (ecs->components[i] && (mask & (1ULL << i)))
+		{
+			char* components = ecs->components[i];
+			size_t size = ecs->component_type_sizes[i];
+			char* data_a = &components[size * a];
+			char* data_b = &components[size * b];
+			for (size_t offset = 0; offset < size;)
+			{
+				char temp[64];
+				size_t chunk = __min(size - offset, sizeof(temp));
+				memcpy(temp, &data_a[offset], chunk);
+				memcpy(&data_a[offset], &data_b[offset], chunk);
+				memcpy(&data_b[offset], temp, chunk);
+				offset += chunk;
+			}
+		}
+	}
+
+	int handle_a = ecs->slot_handles[a];
+	int handle_b = ecs->slot_handles[b];
+	ecs->slot_handles[a] = handle_b;
+	ecs->slot_handles[b] = handle_a;
+	ecs->handle_slots[handle_a] = b;
+	ecs->handle_slots[handle_b] = a;
+
+	entity_state_t state = ecs->entity_states[a];
+	ecs->entity_states[a] = ecs->entity_states[b];
+	ecs->entity_states[b] = state;
+
+	uint64_t component_mask = ecs->component_masks[a];
+	ecs->component_masks[a] = ecs->component_masks[b];
+	ecs->component_masks[b] = component_mask;
 }
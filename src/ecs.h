@@ -18,13 +18,42 @@ typedef struct ecs_entity_ref_t
 	int sequence;
 } ecs_entity_ref_t;
 
+// Describes which entities a query visits.
+// Entities must have every required component and none of the excluded components.
+// Optional components may be missing; ecs_query_get_component() returns NULL for them.
+typedef struct ecs_query_desc_t
+{
+	uint64_t required_mask;
+	uint64_t excluded_mask;
+	uint64_t optional_mask;
+} ecs_query_desc_t;
+
 // Working data for an active entity query.
 typedef struct ecs_query_t
 {
 	uint64_t component_mask;
-	int entity;
+	uint64_t excluded_mask;
+	uint64_t optional_mask;
+	int slot;
 } ecs_query_t;
 
+// Entity lifetime events reported to observers.
+// Components are fixed when an entity is spawned, so spawn and despawn
+// are also the points at which components are added and removed.
+typedef enum ecs_event_t
+{
+	k_ecs_event_spawn = 1 << 0,
+	k_ecs_event_despawn = 1 << 1,
+} ecs_event_t;
+
+// Receives a batch of entities that raised an event during ecs_update().
+// On spawn the entities are active. On despawn they are still valid and their components readable.
+typedef void (*ecs_observer_callback_t)(ecs_t* ecs, ecs_event_t event, const ecs_entity_ref_t* entities, int count, void* user);
+
+// Orders two components of the same type for ecs_sort().
+// Returns less than, equal to or greater than zero, like qsort.
+typedef int (*ecs_compare_callback_t)(const void* a, const void* b, void* user);
+
 // Create an entity component system.
 ecs_t* ecs_create(heap_t* heap);
 
@@ -32,8 +61,20 @@ ecs_t* ecs_create(heap_t* heap);
 void ecs_destroy(ecs_t* ecs);
 
 // Per-frame entity component system update.
+// Reports spawned and despawned entities to observers.
+// Also performs a small, bounded step of ecs_compact().
 void ecs_update(ecs_t* ecs);
 
+// Register a callback for entity events.
+// Event mask is a combination of ecs_event_t flags.
+// Only entities that have all components in component_mask are reported; zero matches every entity.
+// Entities added or removed by the callback are reported on a later update.
+// Returns an observer handle, or -1 if there is no space.
+int ecs_observer_add(ecs_t* ecs, uint32_t event_mask, uint64_t component_mask, ecs_observer_callback_t callback, void* user);
+
+// Unregister an observer previously returned from ecs_observer_add().
+void ecs_observer_remove(ecs_t* ecs, int observer);
+
 // Register a type of component with the entity system.
 int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment);
 
@@ -59,14 +100,30 @@ void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_t
 // Creates a new entity query by component type mask.
 ecs_query_t ecs_query_create(ecs_t* ecs, uint64_t mask);
 
+// Creates a new entity query from required, excluded and optional component sets.
+ecs_query_t ecs_query_create_desc(ecs_t* ecs, const ecs_query_desc_t* desc);
+
 // Determines if the query points at a valid entity.
 bool ecs_query_is_valid(ecs_t* ecs, ecs_query_t* query);
 
 // Advances the query to the next matching entity, if any.
 void ecs_query_next(ecs_t* ecs, ecs_query_t* query);
 
-// Get data for a component on the entity referenced by the query, if any.
+// Get data for a component on the entity referenced by the query.
+// The component type must be one of the query's required or optional components.
+// Returns NULL for an optional component the entity does not have.
 void* ecs_query_get_component(ecs_t* ecs, ecs_query_t* query, int component_type);
 
 // Get a entity reference for the current query location.
 ecs_entity_ref_t ecs_query_get_entity(ecs_t* ecs, ecs_query_t* query);
+
+// Moves up to max_moves entities from the end of storage into free slots nearer the front.
+// Entity references remain valid; component pointers obtained before the call do not.
+// Returns the number of entities moved.
+int ecs_compact(ecs_t* ecs, int max_moves);
+
+// Fully compacts storage, then orders entities with component_type using compare.
+// Entities without the component are placed after those that have it.
+// Queries visit entities in storage order, so this can group draws by mesh or shader.
+// Entity references remain valid; component pointers obtained before the call do not.
+void ecs_sort(ecs_t* ecs, int component_type, ecs_compare_callback_t compare, void* user);
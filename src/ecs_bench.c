@@ -0,0 +1,217 @@
+#include "ecs_bench.h"
+
+#include "debug.h"
+#include "ecs.h"
+#include "heap.h"
+#include "timer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum
+{
+	k_bench_component_types = 8,
+	k_bench_repetitions = 16,
+};
+
+// Largest count leaves room in the ECS for the replacements spawned by bench_structural.
+static const int k_bench_entity_counts[] = { 32, 64, 128, 256 };
+
+typedef struct bench_component_t
+{
+	float value[4];
+} bench_component_t;
+
+typedef struct bench_world_t
+{
+	ecs_t* ecs;
+	int types[k_bench_component_types];
+	uint64_t all_mask;
+	ecs_entity_ref_t refs[512];
+} bench_world_t;
+
+static void world_create(bench_world_t* world, heap_t* heap, int count)
+{
+	world->ecs = ecs_create(heap);
+	world->all_mask = 0;
+	for (int i = 0; i < k_bench_component_types; ++i)
+	{
+		world->types[i] = ecs_register_component_type(world->ecs, "bench", sizeof(bench_component_t), _Alignof(bench_component_t));
+		world->all_mask |= 1ULL << world->types[i];
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		world->refs[i] = ecs_entity_add(world->ecs, world->all_mask);
+	}
+	ecs_update(world->ecs);
+}
+
+static void world_destroy(bench_world_t* world)
+{
+	ecs_destroy(world->ecs);
+}
+
+static uint32_t xorshift32(uint32_t* state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static void bench_report(const char* test, int entities, int components, uint64_t ticks, size_t bytes_per_entity)
+{
+	double seconds = (double)ticks / (double)timer_get_ticks_per_second();
+	double ns_per_entity = seconds * 1000000000.0 / entities;
+	double mb_per_s = seconds > 0.0 ? (double)bytes_per_entity * entities / (seconds * 1024.0 * 1024.0) : 0.0;
+	debug_print(k_print_info, "ecs_bench test=%s entities=%d components=%d ns_per_entity=%.2f bytes_per_entity=%d mb_per_s=%.1f\n",
+		test, entities, components, ns_per_entity, (int)bytes_per_entity, mb_per_s);
+}
+
+// Spawn and destroy every entity, including the ecs_update calls that retire them.
+static void bench_churn(heap_t* heap, int count)
+{
+	bench_world_t world;
+	world_create(&world, heap, 0);
+
+	uint64_t best = UINT64_MAX;
+	for (int r = 0; r < k_bench_repetitions; ++r)
+	{
+		uint64_t t0 = timer_get_ticks();
+		for (int i = 0; i < count; ++i)
+		{
+			world.refs[i] = ecs_entity_add(world.ecs, world.all_mask);
+		}
+		ecs_update(world.ecs);
+		for (int i = 0; i < count; ++i)
+		{
+			ecs_entity_remove(world.ecs, world.refs[i], false);
+		}
+		ecs_update(world.ecs);
+		uint64_t t1 = timer_get_ticks();
+		best = __min(best, t1 - t0);
+	}
+	bench_report("churn", count, k_bench_component_types, best, 0);
+
+	world_destroy(&world);
+}
+
+// Iterate a query matching the first component_count components, touching each.
+static void bench_query(heap_t* heap, int count, int component_count)
+{
+	bench_world_t world;
+	world_create(&world, heap, count);
+
+	uint64_t mask = 0;
+	for (int i = 0; i < component_count; ++i)
+	{
+		mask |= 1ULL << world.types[i];
+	}
+
+	uint64_t best = UINT64_MAX;
+	for (int r = 0; r < k_bench_repetitions; ++r)
+	{
+		uint64_t t0 = timer_get_ticks();
+		for (ecs_query_t query = ecs_query_create(world.ecs, mask);
+			ecs_query_is_valid(world.ecs, &query);
+			ecs_query_next(world.ecs, &query))
+		{
+			for (int i = 0; i < component_count; ++i)
+			{
+				bench_component_t* comp = ecs_query_get_component(world.ecs, &query, world.types[i]);
+				comp->value[0] += 1.0f;
+			}
+		}
+		uint64_t t1 = timer_get_ticks();
+		best = __min(best, t1 - t0);
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "query_%d", component_count);
+	bench_report(name, count, component_count, best, sizeof(bench_component_t) * component_count);
+
+	world_destroy(&world);
+}
+
+// Look up one component through entity references in shuffled order.
+static void bench_random_ref(heap_t* heap, int count)
+{
+	bench_world_t world;
+	world_create(&world, heap, count);
+
+	uint32_t seed = 0x12345678;
+	for (int i = count - 1; i > 0; --i)
+	{
+		int j = (int)(xorshift32(&seed) % (uint32_t)(i + 1));
+		ecs_entity_ref_t temp = world.refs[i];
+		world.refs[i] = world.refs[j];
+		world.refs[j] = temp;
+	}
+
+	uint64_t best = UINT64_MAX;
+	for (int r = 0; r < k_bench_repetitions; ++r)
+	{
+		uint64_t t0 = timer_get_ticks();
+		for (int i = 0; i < count; ++i)
+		{
+			bench_component_t* comp = ecs_entity_get_component(world.ecs, world.refs[i], world.types[0], false);
+			comp->value[0] += 1.0f;
+		}
+		uint64_t t1 = timer_get_ticks();
+		best = __min(best, t1 - t0);
+	}
+	bench_report("random_ref", count, 1, best, sizeof(bench_component_t));
+
+	world_destroy(&world);
+}
+
+// Iterate a query while removing every other entity and spawning a replacement.
+static void bench_structural(heap_t* heap, int count)
+{
+	bench_world_t world;
+	world_create(&world, heap, count);
+
+	uint64_t mask = 1ULL << world.types[0];
+
+	uint64_t best = UINT64_MAX;
+	for (int r = 0; r < k_bench_repetitions; ++r)
+	{
+		uint64_t t0 = timer_get_ticks();
+		int index = 0;
+		for (ecs_query_t query = ecs_query_create(world.ecs, mask);
+			ecs_query_is_valid(world.ecs, &query);
+			ecs_query_next(world.ecs, &query))
+		{
+			bench_component_t* comp = ecs_query_get_component(world.ecs, &query, world.types[0]);
+			comp->value[0] += 1.0f;
+			if (index++ & 1)
+			{
+				ecs_entity_remove(world.ecs, ecs_query_get_entity(world.ecs, &query), false);
+				ecs_entity_add(world.ecs, world.all_mask);
+			}
+		}
+		ecs_update(world.ecs);
+		uint64_t t1 = timer_get_ticks();
+		best = __min(best, t1 - t0);
+	}
+	bench_report("structural", count, 1, best, sizeof(bench_component_t));
+
+	world_destroy(&world);
+}
+
+void ecs_bench_run(heap_t* heap)
+{
+	for (int c = 0; c < _countof(k_bench_entity_counts); ++c)
+	{
+		int count = k_bench_entity_counts[c];
+		bench_churn(heap, count);
+		for (int i = 1; i <= k_bench_component_types; ++i)
+		{
+			bench_query(heap, count, i);
+		}
+		bench_random_ref(heap, count);
+		bench_structural(heap, count);
+	}
+}
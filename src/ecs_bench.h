@@ -0,0 +1,12 @@
+#pragma once
+
+// Entity Component System benchmark
+// Headless measurements of ecs.c storage and query performance.
+
+typedef struct heap_t heap_t;
+
+// Run all ECS benchmarks at several entity counts.
+// Each result is printed as a single line:
+//   ecs_bench test=<name> entities=<n> components=<n> ns_per_entity=<f> bytes_per_entity=<n> mb_per_s=<f>
+// The format is stable so that runs can be compared after storage changes.
+void ecs_bench_run(heap_t* heap);
@@ -1,5 +1,7 @@
 #include "event.h"
 
+#if defined(_WIN32)
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -28,3 +30,63 @@ bool event_is_raised(event_t* event)
 {
 	return WaitForSingleObject(event, 0) == WAIT_OBJECT_0;
 }
+
+#else
+
+#include "atomic.h"
+#include "futex.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+enum
+{
+	k_event_clear = 0,
+	k_event_raised = 1,
+	k_event_clear_with_waiters = 2,
+};
+
+// Manual-reset futex event. Signaling only enters the kernel if a thread went to sleep on it.
+typedef struct event_t
+{
+	int state;
+} event_t;
+
+event_t* event_create()
+{
+	return calloc(1, sizeof(event_t));
+}
+
+void event_destroy(event_t* event)
+{
+	free(event);
+}
+
+void event_signal(event_t* event)
+{
+	if (atomic_exchange_explicit(&event->state, k_event_raised, k_atomic_release) == k_event_clear_with_waiters)
+	{
+		futex_wake(&event->state, INT_MAX);
+	}
+}
+
+void event_wait(event_t* event)
+{
+	int state = atomic_load(&event->state);
+	while (state != k_event_raised)
+	{
+		if (state == k_event_clear_with_waiters
+			|| atomic_compare_and_exchange(&event->state, k_event_clear, k_event_clear_with_waiters) == k_event_clear)
+		{
+			futex_wait(&event->state, k_event_clear_with_waiters);
+		}
+		state = atomic_load(&event->state);
+	}
+}
+
+bool event_is_raised(event_t* event)
+{
+	return atomic_load(&event->state) == k_event_raised;
+}
+
+#endif
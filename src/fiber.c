@@ -0,0 +1,125 @@
+#include "fiber.h"
+
+#include "heap.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <ucontext.h>
+#endif
+
+typedef struct fiber_t
+{
+	heap_t* heap;
+	fiber_func_t func;
+	void* data;
+#if defined(_WIN32)
+	LPVOID handle;
+#else
+	ucontext_t context;
+	void* stack;
+#endif
+} fiber_t;
+
+#if defined(_WIN32)
+
+static VOID CALLBACK fiber_start(LPVOID user)
+{
+	fiber_t* fiber = user;
+	fiber->func(fiber->data);
+}
+
+fiber_t* fiber_create(heap_t* heap, size_t stack_size, fiber_func_t func, void* data)
+{
+	fiber_t* fiber = heap_alloc(heap, sizeof(fiber_t), 8);
+	fiber->heap = heap;
+	fiber->func = func;
+	fiber->data = data;
+	fiber->handle = CreateFiber(stack_size, fiber_start, fiber);
+	return fiber;
+}
+
+void fiber_destroy(fiber_t* fiber)
+{
+	DeleteFiber(fiber->handle);
+	heap_free(fiber->heap, fiber);
+}
+
+fiber_t* fiber_convert_thread(heap_t* heap)
+{
+	fiber_t* fiber = heap_alloc(heap, sizeof(fiber_t), 8);
+	fiber->heap = heap;
+	fiber->func = NULL;
+	fiber->data = NULL;
+	fiber->handle = ConvertThreadToFiber(fiber);
+	return fiber;
+}
+
+void fiber_convert_back(fiber_t* fiber)
+{
+	ConvertFiberToThread();
+	heap_free(fiber->heap, fiber);
+}
+
+void fiber_switch(fiber_t* from, fiber_t* to)
+{
+	SwitchToFiber(to->handle);
+}
+
+#else
+
+// makecontext only passes int arguments, so the fiber pointer is split in two.
+static void fiber_start(unsigned int high, unsigned int low)
+{
+	fiber_t* fiber = (fiber_t*)(((uintptr_t)high << 16 << 16) | (uintptr_t)low);
+	fiber->func(fiber->data);
+}
+
+fiber_t* fiber_create(heap_t* heap, size_t stack_size, fiber_func_t func, void* data)
+{
+	fiber_t* fiber = heap_alloc(heap, sizeof(fiber_t), 16);
+	fiber->heap = heap;
+	fiber->func = func;
+	fiber->data = data;
+	fiber->stack = heap_alloc(heap, stack_size, 16);
+
+	getcontext(&fiber->context);
+	fiber->context.uc_stack.ss_sp = fiber->stack;
+	fiber->context.uc_stack.ss_size = stack_size;
+	fiber->context.uc_link = NULL;
+
+	uintptr_t address = (uintptr_t)fiber;
+	makecontext(&fiber->context, (void (*)(void))fiber_start, 2,
+		(unsigned int)(address >> 16 >> 16), (unsigned int)(address & 0xffffffff));
+	return fiber;
+}
+
+void fiber_destroy(fiber_t* fiber)
+{
+	heap_free(fiber->heap, fiber->stack);
+	heap_free(fiber->heap, fiber);
+}
+
+fiber_t* fiber_convert_thread(heap_t* heap)
+{
+	fiber_t* fiber = heap_alloc(heap, sizeof(fiber_t), 16);
+	fiber->heap = heap;
+	fiber->func = NULL;
+	fiber->data = NULL;
+	fiber->stack = NULL;
+	return fiber;
+}
+
+void fiber_convert_back(fiber_t* fiber)
+{
+	heap_free(fiber->heap, fiber);
+}
+
+void fiber_switch(fiber_t* from, fiber_t* to)
+{
+	swapcontext(&from->context, &to->context);
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+// User-mode fibers
+// Cooperative execution contexts with their own stacks.
+// A thread switches between fibers explicitly; no kernel transition is involved.
+
+typedef struct heap_t heap_t;
+
+// Handle to a fiber.
+typedef struct fiber_t fiber_t;
+
+// Entry point of a fiber. Must never return; switch to another fiber instead.
+typedef void (*fiber_func_t)(void* data);
+
+// Create a fiber that runs func with data the first time it is switched to.
+fiber_t* fiber_create(heap_t* heap, size_t stack_size, fiber_func_t func, void* data);
+
+// Destroy a fiber. It must not be running on any thread.
+void fiber_destroy(fiber_t* fiber);
+
+// Turn the calling thread into a fiber so it can switch to others.
+// Returns a fiber representing the thread's original context.
+fiber_t* fiber_convert_thread(heap_t* heap);
+
+// Undo fiber_convert_thread(). Must be called on the same thread, from its original context.
+void fiber_convert_back(fiber_t* fiber);
+
+// Save the calling context into from and resume to.
+// Returns when another fiber switches back to from, possibly on a different thread.
+void fiber_switch(fiber_t* from, fiber_t* to);
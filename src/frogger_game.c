@@ -37,6 +37,11 @@ typedef struct player_component_t
 	float speed;
 } player_component_t;
 
+typedef struct traffic_component_t
+{
+	int lane;
+} traffic_component_t;
+
 typedef struct name_component_t
 {
 	char name[32];
@@ -56,6 +61,7 @@ typedef struct frogger_game_t
 	int camera_type;
 	int model_type;
 	int player_type;
+	int traffic_type;
 	int name_type;
 	
 	int difficulty;
@@ -68,8 +74,10 @@ typedef struct frogger_game_t
 	gpu_mesh_info_t cube_mesh;
 	gpu_shader_info_t cube_shader;
 	gpu_shader_info_t traffic_shader;
-	fs_work_t* vertex_shader_work;
-	fs_work_t* fragment_shader_work;
+	fs_mapping_t* cube_vertex_shader;
+	fs_mapping_t* cube_fragment_shader;
+	fs_mapping_t* traffic_vertex_shader;
+	fs_mapping_t* traffic_fragment_shader;
 } frogger_game_t;
 
 typedef struct ImVec4
@@ -102,6 +110,7 @@ static void spawn_camera(frogger_game_t* game);
 static void update_players(frogger_game_t* game, engine_info_t* engine_info);
 static void update_camera(frogger_game_t* game, engine_info_t* engine_info);
 static void draw_models(frogger_game_t* game, engine_info_t* engine_info);
+static int model_component_compare(const void* a, const void* b, void* user);
 
 frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render, int difficulty)
 {
@@ -124,6 +133,7 @@ frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window,
 	game->camera_type = ecs_register_component_type(game->ecs, "camera", sizeof(camera_component_t), _Alignof(camera_component_t));
 	game->model_type = ecs_register_component_type(game->ecs, "model", sizeof(model_component_t), _Alignof(model_component_t));
 	game->player_type = ecs_register_component_type(game->ecs, "player", sizeof(player_component_t), _Alignof(player_component_t));
+	game->traffic_type = ecs_register_component_type(game->ecs, "traffic", sizeof(traffic_component_t), _Alignof(traffic_component_t));
 	game->name_type = ecs_register_component_type(game->ecs, "name", sizeof(name_component_t), _Alignof(name_component_t));
 
 	game->difficulty = difficulty;
@@ -157,31 +167,34 @@ void frogger_game_update(frogger_game_t* game, engine_info_t* engine_info)
 	ecs_update(game->ecs);
 	update_players(game, engine_info);
 	update_camera(game, engine_info);
+	ecs_sort(game->ecs, game->model_type, model_component_compare, NULL);
 	draw_models(game, engine_info);
 	render_push_done(game->render);
 }
 
 static void load_resources(frogger_game_t* game)
 {
-	game->vertex_shader_work = fs_read(game->fs, "shaders/greenCube.vert", game->heap, false, false);
-	game->fragment_shader_work = fs_read(game->fs, "shaders/greenCube.frag", game->heap, false, false);
+	// Shaders are handed to the GPU as they are on disk, so map them rather than copy them into the heap.
+	// They are not kept in fs_cache: after a restart the OS page cache serves the mapping without copying it.
+	game->cube_vertex_shader = fs_map(game->fs, "shaders/greenCube.vert", k_fs_map_hint_willneed);
+	game->cube_fragment_shader = fs_map(game->fs, "shaders/greenCube.frag", k_fs_map_hint_willneed);
 	game->cube_shader = (gpu_shader_info_t)
 	{
-		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
-		.vertex_shader_size = fs_work_get_size(game->vertex_shader_work),
-		.fragment_shader_data = fs_work_get_buffer(game->fragment_shader_work),
-		.fragment_shader_size = fs_work_get_size(game->fragment_shader_work),
+		.vertex_shader_data = (void*)fs_mapping_get_data(game->cube_vertex_shader),
+		.vertex_shader_size = fs_mapping_get_size(game->cube_vertex_shader),
+		.fragment_shader_data = (void*)fs_mapping_get_data(game->cube_fragment_shader),
+		.fragment_shader_size = fs_mapping_get_size(game->cube_fragment_shader),
 		.uniform_buffer_count = 1,
 	};
 
-	game->vertex_shader_work = fs_read(game->fs, "shaders/randomCube.vert", game->heap, false, false);
-	game->fragment_shader_work = fs_read(game->fs, "shaders/randomCube.frag", game->heap, false, false);
+	game->traffic_vertex_shader = fs_map(game->fs, "shaders/randomCube.vert", k_fs_map_hint_willneed);
+	game->traffic_fragment_shader = fs_map(game->fs, "shaders/randomCube.frag", k_fs_map_hint_willneed);
 	game->traffic_shader = (gpu_shader_info_t)
 	{
-		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
-		.vertex_shader_size = fs_work_get_size(game->vertex_shader_work),
-		.fragment_shader_data = fs_work_get_buffer(game->fragment_shader_work),
-		.fragment_shader_size = fs_work_get_size(game->fragment_shader_work),
+		.vertex_shader_data = (void*)fs_mapping_get_data(game->traffic_vertex_shader),
+		.vertex_shader_size = fs_mapping_get_size(game->traffic_vertex_shader),
+		.fragment_shader_data = (void*)fs_mapping_get_data(game->traffic_fragment_shader),
+		.fragment_shader_size = fs_mapping_get_size(game->traffic_fragment_shader),
 		.uniform_buffer_count = 1,
 	};
 
@@ -223,8 +236,10 @@ static void load_resources(frogger_game_t* game)
 
 static void unload_resources(frogger_game_t* game)
 {
-	fs_work_destroy(game->fragment_shader_work);
-	fs_work_destroy(game->vertex_shader_work);
+	fs_unmap(game->traffic_fragment_shader);
+	fs_unmap(game->traffic_vertex_shader);
+	fs_unmap(game->cube_fragment_shader);
+	fs_unmap(game->cube_vertex_shader);
 }
 
 static void spawn_player(frogger_game_t* game, int index)
@@ -234,6 +249,10 @@ static void spawn_player(frogger_game_t* game, int index)
 		(1ULL << game->model_type) |
 		(1ULL << game->player_type) |
 		(1ULL << game->name_type);
+	if (index != 0)
+	{
+		k_player_ent_mask |= (1ULL << game->traffic_type);
+	}
 	game->player_ent = ecs_entity_add(game->ecs, k_player_ent_mask);
 
 	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->transform_type, true);
@@ -257,6 +276,9 @@ static void spawn_player(frogger_game_t* game, int index)
 
 		name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->name_type, true);
 		strcpy_s(name_comp->name, sizeof(name_comp->name), "traffic");
+
+		traffic_component_t* traffic_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->traffic_type, true);
+		traffic_comp->lane = (index - 1) / game->num_traffic;
 		player_speed = (float) (game->difficulty * 5 + rand() % 5);
 		shader = &game->traffic_shader;
 	}
@@ -289,82 +311,85 @@ static void update_players(frogger_game_t* game, engine_info_t* engine_info)
 
 	uint32_t key_mask = wm_get_key_mask(game->window);
 
-	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->player_type);
+	ecs_query_desc_t k_player_query =
+	{
+		.required_mask = (1ULL << game->transform_type) | (1ULL << game->player_type),
+		.excluded_mask = (1ULL << game->traffic_type),
+	};
+	ecs_query_desc_t k_traffic_query =
+	{
+		.required_mask = (1ULL << game->transform_type) | (1ULL << game->player_type) | (1ULL << game->traffic_type),
+	};
 
-	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask);
+	for (ecs_query_t query = ecs_query_create_desc(game->ecs, &k_player_query);
 		ecs_query_is_valid(game->ecs, &query);
 		ecs_query_next(game->ecs, &query))
 	{
 		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-		player_component_t* player_comp = ecs_query_get_component(game->ecs, &query, game->player_type);
-		name_component_t* name_comp = ecs_query_get_component(game->ecs, &query, game->name_type);
 
-		if (!strcmp(name_comp->name, "player"))
-		{
-			transform_t move;
-			transform_identity(&move);
+		transform_t move;
+		transform_identity(&move);
 
-			if (key_mask & k_key_up)
-			{
-				move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_up(), engine_info->playerSpeed*dt));
-				if (transform_comp->transform.translation.z > 15.0f)
-				{
-					transform_comp->transform.translation.z = -15.0f;
-				}
-			}
-			if (key_mask & k_key_down)
-			{
-				if (transform_comp->transform.translation.z > -15.0f)
-				{
-					move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_up(), -engine_info->playerSpeed*dt));
-				}
-			}
-			if (key_mask & k_key_left)
+		if (key_mask & k_key_up)
+		{
+			move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_up(), engine_info->playerSpeed*dt));
+			if (transform_comp->transform.translation.z > 15.0f)
 			{
-				move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), -engine_info->playerSpeed*dt));
+				transform_comp->transform.translation.z = -15.0f;
 			}
-			if (key_mask & k_key_right)
+		}
+		if (key_mask & k_key_down)
+		{
+			if (transform_comp->transform.translation.z > -15.0f)
 			{
-				move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), engine_info->playerSpeed*dt));
+				move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_up(), -engine_info->playerSpeed*dt));
 			}
+		}
+		if (key_mask & k_key_left)
+		{
+			move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), -engine_info->playerSpeed*dt));
+		}
+		if (key_mask & k_key_right)
+		{
+			move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), engine_info->playerSpeed*dt));
+		}
 
-			transform_multiply(&transform_comp->transform, &move);
+		transform_multiply(&transform_comp->transform, &move);
 
-			for (ecs_query_t query_collision = ecs_query_create(game->ecs, k_query_mask);
-				ecs_query_is_valid(game->ecs, &query_collision);
-				ecs_query_next(game->ecs, &query_collision))
-			{
-				transform_component_t* other_transform_comp = ecs_query_get_component(game->ecs, &query_collision, game->transform_type);
-				player_component_t* other_player_comp = ecs_query_get_component(game->ecs, &query_collision, game->player_type);
-				name_component_t* other_name_comp = ecs_query_get_component(game->ecs, &query_collision, game->name_type);
-
-				transform_identity(&move);
-				if (!strcmp(other_name_comp->name, "traffic"))
-				{
-					if (transform_comp->transform.translation.z > other_transform_comp->transform.translation.z-2.0f 
-						&& transform_comp->transform.translation.z < other_transform_comp->transform.translation.z+2.0f
-						&& transform_comp->transform.translation.y > other_transform_comp->transform.translation.y - 2.0f - (other_transform_comp->transform.scale.y-1)
-						&& transform_comp->transform.translation.y < other_transform_comp->transform.translation.y + 2.0f + (other_transform_comp->transform.scale.y-1)
-						)
-					{
-						transform_comp->transform.translation.z = -15.0f;
-					}
-				}
-			}
-		}
-		else 
+		for (ecs_query_t query_collision = ecs_query_create_desc(game->ecs, &k_traffic_query);
+			ecs_query_is_valid(game->ecs, &query_collision);
+			ecs_query_next(game->ecs, &query_collision))
 		{
-			transform_t move;
-			transform_identity(&move);
+			transform_component_t* other_transform_comp = ecs_query_get_component(game->ecs, &query_collision, game->transform_type);
 
-			move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), player_comp->speed * dt));
-			if (transform_comp->transform.translation.y > 37.5f)
+			if (transform_comp->transform.translation.z > other_transform_comp->transform.translation.z-2.0f 
+				&& transform_comp->transform.translation.z < other_transform_comp->transform.translation.z+2.0f
+				&& transform_comp->transform.translation.y > other_transform_comp->transform.translation.y - 2.0f - (other_transform_comp->transform.scale.y-1)
+				&& transform_comp->transform.translation.y < other_transform_comp->transform.translation.y + 2.0f + (other_transform_comp->transform.scale.y-1)
+				)
 			{
-				move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), -75.0f));
+				transform_comp->transform.translation.z = -15.0f;
 			}
+		}
+	}
+
+	for (ecs_query_t query = ecs_query_create_desc(game->ecs, &k_traffic_query);
+		ecs_query_is_valid(game->ecs, &query);
+		ecs_query_next(game->ecs, &query))
+	{
+		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
+		player_component_t* player_comp = ecs_query_get_component(game->ecs, &query, game->player_type);
+
+		transform_t move;
+		transform_identity(&move);
 
-			transform_multiply(&transform_comp->transform, &move);
+		move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), player_comp->speed * dt));
+		if (transform_comp->transform.translation.y > 37.5f)
+		{
+			move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), -75.0f));
 		}
+
+		transform_multiply(&transform_comp->transform, &move);
 	}
 }
 
@@ -404,6 +429,22 @@ static void update_camera(frogger_game_t* game, engine_info_t* engine_info)
 	}
 }
 
+// Group models by shader, then mesh, so the render thread rebinds as little as possible.
+static int model_component_compare(const void* a, const void* b, void* user)
+{
+	const model_component_t* model_a = a;
+	const model_component_t* model_b = b;
+	if (model_a->shader_info != model_b->shader_info)
+	{
+		return (uintptr_t)model_a->shader_info < (uintptr_t)model_b->shader_info ? -1 : 1;
+	}
+	if (model_a->mesh_info != model_b->mesh_info)
+	{
+		return (uintptr_t)model_a->mesh_info < (uintptr_t)model_b->mesh_info ? -1 : 1;
+	}
+	return 0;
+}
+
 static void draw_models(frogger_game_t* game, engine_info_t* engine_info)
 {
 	uint64_t k_camera_query_mask = (1ULL << game->camera_type);
@@ -1,139 +1,491 @@
 #include "fs.h"
 
-#include "event.h"
+#include "atomic.h"
+#include "cpu_topology.h"
+#include "futex.h"
+#include "future.h"
 #include "heap.h"
 #include "queue.h"
 #include "thread.h"
+#include "timer.h"
+#include "uring.h"
 #include "lz4/lz4.h"
+#include "lz4/lz4frame.h"
+#include "lz4/lz4hc.h"
+#include "lz4/xxhash.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-// Insipred by Johnny L 
+enum
+{
+	k_fs_pool_threads = 4,
+
+	// Each io_uring operation covers at most one chunk, so large files keep several requests in flight.
+	k_fs_uring_entries = 128,
+	k_fs_uring_ops = 64,
+	k_fs_uring_chunk_size = 512 * 1024,
+	k_fs_uring_wake = 0,
+
+	// Frames from other LZ4 encoders are streamed through the decoder one chunk at a time.
+	k_fs_lz4_chunk_size = 256 * 1024,
+
+	// Compressed files are split into independent blocks, coded in parallel by the codec threads in batches.
+	// Two batches are in flight at once: one being coded while the other is read or written.
+	k_fs_lz4_block_size = 1024 * 1024,
+	k_fs_lz4_max_batch_blocks = 16,
+	k_fs_max_codec_threads = 15,
+};
+
+// Work waiting at each priority, plus one ticket per item so threads can block for work of any priority.
+// A NULL ticket tells a thread to exit.
+typedef struct work_queue_t
+{
+	queue_t* tickets;
+	queue_t* priorities[k_fs_priority_count];
+} work_queue_t;
+
+// Insipred by Johnny L
 typedef struct fs_t
 {
 	heap_t* heap;
-	queue_t* file_queue;
-	thread_t* file_thread;
-	queue_t* compressed_file_queue;
+	fs_backend_t backend;
+	work_queue_t file_queue;
+	thread_t* file_threads[k_fs_pool_threads];
+	int file_thread_count;
+	work_queue_t compressed_file_queue;
 	thread_t* compressed_file_thread;
+	fs_priority_stats_t stats[k_fs_priority_count];
+
+	// Block compression threads. The compressed file thread codes blocks too while it waits on them.
+	queue_t* codec_queue;
+	thread_t* codec_threads[k_fs_max_codec_threads];
+	int codec_thread_count;
+	int codec_batch_blocks;
+
+	// io_uring backend: the ring thread sleeps in the kernel, and new work wakes it through an eventfd.
+	uring_t* uring;
+	int wake_fd;
+	int wake_pending;
+	int stopping;
 } fs_t;
 
 typedef enum fs_work_op_t
 {
 	k_fs_work_op_read,
 	k_fs_work_op_write,
+	k_fs_work_op_compress,
+	k_fs_work_op_archive_read,
+	k_fs_work_op_read_range,
 } fs_work_op_t;
 
+// Work is queued until a thread starts it, unless it is cancelled first.
+typedef enum fs_work_state_t
+{
+	k_fs_work_state_queued,
+	k_fs_work_state_started,
+	k_fs_work_state_cancelled,
+} fs_work_state_t;
+
 typedef struct fs_work_t
 {
+	fs_t* fs;
 	heap_t* heap;
 	fs_work_op_t op;
+	fs_priority_t priority;
+	int state;
+	uint64_t queued_ticks;
+
+	// Held by the caller, and by the queue until a thread has finished with the work,
+	// so cancelled work can be destroyed while it is still queued.
+	int references;
 	char path[1024];
 	bool null_terminate;
 	bool use_compression;
+	int compression_level;
 	void* buffer;
 	size_t size;
-	event_t* done;
+	future_t* done;
 	int result;
+
+	// Data compressed, or an archive entry read, in place.
+	const char* source;
+	size_t source_size;
+
+	// Range reads: an optional open file, and where in it to start.
+	fs_file_t* file;
+	uint64_t offset;
+
+	// io_uring backend state.
+	struct fs_work_t* next;
+	int fd;
+	size_t next_offset;
+	int ops_in_flight;
+	bool issuing;
 } fs_work_t;
 
+typedef struct fs_mapping_t
+{
+	heap_t* heap;
+	void* data;
+	size_t size;
+} fs_mapping_t;
+
+static void work_queue_create(work_queue_t* queue, heap_t* heap, int capacity)
+{
+	queue->tickets = queue_create(heap, capacity * k_fs_priority_count);
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		queue->priorities[i] = queue_create(heap, capacity);
+	}
+}
+
+static void work_queue_destroy(work_queue_t* queue)
+{
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		queue_destroy(queue->priorities[i]);
+	}
+	queue_destroy(queue->tickets);
+}
+
+static void work_queue_push(work_queue_t* queue, fs_work_t* work)
+{
+	queue_push(queue->priorities[work->priority], work);
+	queue_push(queue->tickets, work);
+}
+
+static void work_queue_push_exit(work_queue_t* queue)
+{
+	queue_push(queue->tickets, NULL);
+}
+
+// Take the most urgent work. Each ticket is pushed after its work, so a ticket always has work to match.
+static fs_work_t* work_queue_take(work_queue_t* queue)
+{
+	while (true)
+	{
+		for (int i = 0; i < k_fs_priority_count; ++i)
+		{
+			fs_work_t* work = queue_try_pop(queue->priorities[i]);
+			if (work)
+			{
+				return work;
+			}
+		}
+	}
+}
+
+// Block for the most urgent work, or NULL when the thread should exit.
+static fs_work_t* work_queue_pop(work_queue_t* queue)
+{
+	return queue_pop(queue->tickets) ? work_queue_take(queue) : NULL;
+}
+
+static fs_work_t* work_queue_try_pop(work_queue_t* queue)
+{
+	return queue_try_pop(queue->tickets) ? work_queue_take(queue) : NULL;
+}
+
 static int file_thread_func(void* user);
 static int compressed_file_thread_func(void* user);
+static int uring_thread_func(void* user);
+static int codec_thread_func(void* user);
 
 fs_t* fs_create(heap_t* heap, int queue_capacity)
+{
+	return fs_create_backend(heap, queue_capacity, k_fs_backend_default);
+}
+
+fs_t* fs_create_backend(heap_t* heap, int queue_capacity, fs_backend_t backend)
 {
 	fs_t* fs = heap_alloc(heap, sizeof(fs_t), 8);
+	memset(fs, 0, sizeof(*fs));
 	fs->heap = heap;
-	fs->file_queue = queue_create(heap, queue_capacity);
-	fs->compressed_file_queue = queue_create(heap, queue_capacity);
-	fs->file_thread = thread_create(file_thread_func, fs);
+	work_queue_create(&fs->file_queue, heap, queue_capacity);
+	work_queue_create(&fs->compressed_file_queue, heap, queue_capacity);
+
+#if !defined(_WIN32)
+	if (backend != k_fs_backend_threads)
+	{
+		fs->uring = uring_create(heap, k_fs_uring_entries);
+		fs->wake_fd = fs->uring ? eventfd(0, EFD_CLOEXEC) : -1;
+		if (fs->uring && fs->wake_fd < 0)
+		{
+			uring_destroy(fs->uring);
+			fs->uring = NULL;
+		}
+	}
+#endif
+
+	if (fs->uring)
+	{
+		fs->backend = k_fs_backend_uring;
+		fs->file_threads[0] = thread_create(uring_thread_func, fs);
+		fs->file_thread_count = 1;
+		thread_set_name(fs->file_threads[0], "fs_uring");
+	}
+	else
+	{
+		fs->backend = k_fs_backend_threads;
+		fs->file_thread_count = k_fs_pool_threads;
+		for (int i = 0; i < fs->file_thread_count; ++i)
+		{
+			fs->file_threads[i] = thread_create(file_thread_func, fs);
+			thread_set_name(fs->file_threads[i], "fs_file");
+		}
+	}
+
 	fs->compressed_file_thread = thread_create(compressed_file_thread_func, fs);
+	thread_set_name(fs->compressed_file_thread, "fs_compressed");
+
+	fs->codec_queue = queue_create(heap, k_fs_lz4_max_batch_blocks * 2);
+	fs->codec_thread_count = __max(__min(thread_get_processor_count() - 1, k_fs_max_codec_threads), 0);
+	fs->codec_batch_blocks = __min((fs->codec_thread_count + 1) * 2, k_fs_lz4_max_batch_blocks);
+	for (int i = 0; i < fs->codec_thread_count; ++i)
+	{
+		fs->codec_threads[i] = thread_create(codec_thread_func, fs);
+		thread_set_name(fs->codec_threads[i], "fs_lz4");
+	}
 	return fs;
 }
 
+static void wake_uring_thread(fs_t* fs)
+{
+#if !defined(_WIN32)
+	// Only the first request since the ring thread last looked needs to make a system call.
+	if (atomic_exchange(&fs->wake_pending, 1) == 0)
+	{
+		uint64_t one = 1;
+		while (write(fs->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+		{
+		}
+	}
+#endif
+}
+
 void fs_destroy(fs_t* fs)
 {
-	queue_push(fs->file_queue, NULL);
-	thread_destroy(fs->file_thread);
-	queue_destroy(fs->file_queue);
-	queue_push(fs->compressed_file_queue, NULL);
+	if (fs->uring)
+	{
+		atomic_store(&fs->stopping, 1);
+		atomic_store(&fs->wake_pending, 0);
+		wake_uring_thread(fs);
+		thread_destroy(fs->file_threads[0]);
+		uring_destroy(fs->uring);
+#if !defined(_WIN32)
+		close(fs->wake_fd);
+#endif
+	}
+	else
+	{
+		for (int i = 0; i < fs->file_thread_count; ++i)
+		{
+			work_queue_push_exit(&fs->file_queue);
+		}
+		for (int i = 0; i < fs->file_thread_count; ++i)
+		{
+			thread_destroy(fs->file_threads[i]);
+		}
+	}
+	work_queue_destroy(&fs->file_queue);
+	work_queue_push_exit(&fs->compressed_file_queue);
 	thread_destroy(fs->compressed_file_thread);
-	queue_destroy(fs->compressed_file_queue);
+	work_queue_destroy(&fs->compressed_file_queue);
+	for (int i = 0; i < fs->codec_thread_count; ++i)
+	{
+		queue_push(fs->codec_queue, NULL);
+	}
+	for (int i = 0; i < fs->codec_thread_count; ++i)
+	{
+		thread_destroy(fs->codec_threads[i]);
+	}
+	queue_destroy(fs->codec_queue);
 	heap_free(fs->heap, fs);
 }
 
-fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression)
+void fs_set_placement(fs_t* fs, const cpu_placement_t* placement)
+{
+	for (int i = 0; i < fs->file_thread_count; ++i)
+	{
+		thread_set_affinity(fs->file_threads[i], placement->io_mask);
+	}
+	thread_set_affinity(fs->compressed_file_thread, placement->io_mask);
+	// Codec threads are compute bound, so they stay free to run on any core.
+}
+
+fs_backend_t fs_get_backend(fs_t* fs)
+{
+	return fs->backend;
+}
+
+static fs_work_t* work_create(fs_t* fs, fs_work_op_t op, const char* path, heap_t* heap, fs_priority_t priority)
 {
 	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
+	memset(work, 0, sizeof(*work));
+	work->fs = fs;
 	work->heap = heap;
-	work->op = k_fs_work_op_read;
-	strcpy_s(work->path, sizeof(work->path), path);
-	work->buffer = NULL;
-	work->size = 0;
-	work->done = event_create();
-	work->result = 0;
-	work->null_terminate = null_terminate;
-	work->use_compression = use_compression;
-	
-	if (use_compression) 
+	work->op = op;
+	work->priority = priority;
+	work->state = k_fs_work_state_queued;
+	work->references = 1;
+	snprintf(work->path, sizeof(work->path), "%s", path);
+	work->done = future_create(fs->heap);
+	work->fd = -1;
+	return work;
+}
+
+static void work_release(fs_work_t* work)
+{
+	if (atomic_decrement(&work->references) == 1)
 	{
-		queue_push(fs->compressed_file_queue, work);
+		future_release(work->done);
+		heap_free(work->fs->heap, work);
 	}
-	else 
+}
+
+static void stats_add_max(uint64_t* address, uint64_t value)
+{
+	int64_t current = atomic_load_64((int64_t*)address);
+	while ((uint64_t)current < value)
 	{
-		queue_push(fs->file_queue, work);
+		int64_t previous = atomic_compare_and_exchange_64((int64_t*)address, current, (int64_t)value);
+		if (previous == current)
+		{
+			break;
+		}
+		current = previous;
 	}
+}
 
-	return work;
+// Claim queued work for a thread and record how long it waited.
+// Returns false if the work was cancelled, after dropping the queue's reference to it.
+static bool work_begin(fs_work_t* work)
+{
+	if (atomic_compare_and_exchange(&work->state, k_fs_work_state_queued, k_fs_work_state_started) != k_fs_work_state_queued)
+	{
+		work_release(work);
+		return false;
+	}
+
+	fs_priority_stats_t* stats = &work->fs->stats[work->priority];
+	uint64_t wait_ticks = timer_get_ticks() - work->queued_ticks;
+	atomic_increment_64(&stats->started);
+	atomic_fetch_add_64((int64_t*)&stats->wait_ticks, (int64_t)wait_ticks);
+	stats_add_max(&stats->max_wait_ticks, wait_ticks);
+	return true;
 }
 
-fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression)
+static void work_submit(fs_t* fs, fs_work_t* work)
 {
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
-	work->heap = fs->heap;
-	work->op = k_fs_work_op_write;
-	strcpy_s(work->path, sizeof(work->path), path);
-	work->buffer = (void*)buffer;
-	work->size = size;
-	work->done = event_create();
-	work->result = 0;
-	work->null_terminate = false;
-	work->use_compression = use_compression;
+	atomic_increment(&work->references);
+	work->queued_ticks = timer_get_ticks();
 
-	if (use_compression)
+	// Work on memory never waits on I/O, so it stays off the I/O threads.
+	if (work->use_compression || work->op == k_fs_work_op_compress || work->op == k_fs_work_op_archive_read)
 	{
-		char dest[1000];
-		int compressed_size = LZ4_compress_default((const char*)buffer, dest, (int)strlen(buffer), sizeof(dest));
-		dest[compressed_size] = 0;
-		work->buffer = (void*) dest;
-		//work->size = compressed_size;
-		queue_push(fs->compressed_file_queue, work);
+		work_queue_push(&fs->compressed_file_queue, work);
 	}
 	else
 	{
-		queue_push(fs->file_queue, work);
+		work_queue_push(&fs->file_queue, work);
+		if (fs->uring)
+		{
+			wake_uring_thread(fs);
+		}
 	}
+}
+
+fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression, fs_priority_t priority)
+{
+	fs_work_t* work = work_create(fs, k_fs_work_op_read, path, heap, priority);
+	work->null_terminate = null_terminate;
+	work->use_compression = use_compression;
+	work_submit(fs, work);
+	return work;
+}
+
+fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, int compression_level, fs_priority_t priority)
+{
+	fs_work_t* work = work_create(fs, k_fs_work_op_write, path, fs->heap, priority);
+	work->buffer = (void*)buffer;
+	work->size = size;
+	work->use_compression = compression_level > k_fs_compression_none;
+	work->compression_level = compression_level;
+	work_submit(fs, work);
+	return work;
+}
 
+fs_work_t* fs_compress(fs_t* fs, const void* buffer, size_t size, heap_t* heap, int compression_level, fs_priority_t priority)
+{
+	fs_work_t* work = work_create(fs, k_fs_work_op_compress, "", heap, priority);
+	work->buffer = (void*)buffer;
+	work->size = size;
+	work->compression_level = __max(compression_level, k_fs_compression_fast);
+	work_submit(fs, work);
 	return work;
 }
 
+bool fs_work_cancel(fs_work_t* work)
+{
+	if (!work || atomic_compare_and_exchange(&work->state, k_fs_work_state_queued, k_fs_work_state_cancelled) != k_fs_work_state_queued)
+	{
+		return false;
+	}
+	atomic_increment_64(&work->fs->stats[work->priority].cancelled);
+	work->result = k_fs_result_cancelled;
+	future_complete(work->done, work->result);
+	return true;
+}
+
+void fs_get_priority_stats(fs_t* fs, fs_priority_t priority, fs_priority_stats_t* stats)
+{
+	fs_priority_stats_t* source = &fs->stats[priority];
+	stats->started = atomic_load_64(&source->started);
+	stats->cancelled = atomic_load_64(&source->cancelled);
+	stats->wait_ticks = (uint64_t)atomic_load_64((int64_t*)&source->wait_ticks);
+	stats->max_wait_ticks = (uint64_t)atomic_load_64((int64_t*)&source->max_wait_ticks);
+}
+
 bool fs_work_is_done(fs_work_t* work)
 {
-	return work ? event_is_raised(work->done) : true;
+	return work ? future_is_done(work->done) : true;
 }
 
 void fs_work_wait(fs_work_t* work)
 {
 	if (work)
 	{
-		event_wait(work->done);
+		future_wait(work->done);
+	}
+}
+
+void fs_work_wait_job(fs_work_t* work, job_system_t* jobs)
+{
+	if (work)
+	{
+		future_wait_job(work->done, jobs);
 	}
 }
 
+future_t* fs_work_get_future(fs_work_t* work)
+{
+	return work->done;
+}
+
 int fs_work_get_result(fs_work_t* work)
 {
 	fs_work_wait(work);
@@ -156,37 +508,172 @@ void fs_work_destroy(fs_work_t* work)
 {
 	if (work)
 	{
-		event_wait(work->done);
-		event_destroy(work->done);
-		heap_free(work->heap, work);
+		future_wait(work->done);
+		work_release(work);
 	}
 }
 
-static void file_read(fs_work_t* work)
+#if defined(_WIN32)
+
+fs_mapping_t* fs_map(fs_t* fs, const char* path, uint32_t hints)
 {
 	wchar_t wide_path[1024];
-	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
 	{
-		work->result = -1;
-		event_signal(work->done);
-		return;
+		return NULL;
+	}
+
+	DWORD flags = FILE_ATTRIBUTE_NORMAL;
+	flags |= (hints & k_fs_map_hint_sequential) ? FILE_FLAG_SEQUENTIAL_SCAN : 0;
+	flags |= (hints & k_fs_map_hint_random) ? FILE_FLAG_RANDOM_ACCESS : 0;
+	HANDLE file = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return NULL;
+	}
+
+	void* data = NULL;
+	if (size.QuadPart > 0)
+	{
+		HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (mapping)
+		{
+			// The view keeps the mapping and file alive.
+			CloseHandle(mapping);
+		}
+		if (!data)
+		{
+			CloseHandle(file);
+			return NULL;
+		}
+	}
+	CloseHandle(file);
+
+	if (data && (hints & k_fs_map_hint_willneed))
+	{
+		WIN32_MEMORY_RANGE_ENTRY range = { data, (SIZE_T)size.QuadPart };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+
+	fs_mapping_t* result = heap_alloc(fs->heap, sizeof(fs_mapping_t), 8);
+	result->heap = fs->heap;
+	result->data = data;
+	result->size = (size_t)size.QuadPart;
+	return result;
+}
+
+void fs_unmap(fs_mapping_t* mapping)
+{
+	if (mapping)
+	{
+		if (mapping->data)
+		{
+			UnmapViewOfFile(mapping->data);
+		}
+		heap_free(mapping->heap, mapping);
+	}
+}
+
+#else
+
+fs_mapping_t* fs_map(fs_t* fs, const char* path, uint32_t hints)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void* data = NULL;
+	size_t size = (size_t)info.st_size;
+	if (size > 0)
+	{
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			return NULL;
+		}
+
+		int advice = (hints & k_fs_map_hint_sequential) ? MADV_SEQUENTIAL : (hints & k_fs_map_hint_random) ? MADV_RANDOM : MADV_NORMAL;
+		madvise(data, size, advice);
+		if (hints & k_fs_map_hint_willneed)
+		{
+			madvise(data, size, MADV_WILLNEED);
+		}
+	}
+	// The mapping keeps the file alive.
+	close(fd);
+
+	fs_mapping_t* result = heap_alloc(fs->heap, sizeof(fs_mapping_t), 8);
+	result->heap = fs->heap;
+	result->data = data;
+	result->size = size;
+	return result;
+}
+
+void fs_unmap(fs_mapping_t* mapping)
+{
+	if (mapping)
+	{
+		if (mapping->data)
+		{
+			munmap(mapping->data, mapping->size);
+		}
+		heap_free(mapping->heap, mapping);
+	}
+}
+
+#endif
+
+const void* fs_mapping_get_data(fs_mapping_t* mapping)
+{
+	return mapping ? mapping->data : NULL;
+}
+
+size_t fs_mapping_get_size(fs_mapping_t* mapping)
+{
+	return mapping ? mapping->size : 0;
+}
+
+#if defined(_WIN32)
+
+// Blocking whole-file read and write. Return zero or an error code.
+static int file_read_blocking(fs_work_t* work)
+{
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return -1;
 	}
 
 	HANDLE handle = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL,
 		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (handle == INVALID_HANDLE_VALUE)
 	{
-		work->result = GetLastError();
-		event_signal(work->done);
-		return;
+		return GetLastError();
 	}
 
 	if (!GetFileSizeEx(handle, (PLARGE_INTEGER)&work->size))
 	{
-		work->result = GetLastError();
+		int result = GetLastError();
 		CloseHandle(handle);
-		event_signal(work->done);
-		return;
+		return result;
 	}
 
 	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
@@ -194,89 +681,1446 @@ static void file_read(fs_work_t* work)
 	DWORD bytes_read = 0;
 	if (!ReadFile(handle, work->buffer, (DWORD)work->size, &bytes_read, NULL))
 	{
-		work->result = GetLastError();
+		int result = GetLastError();
 		CloseHandle(handle);
-		event_signal(work->done);
-		return;
+		return result;
 	}
 
 	work->size = bytes_read;
-	if (work->null_terminate)
-	{
-		((char*)work->buffer)[bytes_read] = 0;
-	}
-
 	CloseHandle(handle);
-
-	if (work->use_compression)
-	{
-		char result[1000000];
-		LZ4_decompress_safe(work->buffer, result, (int)work->size, sizeof(result));
-		result[(int)work->size] = 0;
-		work->buffer = (void*)result;
-		event_signal(work->done);
-	}
-	else
-	{
-		event_signal(work->done);
-	}
+	return 0;
 }
 
-static void file_write(fs_work_t* work)
+static int file_write_blocking(fs_work_t* work)
 {
 	wchar_t wide_path[1024];
-	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
+	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, _countof(wide_path)) <= 0)
 	{
-		work->result = -1;
-		event_signal(work->done);
-		return;
+		return -1;
 	}
 
 	HANDLE handle = CreateFile(wide_path, GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
 		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (handle == INVALID_HANDLE_VALUE)
 	{
-		work->result = GetLastError();
-		event_signal(work->done);
-		return;
+		return GetLastError();
 	}
 
 	DWORD bytes_written = 0;
 	if (!WriteFile(handle, work->buffer, (DWORD)work->size, &bytes_written, NULL))
 	{
-		work->result = GetLastError();
+		int result = GetLastError();
 		CloseHandle(handle);
-		event_signal(work->done);
-		return;
+		return result;
 	}
 
 	work->size = bytes_written;
-
 	CloseHandle(handle);
+	return 0;
+}
+
+// Sequential streams, used to move compressed files through the codec in blocks.
+typedef HANDLE file_stream_t;
+
+static int stream_open(const char* path, bool write, file_stream_t* stream)
+{
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return -1;
+	}
 
-	event_signal(work->done);
+	*stream = write
+		? CreateFile(wide_path, GENERIC_WRITE, FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)
+		: CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	return *stream == INVALID_HANDLE_VALUE ? GetLastError() : 0;
 }
 
-static int file_thread_func(void* user)
+static int stream_get_size(file_stream_t stream, size_t* size)
 {
-	fs_t* fs = user;
-	while (true)
+	LARGE_INTEGER value;
+	if (!GetFileSizeEx(stream, &value))
 	{
-		fs_work_t* work = queue_pop(fs->file_queue);
-		if (work == NULL)
-		{
-			break;
+		return GetLastError();
+	}
+	*size = (size_t)value.QuadPart;
+	return 0;
+}
+
+// Read up to size bytes at offset. Zero bytes read marks the end of the file.
+static int stream_read_at(file_stream_t stream, void* buffer, size_t size, uint64_t offset, size_t* bytes_read)
+{
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD bytes = 0;
+	if (!ReadFile(stream, buffer, (DWORD)size, &bytes, &overlapped))
+	{
+		int result = GetLastError();
+		if (result != ERROR_HANDLE_EOF)
+		{
+			return result;
+		}
+	}
+	*bytes_read = bytes;
+	return 0;
+}
+
+static int stream_write(file_stream_t stream, const void* buffer, size_t size)
+{
+	while (size > 0)
+	{
+		DWORD bytes = 0;
+		if (!WriteFile(stream, buffer, (DWORD)size, &bytes, NULL))
+		{
+			return GetLastError();
+		}
+		buffer = (const char*)buffer + bytes;
+		size -= bytes;
+	}
+	return 0;
+}
+
+static void stream_close(file_stream_t stream)
+{
+	CloseHandle(stream);
+}
+
+#else
+
+static int file_read_blocking(fs_work_t* work)
+{
+	int fd = open(work->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		int result = errno;
+		close(fd);
+		return result;
+	}
+
+	work->size = (size_t)info.st_size;
+	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+
+	size_t total = 0;
+	while (total < work->size)
+	{
+		ssize_t bytes = read(fd, (char*)work->buffer + total, work->size - total);
+		if (bytes < 0 && errno != EINTR)
+		{
+			int result = errno;
+			close(fd);
+			return result;
+		}
+		if (bytes == 0)
+		{
+			break;
+		}
+		total += bytes > 0 ? (size_t)bytes : 0;
+	}
+
+	work->size = total;
+	close(fd);
+	return 0;
+}
+
+static int file_write_blocking(fs_work_t* work)
+{
+	int fd = open(work->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		return errno;
+	}
+
+	size_t total = 0;
+	while (total < work->size)
+	{
+		ssize_t bytes = write(fd, (const char*)work->buffer + total, work->size - total);
+		if (bytes < 0 && errno != EINTR)
+		{
+			int result = errno;
+			close(fd);
+			return result;
+		}
+		total += bytes > 0 ? (size_t)bytes : 0;
+	}
+
+	work->size = total;
+	close(fd);
+	return 0;
+}
+
+typedef int file_stream_t;
+
+static int stream_open(const char* path, bool write, file_stream_t* stream)
+{
+	*stream = write
+		? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+		: open(path, O_RDONLY | O_CLOEXEC);
+	if (*stream < 0)
+	{
+		return errno;
+	}
+	if (!write)
+	{
+		posix_fadvise(*stream, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	return 0;
+}
+
+static int stream_get_size(file_stream_t stream, size_t* size)
+{
+	struct stat info;
+	if (fstat(stream, &info) != 0)
+	{
+		return errno;
+	}
+	*size = (size_t)info.st_size;
+	return 0;
+}
+
+static int stream_read_at(file_stream_t stream, void* buffer, size_t size, uint64_t offset, size_t* bytes_read)
+{
+	ssize_t bytes;
+	while ((bytes = pread(stream, buffer, size, (off_t)offset)) < 0)
+	{
+		if (errno != EINTR)
+		{
+			return errno;
+		}
+	}
+	*bytes_read = (size_t)bytes;
+	return 0;
+}
+
+static int stream_write(file_stream_t stream, const void* buffer, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t bytes = write(stream, buffer, size);
+		if (bytes < 0 && errno != EINTR)
+		{
+			return errno;
+		}
+		if (bytes > 0)
+		{
+			buffer = (const char*)buffer + bytes;
+			size -= (size_t)bytes;
+		}
+	}
+	return 0;
+}
+
+static void stream_close(file_stream_t stream)
+{
+	close(stream);
+}
+
+#endif
+
+// Read exactly size bytes at offset, failing if the file ends first.
+static int stream_read_exact(file_stream_t stream, void* buffer, size_t size, uint64_t offset)
+{
+	while (size > 0)
+	{
+		size_t bytes = 0;
+		int result = stream_read_at(stream, buffer, size, offset, &bytes);
+		if (result != 0)
+		{
+			return result;
+		}
+		if (bytes == 0)
+		{
+			return -1;
+		}
+		buffer = (char*)buffer + bytes;
+		size -= bytes;
+		offset += bytes;
+	}
+	return 0;
+}
+
+// An open file for range reads. Reads of different ranges may be in flight at once.
+typedef struct fs_file_t
+{
+	fs_t* fs;
+	file_stream_t stream;
+	uint64_t size;
+} fs_file_t;
+
+fs_file_t* fs_open(fs_t* fs, const char* path)
+{
+	file_stream_t stream;
+	size_t size = 0;
+	if (stream_open(path, false, &stream) != 0)
+	{
+		return NULL;
+	}
+	if (stream_get_size(stream, &size) != 0)
+	{
+		stream_close(stream);
+		return NULL;
+	}
+
+	fs_file_t* file = heap_alloc(fs->heap, sizeof(fs_file_t), 8);
+	file->fs = fs;
+	file->stream = stream;
+	file->size = size;
+	return file;
+}
+
+void fs_close(fs_file_t* file)
+{
+	if (file)
+	{
+		stream_close(file->stream);
+		heap_free(file->fs->heap, file);
+	}
+}
+
+uint64_t fs_file_get_size(fs_file_t* file)
+{
+	return file ? file->size : 0;
+}
+
+static fs_work_t* range_create(fs_t* fs, fs_file_t* file, const char* path, uint64_t offset, size_t size, heap_t* heap, void* buffer, fs_priority_t priority)
+{
+	fs_work_t* work = work_create(fs, k_fs_work_op_read_range, path, heap, priority);
+	work->file = file;
+	work->offset = offset;
+	work->size = size;
+	work->buffer = buffer;
+	work_submit(fs, work);
+	return work;
+}
+
+fs_work_t* fs_read_range(fs_t* fs, const char* path, uint64_t offset, size_t size, heap_t* heap, void* buffer, fs_priority_t priority)
+{
+	return range_create(fs, NULL, path, offset, size, heap, buffer, priority);
+}
+
+fs_work_t* fs_file_read_range(fs_file_t* file, uint64_t offset, size_t size, heap_t* heap, void* buffer, fs_priority_t priority)
+{
+	return range_create(file->fs, file, "", offset, size, heap, buffer, priority);
+}
+
+// Clamp a range read to the end of the file, and allocate its buffer unless the caller gave one.
+static void range_prepare(fs_work_t* work, uint64_t file_size)
+{
+	work->size = (size_t)__min((uint64_t)work->size, work->offset < file_size ? file_size - work->offset : 0);
+	if (!work->buffer)
+	{
+		work->buffer = heap_alloc(work->heap, work->size, 8);
+	}
+}
+
+static int file_read_range_blocking(fs_work_t* work)
+{
+	file_stream_t stream = work->file ? work->file->stream : 0;
+	size_t file_size = work->file ? (size_t)work->file->size : 0;
+	int result = work->file ? 0 : stream_open(work->path, false, &stream);
+	if (result == 0 && !work->file)
+	{
+		result = stream_get_size(stream, &file_size);
+		if (result != 0)
+		{
+			stream_close(stream);
+		}
+	}
+	if (result != 0)
+	{
+		work->size = 0;
+		return result;
+	}
+
+	range_prepare(work, file_size);
+	size_t total = 0;
+	while (result == 0 && total < work->size)
+	{
+		size_t bytes = 0;
+		result = stream_read_at(stream, (char*)work->buffer + total, work->size - total, work->offset + total, &bytes);
+		if (bytes == 0)
+		{
+			break;
+		}
+		total += bytes;
+	}
+	work->size = total;
+
+	if (!work->file)
+	{
+		stream_close(stream);
+	}
+	return result;
+}
+
+// A file read in chunks, each into the next buffer of a caller's ring.
+// Every buffer is kept busy with a read until its chunk is handed out, so the file is read ahead by the ring's size.
+typedef struct fs_stream_t
+{
+	fs_t* fs;
+	fs_file_t* file;
+	size_t chunk_size;
+	fs_priority_t priority;
+	uint64_t next_offset;
+	int result;
+
+	// Chunks in flight or held, oldest first. Slot i always reads into buffer i.
+	fs_work_t** chunks;
+	void** buffers;
+	int buffer_count;
+	int first;
+	int count;
+	bool held;
+} fs_stream_t;
+
+// Start reads into every free buffer, up to the end of the file.
+static void stream_issue(fs_stream_t* stream)
+{
+	while (stream->count < stream->buffer_count && stream->next_offset < stream->file->size && stream->result == 0)
+	{
+		int slot = (stream->first + stream->count) % stream->buffer_count;
+		stream->chunks[slot] = fs_file_read_range(stream->file, stream->next_offset, stream->chunk_size, NULL, stream->buffers[slot], stream->priority);
+		stream->next_offset += stream->chunk_size;
+		stream->count++;
+	}
+}
+
+fs_stream_t* fs_stream_open(fs_t* fs, const char* path, void* const* buffers, int buffer_count, size_t chunk_size, fs_priority_t priority)
+{
+	fs_file_t* file = fs_open(fs, path);
+	if (!file)
+	{
+		return NULL;
+	}
+
+	fs_stream_t* stream = heap_alloc(fs->heap, sizeof(fs_stream_t), 8);
+	memset(stream, 0, sizeof(*stream));
+	stream->fs = fs;
+	stream->file = file;
+	stream->chunk_size = chunk_size;
+	stream->priority = priority;
+	stream->buffer_count = buffer_count;
+	stream->chunks = heap_alloc(fs->heap, buffer_count * sizeof(fs_work_t*), 8);
+	stream->buffers = heap_alloc(fs->heap, buffer_count * sizeof(void*), 8);
+	memcpy(stream->buffers, buffers, buffer_count * sizeof(void*));
+	stream_issue(stream);
+	return stream;
+}
+
+void fs_stream_close(fs_stream_t* stream)
+{
+	if (stream)
+	{
+		for (int i = 0; i < stream->count; ++i)
+		{
+			fs_work_destroy(stream->chunks[(stream->first + i) % stream->buffer_count]);
+		}
+		fs_close(stream->file);
+		heap_free(stream->fs->heap, stream->buffers);
+		heap_free(stream->fs->heap, stream->chunks);
+		heap_free(stream->fs->heap, stream);
+	}
+}
+
+bool fs_stream_is_ready(fs_stream_t* stream)
+{
+	return stream->count == 0 || fs_work_is_done(stream->chunks[stream->first]);
+}
+
+const void* fs_stream_next(fs_stream_t* stream, size_t* size)
+{
+	if (stream->held || stream->count == 0)
+	{
+		return NULL;
+	}
+
+	fs_work_t* chunk = stream->chunks[stream->first];
+	int result = fs_work_get_result(chunk);
+	if (result != 0)
+	{
+		stream->result = result;
+		return NULL;
+	}
+	stream->held = true;
+	*size = fs_work_get_size(chunk);
+	return fs_work_get_buffer(chunk);
+}
+
+void fs_stream_release(fs_stream_t* stream)
+{
+	if (stream->held)
+	{
+		fs_work_destroy(stream->chunks[stream->first]);
+		stream->first = (stream->first + 1) % stream->buffer_count;
+		stream->count--;
+		stream->held = false;
+		stream_issue(stream);
+	}
+}
+
+int fs_stream_get_result(fs_stream_t* stream)
+{
+	return stream->result;
+}
+
+// Compressed files are standard LZ4 frames of independent blocks, readable by any LZ4 frame decoder:
+//
+//   frame header | block 0 | ... | block n-1 | end mark | index
+//
+// Each block is a 4 byte size word and its data, and holds k_fs_lz4_block_size bytes of the file
+// (the last block may hold less). Blocks are compressed and decompressed in parallel.
+// The index is a skippable frame holding every block's stored size and checksum, then a fixed-size footer,
+// so readers can locate and verify any block from the end of the file without walking the frame.
+enum
+{
+	k_lz4_frame_header_size = 15,
+	k_lz4_block_overhead = 4,
+	k_lz4_max_block_size = 4 * 1024 * 1024,
+	k_lz4_index_magic = LZ4F_MAGIC_SKIPPABLE_START + 0xf,
+	k_lz4_index_header_size = 8,
+	k_lz4_index_entry_size = 8,
+	k_lz4_index_footer_size = 24,
+	k_lz4_index_tag = 0x78646966, // "fidx"
+};
+
+// Set in a block's size word when the block is stored uncompressed.
+static const uint32_t k_lz4_block_uncompressed = 0x80000000u;
+
+typedef struct lz4_index_t
+{
+	uint64_t content_size;
+	size_t block_size;
+	size_t block_count;
+	// File offset of each block, and of the end of the last.
+	uint64_t* offsets;
+	uint32_t* checksums;
+} lz4_index_t;
+
+// One block of a batch, compressed or decompressed by whichever codec thread pops it.
+typedef struct lz4_block_t
+{
+	bool compress;
+	int level;
+	const char* source;
+	size_t source_size;
+	char* dest;
+	size_t dest_size;
+	uint32_t checksum;
+	int result;
+	int* remaining;
+} lz4_block_t;
+
+// Blocks in flight together, with the staging memory for their compressed form.
+typedef struct lz4_batch_t
+{
+	lz4_block_t blocks[k_fs_lz4_max_batch_blocks];
+	int count;
+	int remaining;
+	size_t first_block;
+	char* staging;
+} lz4_batch_t;
+
+static void write_le32(char* dest, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		dest[i] = (char)(value >> (i * 8));
+	}
+}
+
+static void write_le64(char* dest, uint64_t value)
+{
+	write_le32(dest, (uint32_t)value);
+	write_le32(dest + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t read_le32(const char* source)
+{
+	const unsigned char* bytes = (const unsigned char*)source;
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint64_t read_le64(const char* source)
+{
+	return read_le32(source) | ((uint64_t)read_le32(source + 4) << 32);
+}
+
+static void lz4_frame_header(char* header, uint64_t content_size)
+{
+	write_le32(header, LZ4F_MAGICNUMBER);
+	// Version 1, independent blocks and a content size. Block checksums live in the index instead.
+	header[4] = 0x40 | 0x20 | 0x08;
+	// Maximum block size of 1 MB, matching k_fs_lz4_block_size.
+	header[5] = 6 << 4;
+	write_le64(header + 6, content_size);
+	header[14] = (char)(XXH32(header + 4, 10, 0) >> 8);
+}
+
+static void lz4_block_compress(lz4_block_t* block)
+{
+	// A block that does not shrink is stored as is.
+	char* data = block->dest + 4;
+	int size = block->level >= k_fs_compression_hc_min
+		? LZ4_compress_HC(block->source, data, (int)block->source_size, (int)block->source_size - 1, block->level)
+		: LZ4_compress_default(block->source, data, (int)block->source_size, (int)block->source_size - 1);
+	uint32_t word = (uint32_t)size;
+	if (size <= 0)
+	{
+		memcpy(data, block->source, block->source_size);
+		size = (int)block->source_size;
+		word = (uint32_t)size | k_lz4_block_uncompressed;
+	}
+	write_le32(block->dest, word);
+	block->checksum = XXH32(data, size, 0);
+	block->dest_size = size + k_lz4_block_overhead;
+	block->result = 0;
+}
+
+static void lz4_block_decompress(lz4_block_t* block)
+{
+	block->result = -1;
+	if (block->source_size < k_lz4_block_overhead)
+	{
+		return;
+	}
+
+	uint32_t word = read_le32(block->source);
+	size_t size = word & ~k_lz4_block_uncompressed;
+	const char* data = block->source + 4;
+	if (size + k_lz4_block_overhead != block->source_size || block->checksum != XXH32(data, size, 0))
+	{
+		return;
+	}
+
+	if (word & k_lz4_block_uncompressed)
+	{
+		if (size == block->dest_size)
+		{
+			memcpy(block->dest, data, size);
+			block->result = 0;
+		}
+	}
+	else if (LZ4_decompress_safe(data, block->dest, (int)size, (int)block->dest_size) == (int)block->dest_size)
+	{
+		block->result = 0;
+	}
+}
+
+static void lz4_block_run(lz4_block_t* block)
+{
+	if (block->compress)
+	{
+		lz4_block_compress(block);
+	}
+	else
+	{
+		lz4_block_decompress(block);
+	}
+
+	if (atomic_decrement(block->remaining) == 1)
+	{
+		futex_wake(block->remaining, 1);
+	}
+}
+
+static int codec_thread_func(void* user)
+{
+	fs_t* fs = user;
+	while (true)
+	{
+		lz4_block_t* block = queue_pop(fs->codec_queue);
+		if (block == NULL)
+		{
+			break;
+		}
+		lz4_block_run(block);
+	}
+	return 0;
+}
+
+static void lz4_batch_dispatch(fs_t* fs, lz4_batch_t* batch)
+{
+	batch->remaining = batch->count;
+	for (int i = 0; i < batch->count; ++i)
+	{
+		batch->blocks[i].remaining = &batch->remaining;
+		queue_push(fs->codec_queue, &batch->blocks[i]);
+	}
+}
+
+// Wait for every block of a batch, running queued blocks on this thread meanwhile.
+// Returns the first error among the blocks.
+static int lz4_batch_wait(fs_t* fs, lz4_batch_t* batch)
+{
+	int remaining;
+	while ((remaining = atomic_load(&batch->remaining)) != 0)
+	{
+		lz4_block_t* block = queue_try_pop(fs->codec_queue);
+		if (block)
+		{
+			lz4_block_run(block);
+		}
+		else
+		{
+			futex_wait(&batch->remaining, remaining);
+		}
+	}
+
+	int result = 0;
+	for (int i = 0; i < batch->count && result == 0; ++i)
+	{
+		result = batch->blocks[i].result;
+	}
+	return result;
+}
+
+// Where compressed data goes: an open file, or memory of at least lz4_compressed_bound() bytes.
+typedef struct lz4_sink_t
+{
+	file_stream_t stream;
+	char* memory;
+	size_t size;
+} lz4_sink_t;
+
+static int lz4_sink_write(lz4_sink_t* sink, const void* data, size_t size)
+{
+	if (sink->memory)
+	{
+		memcpy(sink->memory + sink->size, data, size);
+		sink->size += size;
+		return 0;
+	}
+	return stream_write(sink->stream, data, size);
+}
+
+// Largest compressed form of size bytes: every block stored as is, plus the frame and index.
+static size_t lz4_compressed_bound(size_t size)
+{
+	size_t block_count = (size + k_fs_lz4_block_size - 1) / k_fs_lz4_block_size;
+	return k_lz4_frame_header_size + size + block_count * k_lz4_block_overhead + 4 +
+		k_lz4_index_header_size + block_count * k_lz4_index_entry_size + k_lz4_index_footer_size;
+}
+
+// Compress the work's buffer a batch of blocks at a time, writing each batch while the next one compresses.
+static int lz4_compress(fs_t* fs, fs_work_t* work, lz4_sink_t* sink)
+{
+	size_t block_count = (work->size + k_fs_lz4_block_size - 1) / k_fs_lz4_block_size;
+	size_t index_size = k_lz4_index_header_size + block_count * k_lz4_index_entry_size + k_lz4_index_footer_size;
+	char* index = heap_alloc(work->heap, index_size, 8);
+
+	// Blocks are only kept compressed if they shrink, so each fits in its uncompressed size plus overhead.
+	size_t block_capacity = k_fs_lz4_block_size + k_lz4_block_overhead;
+	lz4_batch_t batches[2];
+	for (int b = 0; b < _countof(batches); ++b)
+	{
+		batches[b].staging = heap_alloc(work->heap, fs->codec_batch_blocks * block_capacity, 8);
+	}
+
+	char header[k_lz4_frame_header_size];
+	lz4_frame_header(header, work->size);
+	int result = lz4_sink_write(sink, header, sizeof(header));
+
+	size_t next_block = 0;
+	lz4_batch_t* pending = NULL;
+	for (int b = 0; next_block < block_count || pending; b ^= 1)
+	{
+		lz4_batch_t* batch = NULL;
+		if (result == 0 && next_block < block_count)
+		{
+			batch = &batches[b];
+			batch->first_block = next_block;
+			batch->count = (int)__min(block_count - next_block, (size_t)fs->codec_batch_blocks);
+			for (int i = 0; i < batch->count; ++i, ++next_block)
+			{
+				size_t offset = next_block * k_fs_lz4_block_size;
+				lz4_block_t* block = &batch->blocks[i];
+				block->compress = true;
+				block->level = work->compression_level;
+				block->source = (const char*)work->buffer + offset;
+				block->source_size = __min(work->size - offset, (size_t)k_fs_lz4_block_size);
+				block->dest = batch->staging + i * block_capacity;
+			}
+			lz4_batch_dispatch(fs, batch);
+		}
+		else
+		{
+			next_block = block_count;
+		}
+
+		if (pending)
+		{
+			int batch_result = lz4_batch_wait(fs, pending);
+			result = result ? result : batch_result;
+			for (int i = 0; i < pending->count && result == 0; ++i)
+			{
+				lz4_block_t* block = &pending->blocks[i];
+				char* entry = index + k_lz4_index_header_size + (pending->first_block + i) * k_lz4_index_entry_size;
+				write_le32(entry, (uint32_t)block->dest_size);
+				write_le32(entry + 4, block->checksum);
+				result = lz4_sink_write(sink, block->dest, block->dest_size);
+			}
+		}
+		pending = batch;
+	}
+
+	if (result == 0)
+	{
+		char end_mark[4] = { 0 };
+		result = lz4_sink_write(sink, end_mark, sizeof(end_mark));
+	}
+	if (result == 0)
+	{
+		write_le32(index, k_lz4_index_magic);
+		write_le32(index + 4, (uint32_t)(index_size - k_lz4_index_header_size));
+		char* footer = index + index_size - k_lz4_index_footer_size;
+		write_le64(footer, work->size);
+		write_le32(footer + 8, k_fs_lz4_block_size);
+		write_le32(footer + 12, (uint32_t)block_count);
+		write_le32(footer + 16, k_lz4_frame_header_size);
+		write_le32(footer + 20, k_lz4_index_tag);
+		result = lz4_sink_write(sink, index, index_size);
+	}
+
+	for (int b = 0; b < _countof(batches); ++b)
+	{
+		heap_free(work->heap, batches[b].staging);
+	}
+	heap_free(work->heap, index);
+	return result;
+}
+
+static int file_write_compressed(fs_t* fs, fs_work_t* work)
+{
+	lz4_sink_t sink;
+	memset(&sink, 0, sizeof(sink));
+	int result = stream_open(work->path, true, &sink.stream);
+	if (result != 0)
+	{
+		return result;
+	}
+	result = lz4_compress(fs, work, &sink);
+	stream_close(sink.stream);
+	return result;
+}
+
+// Replace the work's buffer with its compressed form.
+static void file_compress(fs_work_t* work)
+{
+	lz4_sink_t sink;
+	memset(&sink, 0, sizeof(sink));
+	sink.memory = heap_alloc(work->heap, lz4_compressed_bound(work->size), 8);
+
+	work->result = lz4_compress(work->fs, work, &sink);
+	if (work->result == 0)
+	{
+		work->buffer = sink.memory;
+		work->size = sink.size;
+	}
+	else
+	{
+		heap_free(work->heap, sink.memory);
+		work->buffer = NULL;
+		work->size = 0;
+	}
+	future_complete(work->done, work->result);
+}
+
+// Where compressed data comes from: an open file, or memory such as an archive entry.
+typedef struct lz4_source_t
+{
+	file_stream_t stream;
+	const char* memory;
+	uint64_t size;
+} lz4_source_t;
+
+// Get size bytes at offset: read into staging from a file, or in place from memory.
+static int lz4_source_read(const lz4_source_t* source, char* staging, size_t size, uint64_t offset, const char** data)
+{
+	if (source->memory)
+	{
+		*data = source->memory + offset;
+		return offset + size <= source->size ? 0 : -1;
+	}
+	*data = staging;
+	return stream_read_exact(source->stream, staging, size, offset);
+}
+
+// Load the block index from the end of the source. Returns false if it has no valid index.
+static bool lz4_index_load(const lz4_source_t* source, heap_t* heap, lz4_index_t* index)
+{
+	char footer_staging[k_lz4_index_footer_size];
+	const char* footer = NULL;
+	if (source->size < k_lz4_frame_header_size + k_lz4_index_header_size + k_lz4_index_footer_size ||
+		lz4_source_read(source, footer_staging, k_lz4_index_footer_size, source->size - k_lz4_index_footer_size, &footer) != 0 ||
+		read_le32(footer + 20) != k_lz4_index_tag)
+	{
+		return false;
+	}
+
+	index->content_size = read_le64(footer);
+	index->block_size = read_le32(footer + 8);
+	index->block_count = read_le32(footer + 12);
+	uint64_t offset = read_le32(footer + 16);
+	size_t index_size = k_lz4_index_header_size + index->block_count * k_lz4_index_entry_size + k_lz4_index_footer_size;
+	if (index->block_size == 0 || index->block_size > k_lz4_max_block_size || index_size > source->size ||
+		index->content_size > SIZE_MAX - 1 ||
+		index->block_count != index->content_size / index->block_size + (index->content_size % index->block_size != 0))
+	{
+		return false;
+	}
+
+	char* staging = source->memory ? NULL : heap_alloc(heap, index_size, 8);
+	const char* data = NULL;
+	index->offsets = heap_alloc(heap, (index->block_count + 1) * sizeof(uint64_t), 8);
+	index->checksums = heap_alloc(heap, __max(index->block_count, 1) * sizeof(uint32_t), 8);
+	bool valid = lz4_source_read(source, staging, index_size, source->size - index_size, &data) == 0 &&
+		read_le32(data) == k_lz4_index_magic && read_le32(data + 4) == index_size - k_lz4_index_header_size;
+	for (size_t i = 0; i < index->block_count && valid; ++i)
+	{
+		const char* entry = data + k_lz4_index_header_size + i * k_lz4_index_entry_size;
+		uint32_t size = read_le32(entry);
+		valid = size >= k_lz4_block_overhead && size <= index->block_size + k_lz4_block_overhead;
+		index->offsets[i] = offset;
+		index->checksums[i] = read_le32(entry + 4);
+		offset += size;
+	}
+	index->offsets[index->block_count] = offset;
+	valid = valid && offset + 4 + index_size == source->size;
+
+	heap_free(heap, staging);
+	if (!valid)
+	{
+		heap_free(heap, index->checksums);
+		heap_free(heap, index->offsets);
+	}
+	return valid;
+}
+
+// Decompress the blocks a batch at a time, reading each batch from a file while the previous one decompresses.
+// Blocks in memory are decompressed in place.
+static int file_read_indexed(fs_t* fs, fs_work_t* work, const lz4_source_t* source, const lz4_index_t* index)
+{
+	work->size = (size_t)index->content_size;
+	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+
+	size_t block_capacity = index->block_size + k_lz4_block_overhead;
+	lz4_batch_t batches[2];
+	for (int b = 0; b < _countof(batches); ++b)
+	{
+		batches[b].staging = source->memory ? NULL : heap_alloc(work->heap, fs->codec_batch_blocks * block_capacity, 8);
+	}
+
+	int result = 0;
+	size_t next_block = 0;
+	lz4_batch_t* pending = NULL;
+	for (int b = 0; next_block < index->block_count || pending; b ^= 1)
+	{
+		lz4_batch_t* batch = NULL;
+		if (result == 0 && next_block < index->block_count)
+		{
+			batch = &batches[b];
+			batch->first_block = next_block;
+			batch->count = (int)__min(index->block_count - next_block, (size_t)fs->codec_batch_blocks);
+			uint64_t start = index->offsets[next_block];
+			const char* data = NULL;
+			result = lz4_source_read(source, batch->staging, (size_t)(index->offsets[next_block + batch->count] - start), start, &data);
+			for (int i = 0; i < batch->count; ++i, ++next_block)
+			{
+				size_t offset = next_block * index->block_size;
+				lz4_block_t* block = &batch->blocks[i];
+				block->compress = false;
+				block->source = data + (index->offsets[next_block] - start);
+				block->source_size = (size_t)(index->offsets[next_block + 1] - index->offsets[next_block]);
+				block->checksum = index->checksums[next_block];
+				block->dest = (char*)work->buffer + offset;
+				block->dest_size = __min(work->size - offset, index->block_size);
+			}
+			if (result == 0)
+			{
+				lz4_batch_dispatch(fs, batch);
+			}
+			else
+			{
+				batch = NULL;
+			}
+		}
+		else
+		{
+			next_block = index->block_count;
+		}
+
+		if (pending)
+		{
+			int batch_result = lz4_batch_wait(fs, pending);
+			result = result ? result : batch_result;
+		}
+		pending = batch;
+	}
+
+	for (int b = 0; b < _countof(batches); ++b)
+	{
+		heap_free(work->heap, batches[b].staging);
+	}
+	return result;
+}
+
+// Decompress an LZ4 frame from another encoder as it is read, one input chunk at a time, straight into the output buffer.
+// The buffer is sized from the frame header; frames written without a content size grow it as needed.
+static int file_read_stream(fs_work_t* work, file_stream_t stream)
+{
+	int result = 0;
+	uint64_t stream_offset = 0;
+	char* input = heap_alloc(work->heap, k_fs_lz4_chunk_size, 8);
+	size_t input_size = 0;
+	size_t input_offset = 0;
+	LZ4F_dctx* context = NULL;
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION)))
+	{
+		result = -1;
+	}
+	if (result == 0)
+	{
+		result = stream_read_at(stream, input, k_fs_lz4_chunk_size, stream_offset, &input_size);
+		stream_offset += input_size;
+	}
+
+	LZ4F_frameInfo_t info;
+	memset(&info, 0, sizeof(info));
+	if (result == 0)
+	{
+		input_offset = input_size;
+		if (LZ4F_isError(LZ4F_getFrameInfo(context, &info, input, &input_offset)) || info.contentSize > (SIZE_MAX - 1))
+		{
+			result = -1;
+		}
+	}
+
+	size_t extra = work->null_terminate ? 1 : 0;
+	size_t capacity = info.contentSize ? (size_t)info.contentSize : k_fs_lz4_chunk_size;
+	work->buffer = heap_alloc(work->heap, capacity + extra, 8);
+	work->size = 0;
+
+	size_t hint = 1;
+	while (result == 0 && hint != 0)
+	{
+		if (input_offset == input_size)
+		{
+			input_offset = 0;
+			result = stream_read_at(stream, input, k_fs_lz4_chunk_size, stream_offset, &input_size);
+			stream_offset += input_size;
+			if (result == 0 && input_size == 0)
+			{
+				// The file ended in the middle of the frame.
+				result = -1;
+			}
+			continue;
+		}
+
+		if (!info.contentSize && work->size == capacity)
+		{
+			char* grown = heap_alloc(work->heap, capacity * 2 + extra, 8);
+			memcpy(grown, work->buffer, work->size);
+			heap_free(work->heap, work->buffer);
+			work->buffer = grown;
+			capacity *= 2;
+		}
+
+		size_t output_bytes = capacity - work->size;
+		size_t input_bytes = input_size - input_offset;
+		hint = LZ4F_decompress(context, (char*)work->buffer + work->size, &output_bytes, input + input_offset, &input_bytes, NULL);
+		if (LZ4F_isError(hint) || (hint != 0 && input_bytes == 0 && output_bytes == 0))
+		{
+			// Corrupt, or holding more data than its header claims.
+			result = -1;
+		}
+		input_offset += input_bytes;
+		work->size += output_bytes;
+	}
+
+	LZ4F_freeDecompressionContext(context);
+	heap_free(work->heap, input);
+	return result;
+}
+
+// Decompress a source into the work's buffer.
+static int lz4_decompress(fs_t* fs, fs_work_t* work, const lz4_source_t* source)
+{
+	int result = -1;
+	lz4_index_t index;
+	if (lz4_index_load(source, work->heap, &index))
+	{
+		result = file_read_indexed(fs, work, source, &index);
+		heap_free(work->heap, index.checksums);
+		heap_free(work->heap, index.offsets);
+	}
+	else if (!source->memory)
+	{
+		result = file_read_stream(work, source->stream);
+	}
+
+	if (result != 0)
+	{
+		heap_free(work->heap, work->buffer);
+		work->buffer = NULL;
+		work->size = 0;
+	}
+	return result;
+}
+
+static int file_read_compressed(fs_t* fs, fs_work_t* work)
+{
+	lz4_source_t source;
+	memset(&source, 0, sizeof(source));
+	int result = stream_open(work->path, false, &source.stream);
+	if (result != 0)
+	{
+		return result;
+	}
+
+	size_t size = 0;
+	result = stream_get_size(source.stream, &size);
+	source.size = size;
+	if (result == 0)
+	{
+		result = lz4_decompress(fs, work, &source);
+	}
+	stream_close(source.stream);
+	return result;
+}
+
+// Archive layout: a header, then each entry's data aligned so it can be used straight from a mapping,
+// then an index of the entries sorted by the hash of their path.
+enum
+{
+	k_archive_magic = 0x52414147, // "GAAR"
+	k_archive_version = 1,
+	k_archive_alignment = 64,
+	k_archive_header_size = 24,
+	k_archive_entry_size = 40,
+	k_archive_entry_compressed = 1,
+};
+
+typedef struct fs_archive_t
+{
+	fs_t* fs;
+	fs_mapping_t* mapping;
+	const char* data;
+	const char* index;
+	uint32_t count;
+} fs_archive_t;
+
+typedef struct archive_entry_t
+{
+	uint64_t hash;
+	uint64_t offset;
+	uint64_t stored_size;
+	uint64_t size;
+	uint32_t flags;
+} archive_entry_t;
+
+// Hash a path the same way on every platform.
+static uint64_t archive_hash(const char* path)
+{
+	char normalized[1024];
+	size_t length = 0;
+	for (; path[length] && length < sizeof(normalized); ++length)
+	{
+		normalized[length] = path[length] == '\\' ? '/' : path[length];
+	}
+	return XXH64(normalized, length, 0);
+}
+
+static void archive_entry_read(const char* data, archive_entry_t* entry)
+{
+	entry->hash = read_le64(data);
+	entry->offset = read_le64(data + 8);
+	entry->stored_size = read_le64(data + 16);
+	entry->size = read_le64(data + 24);
+	entry->flags = read_le32(data + 32);
+}
+
+static bool archive_find(fs_archive_t* archive, const char* path, archive_entry_t* entry)
+{
+	uint64_t hash = archive_hash(path);
+	uint32_t first = 0;
+	uint32_t last = archive->count;
+	while (first < last)
+	{
+		uint32_t middle = first + (last - first) / 2;
+		uint64_t middle_hash = read_le64(archive->index + (size_t)middle * k_archive_entry_size);
+		if (middle_hash < hash)
+		{
+			first = middle + 1;
 		}
-		
-		switch (work->op)
+		else
+		{
+			last = middle;
+		}
+	}
+	if (first == archive->count)
+	{
+		return false;
+	}
+	archive_entry_read(archive->index + (size_t)first * k_archive_entry_size, entry);
+	return entry->hash == hash;
+}
+
+static size_t archive_align(size_t offset)
+{
+	return (offset + k_archive_alignment - 1) & ~(size_t)(k_archive_alignment - 1);
+}
+
+typedef struct archive_order_t
+{
+	uint64_t hash;
+	const fs_archive_entry_t* entry;
+} archive_order_t;
+
+static int compare_archive_order(const void* a, const void* b)
+{
+	uint64_t hash_a = ((const archive_order_t*)a)->hash;
+	uint64_t hash_b = ((const archive_order_t*)b)->hash;
+	return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+int fs_archive_write(fs_t* fs, const char* path, const fs_archive_entry_t* entries, int count)
+{
+	archive_order_t* order = heap_alloc(fs->heap, __max(count, 1) * sizeof(archive_order_t), 8);
+	for (int i = 0; i < count; ++i)
+	{
+		order[i].hash = archive_hash(entries[i].path);
+		order[i].entry = &entries[i];
+	}
+	qsort(order, count, sizeof(archive_order_t), compare_archive_order);
+
+	int result = 0;
+	size_t index_offset = archive_align(k_archive_header_size);
+	for (int i = 0; i < count && result == 0; ++i)
+	{
+		// Compressed entries must be whole images from fs_compress(), which end with their content size.
+		const fs_archive_entry_t* entry = order[i].entry;
+		if ((i > 0 && order[i].hash == order[i - 1].hash) ||
+			(entry->compressed && (entry->data_size < k_lz4_index_footer_size ||
+				read_le32((const char*)entry->data + entry->data_size - 4) != k_lz4_index_tag)))
+		{
+			result = -1;
+		}
+		index_offset = archive_align(index_offset + entry->data_size);
+	}
+
+	size_t size = index_offset + (size_t)count * k_archive_entry_size;
+	char* image = result == 0 ? heap_alloc(fs->heap, size, 8) : NULL;
+	if (image)
+	{
+		memset(image, 0, size);
+		write_le32(image, k_archive_magic);
+		write_le32(image + 4, k_archive_version);
+		write_le32(image + 8, (uint32_t)count);
+		write_le32(image + 12, k_archive_alignment);
+		write_le64(image + 16, index_offset);
+
+		size_t offset = archive_align(k_archive_header_size);
+		for (int i = 0; i < count; ++i)
+		{
+			const fs_archive_entry_t* entry = order[i].entry;
+			const char* footer = (const char*)entry->data + entry->data_size - k_lz4_index_footer_size;
+			char* index_entry = image + index_offset + (size_t)i * k_archive_entry_size;
+			write_le64(index_entry, order[i].hash);
+			write_le64(index_entry + 8, offset);
+			write_le64(index_entry + 16, entry->data_size);
+			write_le64(index_entry + 24, entry->compressed ? read_le64(footer) : entry->data_size);
+			write_le32(index_entry + 32, entry->compressed ? k_archive_entry_compressed : 0);
+			memcpy(image + offset, entry->data, entry->data_size);
+			offset = archive_align(offset + entry->data_size);
+		}
+
+		fs_work_t* work = fs_write(fs, path, image, size, k_fs_compression_none, k_fs_priority_normal);
+		result = fs_work_get_result(work);
+		fs_work_destroy(work);
+		heap_free(fs->heap, image);
+	}
+
+	heap_free(fs->heap, order);
+	return result;
+}
+
+fs_archive_t* fs_archive_open(fs_t* fs, const char* path)
+{
+	fs_mapping_t* mapping = fs_map(fs, path, k_fs_map_hint_random);
+	const char* data = fs_mapping_get_data(mapping);
+	uint64_t size = fs_mapping_get_size(mapping);
+	if (!data || size < k_archive_header_size ||
+		read_le32(data) != k_archive_magic || read_le32(data + 4) != k_archive_version)
+	{
+		fs_unmap(mapping);
+		return NULL;
+	}
+
+	uint32_t count = read_le32(data + 8);
+	uint64_t index_offset = read_le64(data + 16);
+	bool valid = index_offset <= size && (size - index_offset) / k_archive_entry_size >= count;
+	uint64_t previous_hash = 0;
+	for (uint32_t i = 0; i < count && valid; ++i)
+	{
+		archive_entry_t entry;
+		archive_entry_read(data + index_offset + (size_t)i * k_archive_entry_size, &entry);
+		valid = (i == 0 || entry.hash > previous_hash) &&
+			entry.offset <= index_offset && entry.stored_size <= index_offset - entry.offset &&
+			(entry.flags & k_archive_entry_compressed || entry.size == entry.stored_size);
+		previous_hash = entry.hash;
+	}
+	if (!valid)
+	{
+		fs_unmap(mapping);
+		return NULL;
+	}
+
+	fs_archive_t* archive = heap_alloc(fs->heap, sizeof(fs_archive_t), 8);
+	archive->fs = fs;
+	archive->mapping = mapping;
+	archive->data = data;
+	archive->index = data + index_offset;
+	archive->count = count;
+	return archive;
+}
+
+void fs_archive_close(fs_archive_t* archive)
+{
+	if (archive)
+	{
+		fs_unmap(archive->mapping);
+		heap_free(archive->fs->heap, archive);
+	}
+}
+
+bool fs_archive_contains(fs_archive_t* archive, const char* path)
+{
+	archive_entry_t entry;
+	return archive_find(archive, path, &entry);
+}
+
+fs_work_t* fs_archive_read(fs_archive_t* archive, const char* path, heap_t* heap, bool null_terminate, fs_priority_t priority)
+{
+	fs_work_t* work = work_create(archive->fs, k_fs_work_op_archive_read, path, heap, priority);
+	work->null_terminate = null_terminate;
+
+	archive_entry_t entry;
+	if (!archive_find(archive, path, &entry))
+	{
+		// Never queued, so it must not be cancellable: cancelling would complete it again.
+		work->state = k_fs_work_state_started;
+		work->result = -1;
+		future_complete(work->done, work->result);
+		return work;
+	}
+	work->use_compression = (entry.flags & k_archive_entry_compressed) != 0;
+	work->source = archive->data + entry.offset;
+	work->source_size = (size_t)entry.stored_size;
+	work_submit(archive->fs, work);
+	return work;
+}
+
+const void* fs_archive_map(fs_archive_t* archive, const char* path, size_t* size)
+{
+	archive_entry_t entry;
+	if (!archive_find(archive, path, &entry) || entry.flags & k_archive_entry_compressed)
+	{
+		return NULL;
+	}
+	*size = (size_t)entry.size;
+	return archive->data + entry.offset;
+}
+
+// Copy or decompress an entry out of an archive's mapping.
+static int file_read_archive(fs_work_t* work)
+{
+	if (work->use_compression)
+	{
+		lz4_source_t source;
+		memset(&source, 0, sizeof(source));
+		source.memory = work->source;
+		source.size = work->source_size;
+		return lz4_decompress(work->fs, work, &source);
+	}
+
+	work->size = work->source_size;
+	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+	memcpy(work->buffer, work->source, work->size);
+	return 0;
+}
+
+static void file_read(fs_work_t* work)
+{
+	if (work->op == k_fs_work_op_archive_read)
+	{
+		work->result = file_read_archive(work);
+	}
+	else if (work->op == k_fs_work_op_read_range)
+	{
+		work->result = file_read_range_blocking(work);
+	}
+	else
+	{
+		work->result = work->use_compression ? file_read_compressed(work->fs, work) : file_read_blocking(work);
+	}
+	if (work->result == 0 && work->null_terminate)
+	{
+		((char*)work->buffer)[work->size] = 0;
+	}
+	future_complete(work->done, work->result);
+}
+
+static void file_write(fs_work_t* work)
+{
+	work->result = work->use_compression ? file_write_compressed(work->fs, work) : file_write_blocking(work);
+	future_complete(work->done, work->result);
+}
+
+static void file_work(fs_work_t* work)
+{
+	if (!work_begin(work))
+	{
+		return;
+	}
+
+	switch (work->op)
+	{
+	case k_fs_work_op_read:
+		file_read(work);
+		break;
+	case k_fs_work_op_write:
+		file_write(work);
+		break;
+	case k_fs_work_op_compress:
+		file_compress(work);
+		break;
+	case k_fs_work_op_archive_read:
+	case k_fs_work_op_read_range:
+		file_read(work);
+		break;
+	}
+	work_release(work);
+}
+
+static int file_thread_func(void* user)
+{
+	fs_t* fs = user;
+	while (true)
+	{
+		fs_work_t* work = work_queue_pop(&fs->file_queue);
+		if (work == NULL)
 		{
-		case k_fs_work_op_read:
-			file_read(work);
-			break;
-		case k_fs_work_op_write:
-			file_write(work);
 			break;
 		}
+		file_work(work);
 	}
 	return 0;
 }
@@ -286,21 +2130,289 @@ static int compressed_file_thread_func(void* user)
 	fs_t* fs = user;
 	while (true)
 	{
-		fs_work_t* work = queue_pop(fs->compressed_file_queue);
+		fs_work_t* work = work_queue_pop(&fs->compressed_file_queue);
 		if (work == NULL)
 		{
 			break;
 		}
+		file_work(work);
+	}
+	return 0;
+}
+
+#if defined(_WIN32)
+
+static int uring_thread_func(void* user)
+{
+	return 0;
+}
+
+#else
+
+// One chunk of a file read or write in flight on the ring.
+typedef struct uring_op_t
+{
+	fs_work_t* work;
+	size_t offset;
+	uint32_t size;
+	struct uring_op_t* next;
+} uring_op_t;
+
+// State owned by the ring thread.
+typedef struct uring_state_t
+{
+	fs_t* fs;
+	uring_op_t ops[k_fs_uring_ops];
+	uring_op_t* free_ops;
+	// Work waiting for free operations, a list per priority so urgent work takes the next free one.
+	fs_work_t* issue_first[k_fs_priority_count];
+	fs_work_t* issue_last[k_fs_priority_count];
+	int in_flight;
+	uint64_t wake_value;
+	bool wake_armed;
+} uring_state_t;
+
+static void uring_work_finish(fs_work_t* work)
+{
+	if (!work->file)
+	{
+		close(work->fd);
+	}
+	if (work->result == 0 && work->op == k_fs_work_op_read && work->null_terminate)
+	{
+		((char*)work->buffer)[work->size] = 0;
+	}
+	future_complete(work->done, work->result);
+	work_release(work);
+}
 
-		switch (work->op)
+// Open the file and queue the work to be split into chunks.
+static void uring_work_start(uring_state_t* state, fs_work_t* work)
+{
+	if (work->op == k_fs_work_op_read)
+	{
+		work->fd = open(work->path, O_RDONLY | O_CLOEXEC);
+		struct stat info;
+		if (work->fd >= 0 && fstat(work->fd, &info) == 0)
+		{
+			work->size = (size_t)info.st_size;
+			work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+		}
+		else
+		{
+			work->result = errno;
+		}
+	}
+	else if (work->op == k_fs_work_op_read_range)
+	{
+		work->fd = work->file ? work->file->stream : open(work->path, O_RDONLY | O_CLOEXEC);
+		struct stat info;
+		if (work->file)
+		{
+			range_prepare(work, work->file->size);
+		}
+		else if (work->fd >= 0 && fstat(work->fd, &info) == 0)
+		{
+			range_prepare(work, (uint64_t)info.st_size);
+		}
+		else
+		{
+			work->result = errno;
+			work->size = 0;
+		}
+	}
+	else
+	{
+		work->fd = open(work->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		work->result = work->fd < 0 ? errno : 0;
+	}
+
+	if (work->fd < 0 || work->result != 0)
+	{
+		if (work->fd >= 0 && !work->file)
+		{
+			close(work->fd);
+		}
+		future_complete(work->done, work->result);
+		work_release(work);
+		return;
+	}
+
+	work->next_offset = 0;
+	work->ops_in_flight = 0;
+	work->issuing = true;
+	work->next = NULL;
+	if (state->issue_last[work->priority])
+	{
+		state->issue_last[work->priority]->next = work;
+	}
+	else
+	{
+		state->issue_first[work->priority] = work;
+	}
+	state->issue_last[work->priority] = work;
+}
+
+// The most urgent work waiting to issue, or NULL.
+static fs_work_t* uring_next_issue(uring_state_t* state)
+{
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		if (state->issue_first[i])
+		{
+			return state->issue_first[i];
+		}
+	}
+	return NULL;
+}
+
+static void uring_op_prep(uring_state_t* state, uring_op_t* op)
+{
+	fs_work_t* work = op->work;
+	if (work->op != k_fs_work_op_write)
+	{
+		uring_prep_read(state->fs->uring, work->fd, (char*)work->buffer + op->offset, op->size, (int64_t)(work->offset + op->offset), (uint64_t)(uintptr_t)op);
+	}
+	else
+	{
+		uring_prep_write(state->fs->uring, work->fd, (const char*)work->buffer + op->offset, op->size, (int64_t)op->offset, (uint64_t)(uintptr_t)op);
+	}
+}
+
+// Queue chunks of waiting work while there are free operations.
+// The operation pool is smaller than the ring, so the submission queue never fills.
+static void uring_issue(uring_state_t* state)
+{
+	fs_work_t* work;
+	while (state->free_ops && (work = uring_next_issue(state)) != NULL)
+	{
+		if (work->result == 0 && work->next_offset < work->size)
+		{
+			uring_op_t* op = state->free_ops;
+			state->free_ops = op->next;
+			op->work = work;
+			op->offset = work->next_offset;
+			op->size = (uint32_t)__min(work->size - work->next_offset, (size_t)k_fs_uring_chunk_size);
+			uring_op_prep(state, op);
+
+			work->next_offset += op->size;
+			work->ops_in_flight++;
+			state->in_flight++;
+			continue;
+		}
+
+		state->issue_first[work->priority] = work->next;
+		if (!work->next)
+		{
+			state->issue_last[work->priority] = NULL;
+		}
+		work->issuing = false;
+		if (work->ops_in_flight == 0)
+		{
+			uring_work_finish(work);
+		}
+	}
+}
+
+static void uring_complete(uring_state_t* state, uring_op_t* op, int result)
+{
+	fs_work_t* work = op->work;
+	if (result < 0)
+	{
+		work->result = work->result ? work->result : -result;
+	}
+	else if (result == 0)
+	{
+		// A read hit the end because the file shrank since it was opened; a write made no progress.
+		if (work->op != k_fs_work_op_write)
+		{
+			work->size = __min(work->size, op->offset);
+		}
+		else
+		{
+			work->result = work->result ? work->result : EIO;
+		}
+	}
+	else if ((uint32_t)result < op->size)
+	{
+		// Short transfer: requeue the rest.
+		op->offset += (uint32_t)result;
+		op->size -= (uint32_t)result;
+		uring_op_prep(state, op);
+		return;
+	}
+
+	op->next = state->free_ops;
+	state->free_ops = op;
+	state->in_flight--;
+	if (--work->ops_in_flight == 0 && !work->issuing)
+	{
+		uring_work_finish(work);
+	}
+}
+
+static void uring_wake(uring_state_t* state)
+{
+	fs_t* fs = state->fs;
+
+	// Clear the flag before draining, so a request queued during the drain wakes the ring again.
+	atomic_exchange(&fs->wake_pending, 0);
+	fs_work_t* work;
+	while ((work = work_queue_try_pop(&fs->file_queue)) != NULL)
+	{
+		if (work_begin(work))
+		{
+			uring_work_start(state, work);
+		}
+	}
+
+	state->wake_armed = !atomic_load(&fs->stopping);
+	if (state->wake_armed)
+	{
+		uring_prep_read(fs->uring, fs->wake_fd, &state->wake_value, sizeof(state->wake_value), 0, k_fs_uring_wake);
+	}
+}
+
+static int uring_thread_func(void* user)
+{
+	uring_state_t* state = heap_alloc(((fs_t*)user)->heap, sizeof(uring_state_t), 8);
+	memset(state, 0, sizeof(*state));
+	state->fs = user;
+	for (int i = 0; i < k_fs_uring_ops; ++i)
+	{
+		state->ops[i].next = state->free_ops;
+		state->free_ops = &state->ops[i];
+	}
+
+	uring_wake(state);
+	while (true)
+	{
+		uring_issue(state);
+		if (!state->wake_armed && !state->in_flight && !uring_next_issue(state))
 		{
-		case k_fs_work_op_read:
-			file_read(work);
-			break;
-		case k_fs_work_op_write:
-			file_write(work);
 			break;
 		}
+
+		// Hand every queued operation to the kernel at once, then sleep until something completes.
+		uring_submit(state->fs->uring, 1);
+
+		uint64_t user_data;
+		int result;
+		while (uring_pop_completion(state->fs->uring, &user_data, &result))
+		{
+			if (user_data == k_fs_uring_wake)
+			{
+				uring_wake(state);
+			}
+			else
+			{
+				uring_complete(state, (uring_op_t*)(uintptr_t)user_data, result);
+			}
+		}
 	}
+
+	heap_free(state->fs->heap, state);
 	return 0;
-}
\ No newline at end of file
+}
+
+#endif
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // Asynchronous read/write file system.
 
@@ -10,27 +12,232 @@ typedef struct fs_t fs_t;
 // Handle to file work.
 typedef struct fs_work_t fs_work_t;
 
+// Handle to a read-only view of a file mapped into memory.
+typedef struct fs_mapping_t fs_mapping_t;
+
+// Handle to an open asset archive.
+typedef struct fs_archive_t fs_archive_t;
+
+// Handle to a file open for range reads.
+typedef struct fs_file_t fs_file_t;
+
+// Handle to a file being read in chunks.
+typedef struct fs_stream_t fs_stream_t;
+
+typedef struct cpu_placement_t cpu_placement_t;
+typedef struct future_t future_t;
 typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+
+// Ways of performing file I/O.
+typedef enum fs_backend_t
+{
+	// io_uring where available, otherwise the thread pool.
+	k_fs_backend_default,
+	// A pool of threads, each making one blocking read or write at a time.
+	k_fs_backend_threads,
+	// Linux io_uring: one thread keeps many chunked reads and writes in flight.
+	// Falls back to the thread pool where io_uring is unavailable.
+	k_fs_backend_uring,
+} fs_backend_t;
 
-// Create a new file system.
+// Scheduling priority of file work.
+// Each thread takes the most urgent queued work first; work of equal priority runs in the order it was queued.
+typedef enum fs_priority_t
+{
+	// Work something is blocked on right now, such as a shader the frame is waiting for.
+	k_fs_priority_critical,
+	k_fs_priority_normal,
+	// Work nothing waits on yet, such as prefetching.
+	k_fs_priority_background,
+	k_fs_priority_count,
+} fs_priority_t;
+
+// Result of work cancelled before it started.
+enum
+{
+	k_fs_result_cancelled = -2,
+};
+
+// Queue statistics for one priority. Times are in timer ticks.
+typedef struct fs_priority_stats_t
+{
+	// Work taken off the queue by a thread.
+	int64_t started;
+	// Work cancelled while still queued.
+	int64_t cancelled;
+	// Time started work spent queued, in total and at most.
+	uint64_t wait_ticks;
+	uint64_t max_wait_ticks;
+} fs_priority_stats_t;
+
+// Create a new file system with the default backend.
 // Provided heap will be used to allocate space for queue and work buffers.
-// Provided queue size defines number of in-flight file operations.
+// Provided queue size defines number of queued file operations.
 fs_t* fs_create(heap_t* heap, int queue_capacity);
 
+// Create a new file system with a specific backend.
+fs_t* fs_create_backend(heap_t* heap, int queue_capacity, fs_backend_t backend);
+
+// Get the backend in use, after any fallback.
+fs_backend_t fs_get_backend(fs_t* fs);
+
 // Destroy a previously created file system.
 void fs_destroy(fs_t* fs);
 
+// Pin the file system's threads to the I/O processors of a placement.
+void fs_set_placement(fs_t* fs, const cpu_placement_t* placement);
+
+// Get the queue statistics of a priority since the file system was created.
+void fs_get_priority_stats(fs_t* fs, fs_priority_t priority, fs_priority_stats_t* stats);
+
 // Queue a file read.
 // File at the specified path will be read in full.
 // Memory for the file will be allocated out of the provided heap.
 // It is the calls responsibility to free the memory allocated!
+// With use_compression, the file must hold an LZ4 frame, which is decompressed as it is read;
+// the buffer and size are then those of the decompressed contents.
+// Files written by fs_write() are decompressed in parallel, a batch of blocks at a time.
 // Returns a work object.
-fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression);
+fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression, fs_priority_t priority);
+
+// Open a file for range reads, so each read need not open it again.
+// Returns NULL if the file cannot be opened.
+fs_file_t* fs_open(fs_t* fs, const char* path);
+
+// Close a file. Every range read from it must be done.
+void fs_close(fs_file_t* file);
+
+// Get the size of an open file, as of when it was opened.
+uint64_t fs_file_get_size(fs_file_t* file);
+
+// Queue a read of size bytes at offset into a file.
+// The read stops at the end of the file; the work's size is the number of bytes read.
+// With a buffer of at least size bytes, the data is read into it; otherwise memory for it
+// is allocated out of the provided heap, and it is the caller's responsibility to free it.
+fs_work_t* fs_read_range(fs_t* fs, const char* path, uint64_t offset, size_t size, heap_t* heap, void* buffer, fs_priority_t priority);
+
+// Queue a range read from an open file, as fs_read_range() does.
+fs_work_t* fs_file_read_range(fs_file_t* file, uint64_t offset, size_t size, heap_t* heap, void* buffer, fs_priority_t priority);
+
+// Open a file to be read in order, a chunk of chunk_size bytes at a time, so it never needs to be resident at once.
+// Chunks are read into a ring of caller buffers, each at least chunk_size bytes,
+// with every buffer not held by the caller kept busy reading ahead.
+// The buffers must stay valid until the stream is closed. Returns NULL if the file cannot be opened.
+fs_stream_t* fs_stream_open(fs_t* fs, const char* path, void* const* buffers, int buffer_count, size_t chunk_size, fs_priority_t priority);
+
+// Close a stream, waiting for reads in flight.
+void fs_stream_close(fs_stream_t* stream);
+
+// If true, fs_stream_next() will not block.
+bool fs_stream_is_ready(fs_stream_t* stream);
+
+// Block for the next chunk of the file, and hold it until fs_stream_release().
+// The last chunk may be short. Returns NULL at the end of the file, on error, or while a chunk is held.
+const void* fs_stream_next(fs_stream_t* stream, size_t* size);
+
+// Hand the held chunk's buffer back to the ring, to be refilled with a later chunk.
+void fs_stream_release(fs_stream_t* stream);
+
+// Get the error code that ended the stream, or zero.
+int fs_stream_get_result(fs_stream_t* stream);
+
+// Access pattern hints for fs_map(). Combine with bitwise or.
+typedef enum fs_map_hint_t
+{
+	k_fs_map_hint_none = 0,
+	// Pages will be read in order: read ahead aggressively and release pages soon after use.
+	k_fs_map_hint_sequential = 1 << 0,
+	// Pages will be read in no particular order: do not read ahead.
+	k_fs_map_hint_random = 1 << 1,
+	// The whole file will be needed soon: start bringing it into memory now.
+	k_fs_map_hint_willneed = 1 << 2,
+} fs_map_hint_t;
+
+// Map a file read-only into memory.
+// Unlike fs_read(), nothing is allocated from a heap and nothing is copied:
+// pages come straight from the OS file cache as they are touched.
+// Meant for large immutable assets. Returns NULL if the file cannot be opened or mapped.
+fs_mapping_t* fs_map(fs_t* fs, const char* path, uint32_t hints);
+
+// Release a mapping. Its data must no longer be used.
+void fs_unmap(fs_mapping_t* mapping);
+
+// Get the mapped contents of the file. NULL for an empty file or a NULL mapping.
+const void* fs_mapping_get_data(fs_mapping_t* mapping);
+
+// Get the size of the mapped file.
+size_t fs_mapping_get_size(fs_mapping_t* mapping);
+
+// Compression levels for fs_write().
+// Every level is read back with fs_read() and use_compression, and decompresses equally fast.
+enum
+{
+	k_fs_compression_none = 0,
+	// Fast LZ4, for files written at runtime.
+	k_fs_compression_fast = 1,
+	// LZ4HC levels trade write time for smaller files, for assets written once and read many times.
+	k_fs_compression_hc_min = 3,
+	k_fs_compression_hc_default = 9,
+	k_fs_compression_hc_max = 12,
+};
 
 // Queue a file write.
 // File at the specified path will be written in full.
+// With a compression level, the buffer is split into independent blocks compressed in parallel
+// into an LZ4 frame, followed by an index of the blocks; the work's size remains the uncompressed size.
+// The buffer must stay valid until the work is done.
 // Returns a work object.
-fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression);
+fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, int compression_level, fs_priority_t priority);
+
+// Queue compression of a buffer in memory, as fs_write() would compress it to a file.
+// On completion the work's buffer holds the compressed image, allocated out of the provided heap,
+// and its size is the compressed size. It is the caller's responsibility to free the buffer.
+// The source buffer must stay valid until the work is done.
+fs_work_t* fs_compress(fs_t* fs, const void* buffer, size_t size, heap_t* heap, int compression_level, fs_priority_t priority);
+
+// An asset to store in an archive.
+typedef struct fs_archive_entry_t
+{
+	// Path the asset is looked up by. Backslashes and forward slashes are equivalent.
+	const char* path;
+	// Contents of the asset, or with compressed, the image produced by fs_compress().
+	const void* data;
+	size_t data_size;
+	bool compressed;
+} fs_archive_entry_t;
+
+// Write an archive of assets to a single file, blocking until it is written.
+// Entries are indexed by a hash of their path and aligned for use straight from a mapping.
+// Returns zero on success, or non-zero if two paths collide or the file cannot be written.
+int fs_archive_write(fs_t* fs, const char* path, const fs_archive_entry_t* entries, int count);
+
+// Open an archive by mapping it into memory.
+// Looking up an entry is a binary search of the index, with no allocation and no I/O.
+// Returns NULL if the file cannot be mapped or is not a valid archive.
+fs_archive_t* fs_archive_open(fs_t* fs, const char* path);
+
+// Close an archive. Every read from it must be done, and mapped entries no longer used.
+void fs_archive_close(fs_archive_t* archive);
+
+// If true, the archive holds an entry at the path.
+bool fs_archive_contains(fs_archive_t* archive, const char* path);
+
+// Queue a read of an archive entry into memory allocated out of the provided heap.
+// Compressed entries are decompressed in parallel blocks, as fs_read() does with use_compression.
+// It is the caller's responsibility to free the buffer.
+// If there is no entry at the path, the work is already done with a non-zero result.
+fs_work_t* fs_archive_read(fs_archive_t* archive, const char* path, heap_t* heap, bool null_terminate, fs_priority_t priority);
+
+// Get an uncompressed entry in place, with no copy. Valid until the archive is closed.
+// Returns NULL if there is no entry at the path or the entry is compressed.
+const void* fs_archive_map(fs_archive_t* archive, const char* path, size_t* size);
+
+// Cancel work that no longer matters, such as loads for a level being restarted.
+// Work still queued is done at once with k_fs_result_cancelled and never started; returns true.
+// Work already started runs to completion; returns false.
+// Either way, the work must still be destroyed.
+bool fs_work_cancel(fs_work_t* work);
 
 // If true, the file work is complete.
 bool fs_work_is_done(fs_work_t* work);
@@ -38,6 +245,15 @@ bool fs_work_is_done(fs_work_t* work);
 // Block for the file work to complete.
 void fs_work_wait(fs_work_t* work);
 
+// Block for the file work to complete without stalling the job system.
+// Called from a job, the job is suspended and its worker runs other jobs meanwhile.
+void fs_work_wait_job(fs_work_t* work, job_system_t* jobs);
+
+// Get a future completed with the work's result once the work is done.
+// Use it to chain continuations onto the work. It is owned by the work;
+// retain it to use it after fs_work_destroy().
+future_t* fs_work_get_future(fs_work_t* work);
+
 // Get the error code for the file work.
 // A value of zero generally indicates success.
 int fs_work_get_result(fs_work_t* work);
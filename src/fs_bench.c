@@ -0,0 +1,411 @@
+#include "fs_bench.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "fs_cache.h"
+#include "heap.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+enum
+{
+	k_bench_repetitions = 3,
+	k_bench_queue_capacity = 1024,
+	k_bench_max_files = 512,
+	k_bench_compressed_size = 64 * 1024 * 1024,
+};
+
+typedef struct bench_files_t
+{
+	const char* test;
+	int count;
+	size_t size;
+} bench_files_t;
+
+static const bench_files_t k_bench_file_sets[] =
+{
+	{ "small", 512, 16 * 1024 },
+	{ "large", 8, 8 * 1024 * 1024 },
+};
+
+static void file_path(char* path, size_t path_size, const bench_files_t* files, int index)
+{
+	snprintf(path, path_size, "fs_bench_%s_%d.bin", files->test, index);
+}
+
+// Ask the OS to forget the file's cached pages, so the next read goes to the device.
+static bool drop_cached(const char* path)
+{
+#if defined(_WIN32)
+	return false;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	fdatasync(fd);
+	bool dropped = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	close(fd);
+	return dropped;
+#endif
+}
+
+static bool write_files(fs_t* fs, heap_t* heap, const bench_files_t* files)
+{
+	char* data = heap_alloc(heap, files->size, 8);
+	for (size_t i = 0; i < files->size; ++i)
+	{
+		data[i] = (char)(i * 31 + 7);
+	}
+
+	fs_work_t* work[k_bench_max_files];
+	for (int i = 0; i < files->count; ++i)
+	{
+		char path[256];
+		file_path(path, sizeof(path), files, i);
+		work[i] = fs_write(fs, path, data, files->size, k_fs_compression_none, k_fs_priority_normal);
+	}
+	bool ok = true;
+	for (int i = 0; i < files->count; ++i)
+	{
+		ok = ok && fs_work_get_result(work[i]) == 0;
+		fs_work_destroy(work[i]);
+	}
+
+	heap_free(heap, data);
+	return ok;
+}
+
+// Queue every read at once, as a level load would, and time until all have landed.
+static uint64_t read_files(fs_t* fs, heap_t* heap, const bench_files_t* files, bool cold)
+{
+	uint64_t best = UINT64_MAX;
+	for (int r = 0; r < k_bench_repetitions; ++r)
+	{
+		char path[256];
+		for (int i = 0; cold && i < files->count; ++i)
+		{
+			file_path(path, sizeof(path), files, i);
+			drop_cached(path);
+		}
+
+		fs_work_t* work[k_bench_max_files];
+		uint64_t t0 = timer_get_ticks();
+		for (int i = 0; i < files->count; ++i)
+		{
+			file_path(path, sizeof(path), files, i);
+			work[i] = fs_read(fs, path, heap, false, false, k_fs_priority_normal);
+		}
+		for (int i = 0; i < files->count; ++i)
+		{
+			fs_work_wait(work[i]);
+		}
+		uint64_t t1 = timer_get_ticks();
+		best = __min(best, t1 - t0);
+
+		for (int i = 0; i < files->count; ++i)
+		{
+			if (fs_work_get_result(work[i]) != 0 || fs_work_get_size(work[i]) != files->size)
+			{
+				debug_print(k_print_error, "fs_bench test=%s read %d failed: result=%d\n", files->test, i, fs_work_get_result(work[i]));
+			}
+			heap_free(heap, fs_work_get_buffer(work[i]));
+			fs_work_destroy(work[i]);
+		}
+	}
+	return best;
+}
+
+// Map every file and touch each page, as a consumer of the data would.
+static uint64_t map_files(fs_t* fs, const bench_files_t* files, bool cold)
+{
+	uint64_t best = UINT64_MAX;
+	for (int r = 0; r < k_bench_repetitions; ++r)
+	{
+		char path[256];
+		for (int i = 0; cold && i < files->count; ++i)
+		{
+			file_path(path, sizeof(path), files, i);
+			drop_cached(path);
+		}
+
+		fs_mapping_t* mappings[k_bench_max_files];
+		volatile char sum = 0;
+		uint64_t t0 = timer_get_ticks();
+		for (int i = 0; i < files->count; ++i)
+		{
+			file_path(path, sizeof(path), files, i);
+			mappings[i] = fs_map(fs, path, k_fs_map_hint_sequential | k_fs_map_hint_willneed);
+		}
+		for (int i = 0; i < files->count; ++i)
+		{
+			const char* data = fs_mapping_get_data(mappings[i]);
+			for (size_t offset = 0; data && offset < fs_mapping_get_size(mappings[i]); offset += 4096)
+			{
+				sum += data[offset];
+			}
+		}
+		uint64_t t1 = timer_get_ticks();
+		best = __min(best, t1 - t0);
+
+		for (int i = 0; i < files->count; ++i)
+		{
+			fs_unmap(mappings[i]);
+		}
+	}
+	return best;
+}
+
+// Fill a buffer with text-like data that LZ4 compresses a few times over, as typical assets do.
+static void fill_compressible(char* data, size_t size)
+{
+	static const char* k_words[] = { "vertex ", "index ", "normal ", "texture ", "0.125 ", "-1.0 ", "material ", "\n" };
+	uint32_t seed = 12345;
+	size_t offset = 0;
+	while (offset < size)
+	{
+		seed = seed * 1664525 + 1013904223;
+		const char* word = k_words[(seed >> 24) % _countof(k_words)];
+		for (size_t i = 0; word[i] && offset < size; ++i)
+		{
+			data[offset++] = (seed >> 16) % 7 == 0 ? (char)('a' + (seed >> 8) % 26) : word[i];
+		}
+	}
+}
+
+// Write and read back one large compressed file, timing each direction in uncompressed bytes.
+static void compressed_file(heap_t* heap, int level)
+{
+	const char* path = "fs_bench_compressed.lz4";
+	char* data = heap_alloc(heap, k_bench_compressed_size, 8);
+	fill_compressible(data, k_bench_compressed_size);
+
+	fs_t* fs = fs_create(heap, k_bench_queue_capacity);
+	uint64_t best_write = UINT64_MAX;
+	uint64_t best_read = UINT64_MAX;
+	bool ok = true;
+	for (int r = 0; r < k_bench_repetitions && ok; ++r)
+	{
+		uint64_t t0 = timer_get_ticks();
+		fs_work_t* work = fs_write(fs, path, data, k_bench_compressed_size, level, k_fs_priority_normal);
+		ok = fs_work_get_result(work) == 0;
+		fs_work_destroy(work);
+		uint64_t t1 = timer_get_ticks();
+
+		work = fs_read(fs, path, heap, false, true, k_fs_priority_normal);
+		ok = ok && fs_work_get_result(work) == 0 && fs_work_get_size(work) == k_bench_compressed_size &&
+			memcmp(fs_work_get_buffer(work), data, k_bench_compressed_size) == 0;
+		heap_free(heap, fs_work_get_buffer(work));
+		fs_work_destroy(work);
+		uint64_t t2 = timer_get_ticks();
+
+		best_write = __min(best_write, t1 - t0);
+		best_read = __min(best_read, t2 - t1);
+	}
+
+	fs_mapping_t* mapping = ok ? fs_map(fs, path, k_fs_map_hint_none) : NULL;
+	double ratio = mapping ? (double)k_bench_compressed_size / (double)fs_mapping_get_size(mapping) : 0.0;
+	fs_unmap(mapping);
+	fs_destroy(fs);
+
+	if (!ok)
+	{
+		debug_print(k_print_error, "fs_bench test=compressed round trip failed\n");
+	}
+
+	const char* ops[] = { "write", "read" };
+	const uint64_t ticks[] = { best_write, best_read };
+	for (int i = 0; i < _countof(ops) && ok; ++i)
+	{
+		double ms = (double)ticks[i] * 1000.0 / (double)timer_get_ticks_per_second();
+		double mb = (double)k_bench_compressed_size / (1024.0 * 1024.0);
+		debug_print(k_print_info, "fs_bench test=compressed level=%d op=%s processors=%d mb=%d ratio=%.2f ms=%.3f mb_per_s=%.1f\n",
+			level, ops[i], thread_get_processor_count(), (int)mb, ratio, ms, mb * 1000.0 / ms);
+	}
+
+	heap_free(heap, data);
+	remove(path);
+}
+
+// Load every small file through a cache twice, as a game restart would: first from disk, then from memory.
+static void cached_files(fs_t* fs, heap_t* heap)
+{
+	const bench_files_t* files = &k_bench_file_sets[0];
+	fs_cache_t* cache = fs_cache_create(heap, fs, (size_t)files->count * files->size);
+	const char* passes[] = { "miss", "hit" };
+	for (int pass = 0; pass < _countof(passes); ++pass)
+	{
+		char path[256];
+		fs_cache_entry_t* entries[k_bench_max_files];
+		uint64_t t0 = timer_get_ticks();
+		for (int i = 0; i < files->count; ++i)
+		{
+			file_path(path, sizeof(path), files, i);
+			entries[i] = fs_cache_load(cache, path, false, k_fs_priority_normal);
+		}
+		bool ok = true;
+		for (int i = 0; i < files->count; ++i)
+		{
+			ok = ok && fs_cache_entry_get_size(entries[i]) == files->size;
+		}
+		uint64_t t1 = timer_get_ticks();
+		for (int i = 0; i < files->count; ++i)
+		{
+			fs_cache_release(entries[i]);
+		}
+
+		fs_cache_stats_t stats;
+		fs_cache_get_stats(cache, &stats);
+		double ms = (double)(t1 - t0) * 1000.0 / (double)timer_get_ticks_per_second();
+		debug_print(ok ? k_print_info : k_print_error, "fs_bench test=cache pass=%s files=%d file_kb=%d ms=%.3f hits=%lld misses=%lld cache_kb=%d\n",
+			passes[pass], files->count, (int)(files->size / 1024), ms, stats.hits, stats.misses, (int)(stats.size / 1024));
+	}
+	fs_cache_destroy(cache);
+}
+
+static const char* priority_name(fs_priority_t priority)
+{
+	static const char* k_names[] = { "critical", "normal", "background" };
+	return k_names[priority];
+}
+
+// Queue a burst of background reads, as a prefetch would, then one more read at a priority,
+// and time that read. Whatever of the burst is still queued after it is cancelled.
+static void priority_read(fs_t* fs, heap_t* heap, const char* backend, fs_priority_t priority)
+{
+	const bench_files_t* files = &k_bench_file_sets[0];
+	char path[256];
+	fs_work_t* work[k_bench_max_files];
+	for (int i = 0; i < files->count; ++i)
+	{
+		file_path(path, sizeof(path), files, i);
+		work[i] = fs_read(fs, path, heap, false, false, k_fs_priority_background);
+	}
+
+	file_path(path, sizeof(path), files, 0);
+	uint64_t t0 = timer_get_ticks();
+	fs_work_t* urgent = fs_read(fs, path, heap, false, false, priority);
+	fs_work_wait(urgent);
+	uint64_t t1 = timer_get_ticks();
+	heap_free(heap, fs_work_get_buffer(urgent));
+	fs_work_destroy(urgent);
+
+	int cancelled = 0;
+	for (int i = 0; i < files->count; ++i)
+	{
+		cancelled += fs_work_cancel(work[i]) ? 1 : 0;
+	}
+	for (int i = 0; i < files->count; ++i)
+	{
+		heap_free(heap, fs_work_get_buffer(work[i]));
+		fs_work_destroy(work[i]);
+	}
+
+	double ms = (double)(t1 - t0) * 1000.0 / (double)timer_get_ticks_per_second();
+	debug_print(k_print_info, "fs_bench backend=%s test=priority queued=%d priority=%s ms=%.3f cancelled=%d\n",
+		backend, files->count, priority_name(priority), ms, cancelled);
+}
+
+static void report_priority_stats(fs_t* fs, const char* backend)
+{
+	for (int p = 0; p < k_fs_priority_count; ++p)
+	{
+		fs_priority_stats_t stats;
+		fs_get_priority_stats(fs, (fs_priority_t)p, &stats);
+		double tick_ms = 1000.0 / (double)timer_get_ticks_per_second();
+		debug_print(k_print_info, "fs_bench backend=%s test=queue_wait priority=%s started=%lld cancelled=%lld mean_wait_ms=%.3f max_wait_ms=%.3f\n",
+			backend, priority_name((fs_priority_t)p), stats.started, stats.cancelled,
+			stats.started ? (double)stats.wait_ticks * tick_ms / (double)stats.started : 0.0,
+			(double)stats.max_wait_ticks * tick_ms);
+	}
+}
+
+static void report(const char* backend, const bench_files_t* files, bool cold, uint64_t ticks)
+{
+	double ms = (double)ticks * 1000.0 / (double)timer_get_ticks_per_second();
+	double mb = (double)files->size * files->count / (1024.0 * 1024.0);
+	debug_print(k_print_info, "fs_bench backend=%s test=%s cache=%s files=%d file_kb=%d ms=%.3f mb_per_s=%.1f\n",
+		backend, files->test, cold ? "cold" : "warm", files->count, (int)(files->size / 1024),
+		ms, mb * 1000.0 / ms);
+}
+
+static const char* backend_name(fs_backend_t backend)
+{
+	return backend == k_fs_backend_uring ? "uring" : "threads";
+}
+
+void fs_bench_run(heap_t* heap)
+{
+	fs_t* writer = fs_create_backend(heap, k_bench_queue_capacity, k_fs_backend_threads);
+	for (int f = 0; f < _countof(k_bench_file_sets); ++f)
+	{
+		if (!write_files(writer, heap, &k_bench_file_sets[f]))
+		{
+			debug_print(k_print_error, "fs_bench unable to write scratch files\n");
+		}
+	}
+	fs_destroy(writer);
+
+	char path[256];
+	file_path(path, sizeof(path), &k_bench_file_sets[0], 0);
+	bool can_drop = drop_cached(path);
+
+	const fs_backend_t backends[] = { k_fs_backend_threads, k_fs_backend_uring };
+	for (int b = 0; b < _countof(backends); ++b)
+	{
+		fs_t* fs = fs_create_backend(heap, k_bench_queue_capacity, backends[b]);
+		if (fs_get_backend(fs) != backends[b])
+		{
+			debug_print(k_print_info, "fs_bench backend=%s unavailable\n", backend_name(backends[b]));
+			fs_destroy(fs);
+			continue;
+		}
+
+		for (int f = 0; f < _countof(k_bench_file_sets); ++f)
+		{
+			const bench_files_t* files = &k_bench_file_sets[f];
+			for (int cold = 0; cold <= (can_drop ? 1 : 0); ++cold)
+			{
+				report(backend_name(backends[b]), files, cold != 0, read_files(fs, heap, files, cold != 0));
+			}
+		}
+
+		// The same read behind a burst of prefetches: first waiting its turn, then jumping the queue.
+		priority_read(fs, heap, backend_name(backends[b]), k_fs_priority_background);
+		priority_read(fs, heap, backend_name(backends[b]), k_fs_priority_critical);
+		report_priority_stats(fs, backend_name(backends[b]));
+		fs_destroy(fs);
+	}
+
+	fs_t* fs = fs_create(heap, k_bench_queue_capacity);
+	for (int f = 0; f < _countof(k_bench_file_sets); ++f)
+	{
+		for (int cold = 0; cold <= (can_drop ? 1 : 0); ++cold)
+		{
+			report("map", &k_bench_file_sets[f], cold != 0, map_files(fs, &k_bench_file_sets[f], cold != 0));
+		}
+	}
+	cached_files(fs, heap);
+	fs_destroy(fs);
+
+	compressed_file(heap, k_fs_compression_fast);
+	compressed_file(heap, k_fs_compression_hc_min);
+
+	for (int f = 0; f < _countof(k_bench_file_sets); ++f)
+	{
+		for (int i = 0; i < k_bench_file_sets[f].count; ++i)
+		{
+			file_path(path, sizeof(path), &k_bench_file_sets[f], i);
+			remove(path);
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// File system benchmark
+// Measures asset-load throughput of each fs backend, and of fs_map(): many small files, and a few large ones.
+// Also measures compressed writes and reads of one large file, with fast LZ4 and with LZ4HC,
+// which scale with the processor count, how long one read waits behind a burst of background reads
+// at background and at critical priority, and loading the small files through fs_cache twice.
+
+typedef struct heap_t heap_t;
+
+// Write a set of scratch files to the working directory, read them back with every backend,
+// map them and touch every page, then delete them.
+// Each result is printed as a single line:
+//   fs_bench backend=<name> test=<name> cache=<warm|cold> files=<n> file_kb=<n> ms=<f> mb_per_s=<f>
+// Cold runs first drop the files from the page cache, where the platform allows it.
+// The compressed file is reported as:
+//   fs_bench test=compressed level=<n> op=<write|read> processors=<n> mb=<n> ratio=<f> ms=<f> mb_per_s=<f>
+// The priority tests are reported as:
+//   fs_bench backend=<name> test=priority queued=<n> priority=<name> ms=<f> cancelled=<n>
+//   fs_bench backend=<name> test=queue_wait priority=<name> started=<n> cancelled=<n> mean_wait_ms=<f> max_wait_ms=<f>
+// The cache test is reported as:
+//   fs_bench test=cache pass=<miss|hit> files=<n> file_kb=<n> ms=<f> hits=<n> misses=<n> cache_kb=<n>
+void fs_bench_run(heap_t* heap);
@@ -0,0 +1,291 @@
+#include "fs_cache.h"
+
+#include "heap.h"
+#include "lock.h"
+#include "lz4/xxhash.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+enum
+{
+	k_fs_cache_buckets = 1024,
+};
+
+typedef struct fs_cache_entry_t
+{
+	fs_cache_t* cache;
+	char* path;
+	uint64_t hash;
+	bool use_compression;
+	uint64_t modified;
+	uint64_t file_size;
+
+	// The read filling the entry. Its buffer is the cached contents.
+	fs_work_t* work;
+	// Bytes charged to the cache: the file size until the contents are loaded, then their size.
+	size_t charge;
+
+	int references;
+	// False once removed from the table, for entries still referenced when their file changed.
+	bool cached;
+	struct fs_cache_entry_t* next_in_bucket;
+
+	// Unreferenced entries, least recently used first.
+	struct fs_cache_entry_t* lru_prev;
+	struct fs_cache_entry_t* lru_next;
+} fs_cache_entry_t;
+
+typedef struct fs_cache_t
+{
+	heap_t* heap;
+	fs_t* fs;
+	size_t budget;
+	lock_t lock;
+	fs_cache_entry_t* buckets[k_fs_cache_buckets];
+	fs_cache_entry_t* lru_first;
+	fs_cache_entry_t* lru_last;
+	fs_cache_stats_t stats;
+} fs_cache_t;
+
+#if defined(_WIN32)
+
+static bool file_get_info(const char* path, uint64_t* modified, uint64_t* size)
+{
+	wchar_t wide_path[1024];
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0 ||
+		!GetFileAttributesEx(wide_path, GetFileExInfoStandard, &data))
+	{
+		return false;
+	}
+	*modified = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	*size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	return true;
+}
+
+#else
+
+static bool file_get_info(const char* path, uint64_t* modified, uint64_t* size)
+{
+	struct stat info;
+	if (stat(path, &info) != 0)
+	{
+		return false;
+	}
+	*modified = (uint64_t)info.st_mtim.tv_sec * 1000000000ull + (uint64_t)info.st_mtim.tv_nsec;
+	*size = (uint64_t)info.st_size;
+	return true;
+}
+
+#endif
+
+fs_cache_t* fs_cache_create(heap_t* heap, fs_t* fs, size_t budget)
+{
+	fs_cache_t* cache = heap_alloc(heap, sizeof(fs_cache_t), 8);
+	memset(cache, 0, sizeof(*cache));
+	cache->heap = heap;
+	cache->fs = fs;
+	cache->budget = budget;
+	lock_init(&cache->lock, "fs_cache");
+	return cache;
+}
+
+static void entry_free(fs_cache_entry_t* entry)
+{
+	heap_t* heap = entry->cache->heap;
+	heap_free(heap, fs_work_get_buffer(entry->work));
+	fs_work_destroy(entry->work);
+	heap_free(heap, entry->path);
+	heap_free(heap, entry);
+}
+
+void fs_cache_destroy(fs_cache_t* cache)
+{
+	for (int i = 0; i < k_fs_cache_buckets; ++i)
+	{
+		fs_cache_entry_t* entry = cache->buckets[i];
+		while (entry)
+		{
+			fs_cache_entry_t* next = entry->next_in_bucket;
+			entry_free(entry);
+			entry = next;
+		}
+	}
+	lock_destroy(&cache->lock);
+	heap_free(cache->heap, cache);
+}
+
+static void lru_unlink(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	*(entry->lru_prev ? &entry->lru_prev->lru_next : &cache->lru_first) = entry->lru_next;
+	*(entry->lru_next ? &entry->lru_next->lru_prev : &cache->lru_last) = entry->lru_prev;
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void lru_push(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	entry->lru_prev = cache->lru_last;
+	entry->lru_next = NULL;
+	*(cache->lru_last ? &cache->lru_last->lru_next : &cache->lru_first) = entry;
+	cache->lru_last = entry;
+}
+
+// Take an entry out of the table, freeing it unless it is still referenced. Called with the lock held.
+static void entry_remove(fs_cache_t* cache, fs_cache_entry_t* entry)
+{
+	fs_cache_entry_t** link = &cache->buckets[entry->hash & (k_fs_cache_buckets - 1)];
+	while (*link != entry)
+	{
+		link = &(*link)->next_in_bucket;
+	}
+	*link = entry->next_in_bucket;
+	entry->cached = false;
+	cache->stats.size -= entry->charge;
+
+	if (entry->references == 0)
+	{
+		lru_unlink(cache, entry);
+		entry_free(entry);
+	}
+}
+
+// Evict unreferenced entries, least recently used first, until the cache is within its budget.
+static void evict(fs_cache_t* cache)
+{
+	while (cache->stats.size > cache->budget && cache->lru_first)
+	{
+		entry_remove(cache, cache->lru_first);
+		cache->stats.evictions++;
+	}
+}
+
+// Find a cached entry that still matches the file on disk. Stale and failed entries are removed.
+static fs_cache_entry_t* entry_find(fs_cache_t* cache, const char* path, uint64_t hash, bool use_compression, uint64_t modified, uint64_t file_size)
+{
+	fs_cache_entry_t* entry = cache->buckets[hash & (k_fs_cache_buckets - 1)];
+	while (entry && (entry->hash != hash || entry->use_compression != use_compression || strcmp(entry->path, path) != 0))
+	{
+		entry = entry->next_in_bucket;
+	}
+	if (entry && (entry->modified != modified || entry->file_size != file_size ||
+		(fs_work_is_done(entry->work) && fs_work_get_result(entry->work) != 0)))
+	{
+		entry_remove(cache, entry);
+		entry = NULL;
+	}
+	return entry;
+}
+
+fs_cache_entry_t* fs_cache_load(fs_cache_t* cache, const char* path, bool use_compression, fs_priority_t priority)
+{
+	uint64_t modified = 0;
+	uint64_t file_size = 0;
+	if (!file_get_info(path, &modified, &file_size))
+	{
+		return NULL;
+	}
+	size_t path_size = strlen(path) + 1;
+	uint64_t hash = XXH64(path, path_size - 1, use_compression ? 1 : 0);
+
+	lock_acquire(&cache->lock);
+	fs_cache_entry_t* entry = entry_find(cache, path, hash, use_compression, modified, file_size);
+	if (entry)
+	{
+		if (entry->references++ == 0)
+		{
+			lru_unlink(cache, entry);
+		}
+		cache->stats.hits++;
+		lock_release(&cache->lock);
+		return entry;
+	}
+
+	entry = heap_alloc(cache->heap, sizeof(fs_cache_entry_t), 8);
+	memset(entry, 0, sizeof(*entry));
+	entry->cache = cache;
+	entry->path = heap_alloc(cache->heap, path_size, 8);
+	memcpy(entry->path, path, path_size);
+	entry->hash = hash;
+	entry->use_compression = use_compression;
+	entry->modified = modified;
+	entry->file_size = file_size;
+	entry->work = fs_read(cache->fs, path, cache->heap, false, use_compression, priority);
+	entry->charge = (size_t)file_size;
+	entry->references = 1;
+	entry->cached = true;
+
+	fs_cache_entry_t** bucket = &cache->buckets[hash & (k_fs_cache_buckets - 1)];
+	entry->next_in_bucket = *bucket;
+	*bucket = entry;
+	cache->stats.size += entry->charge;
+	cache->stats.misses++;
+	evict(cache);
+	lock_release(&cache->lock);
+	return entry;
+}
+
+void fs_cache_release(fs_cache_entry_t* entry)
+{
+	if (!entry)
+	{
+		return;
+	}
+
+	// An unreferenced entry may be evicted, so its read must be done first. Wait outside the lock.
+	fs_work_wait(entry->work);
+
+	fs_cache_t* cache = entry->cache;
+	lock_acquire(&cache->lock);
+	if (--entry->references == 0)
+	{
+		// A failed read stays until the next load of its path replaces it, or it is evicted.
+		if (!entry->cached)
+		{
+			entry_free(entry);
+		}
+		else
+		{
+			size_t size = fs_work_get_size(entry->work);
+			cache->stats.size = cache->stats.size - entry->charge + size;
+			entry->charge = size;
+			lru_push(cache, entry);
+			evict(cache);
+		}
+	}
+	lock_release(&cache->lock);
+}
+
+bool fs_cache_entry_is_done(fs_cache_entry_t* entry)
+{
+	return entry ? fs_work_is_done(entry->work) : true;
+}
+
+int fs_cache_entry_get_result(fs_cache_entry_t* entry)
+{
+	return entry ? fs_work_get_result(entry->work) : -1;
+}
+
+const void* fs_cache_entry_get_data(fs_cache_entry_t* entry)
+{
+	return entry ? fs_work_get_buffer(entry->work) : NULL;
+}
+
+size_t fs_cache_entry_get_size(fs_cache_entry_t* entry)
+{
+	return entry ? fs_work_get_size(entry->work) : 0;
+}
+
+void fs_cache_get_stats(fs_cache_t* cache, fs_cache_stats_t* stats)
+{
+	lock_acquire(&cache->lock);
+	*stats = cache->stats;
+	lock_release(&cache->lock);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "fs.h"
+
+// File cache
+// Keeps the contents of files read through fs in memory, so loading the same file again
+// costs a hash lookup instead of I/O and decompression.
+// Entries are keyed by path, and checked against the file's modification time and size,
+// so a file changed on disk is read again.
+// Entries no longer referenced stay cached until the memory budget is exceeded,
+// then the least recently used are evicted first. Safe to use from any thread.
+// Contents are copied into the heap, so the cache suits files that are decompressed or decoded on load.
+// Files used as they are on disk are better mapped with fs_map(), which shares the OS page cache instead.
+
+// Handle to a file cache.
+typedef struct fs_cache_t fs_cache_t;
+
+// Handle to a cached file. Reference counted: each fs_cache_load() must be paired with fs_cache_release().
+typedef struct fs_cache_entry_t fs_cache_entry_t;
+
+typedef struct fs_cache_stats_t
+{
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
+	// Bytes of file contents held, referenced or not.
+	size_t size;
+} fs_cache_stats_t;
+
+// Create a cache reading through a file system.
+// File contents are allocated out of the provided heap, up to budget bytes for entries not in use.
+fs_cache_t* fs_cache_create(heap_t* heap, fs_t* fs, size_t budget);
+
+// Destroy a cache. Every entry must have been released.
+void fs_cache_destroy(fs_cache_t* cache);
+
+// Get a reference to a file's contents, queueing a read on a miss.
+// With use_compression, the file is decompressed as fs_read() does, and the decompressed contents are cached.
+// Returns NULL if the file does not exist.
+fs_cache_entry_t* fs_cache_load(fs_cache_t* cache, const char* path, bool use_compression, fs_priority_t priority);
+
+// Drop a reference to an entry. Its data must no longer be used.
+// The entry getters below, and release, accept a NULL entry.
+void fs_cache_release(fs_cache_entry_t* entry);
+
+// If true, the entry's contents are loaded.
+bool fs_cache_entry_is_done(fs_cache_entry_t* entry);
+
+// Block for the entry to load and get the error code of its read. Zero indicates success.
+int fs_cache_entry_get_result(fs_cache_entry_t* entry);
+
+// Block for the entry to load and get its contents.
+const void* fs_cache_entry_get_data(fs_cache_entry_t* entry);
+
+// Block for the entry to load and get the size of its contents.
+size_t fs_cache_entry_get_size(fs_cache_entry_t* entry);
+
+// Get the cache's hit, miss and eviction counts since it was created, and its current size.
+void fs_cache_get_stats(fs_cache_t* cache, fs_cache_stats_t* stats);
@@ -0,0 +1,41 @@
+#include "futex.h"
+
+#if defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+void futex_wait(int* address, int expected)
+{
+	WaitOnAddress(address, &expected, sizeof(int), INFINITE);
+}
+
+void futex_wake(int* address, int count)
+{
+	if (count == 1)
+	{
+		WakeByAddressSingle(address);
+	}
+	else
+	{
+		WakeByAddressAll(address);
+	}
+}
+
+#else
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+void futex_wait(int* address, int expected)
+{
+	syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+void futex_wake(int* address, int count)
+{
+	syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#endif
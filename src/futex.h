@@ -0,0 +1,11 @@
+#pragma once
+
+// Futex wait/wake on a 32-bit word.
+// Linux futex syscall, or WaitOnAddress on Windows.
+
+// Sleep while *address equals expected.
+// Returns immediately if the value already differs; may also wake spuriously.
+void futex_wait(int* address, int expected);
+
+// Wake up to count threads sleeping on address.
+void futex_wake(int* address, int count);
@@ -0,0 +1,272 @@
+#include "future.h"
+
+#include "atomic.h"
+#include "futex.h"
+#include "heap.h"
+#include "job.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+
+enum
+{
+	k_future_pending = 0,
+	k_future_pending_with_waiters = 1,
+	k_future_done = 2,
+};
+
+// A function to run when a future completes, and the future it completes in turn.
+// A continuation without a function counts down a future_when_all(),
+// or with a counter, releases a job waiting in future_wait_job().
+typedef struct continuation_t
+{
+	struct continuation_t* next;
+	heap_t* heap;
+	future_t* target;
+	future_func_t func;
+	void* data;
+	job_system_t* jobs;
+	job_counter_t* counter;
+	int result;
+} continuation_t;
+
+typedef struct future_t
+{
+	heap_t* heap;
+	int state;
+	int refs;
+	int result;
+
+	// Stack of continuations added before completion.
+	// Completion swaps in future_completed, after which continuations are dispatched as soon as they are added.
+	continuation_t* continuations;
+
+	// Used by future_when_all().
+	int remaining;
+	int first_error;
+} future_t;
+
+// Marks the continuation stack of a completed future. Never dereferenced.
+#define future_completed ((continuation_t*)1)
+
+static void run_continuation(continuation_t* continuation)
+{
+	future_t* target = continuation->target;
+	if (continuation->counter)
+	{
+		job_counter_decrement(continuation->jobs, continuation->counter);
+	}
+	else if (continuation->func)
+	{
+		future_complete(target, continuation->func(continuation->result, continuation->data));
+	}
+	else
+	{
+		if (continuation->result != 0)
+		{
+			atomic_compare_and_exchange(&target->first_error, 0, continuation->result);
+		}
+		if (atomic_decrement(&target->remaining) == 1)
+		{
+			future_complete(target, atomic_load(&target->first_error));
+		}
+	}
+	future_release(target);
+	heap_free(continuation->heap, continuation);
+}
+
+static void continuation_job(void* data)
+{
+	run_continuation(data);
+}
+
+static void dispatch(continuation_t* continuation)
+{
+	if (continuation->jobs && !continuation->counter)
+	{
+		job_run(continuation->jobs, continuation_job, continuation, NULL);
+	}
+	else
+	{
+		run_continuation(continuation);
+	}
+}
+
+static continuation_t* continuation_create(heap_t* heap, future_t* target, job_system_t* jobs, future_func_t func, void* data)
+{
+	continuation_t* continuation = heap_alloc(heap, sizeof(continuation_t), 8);
+	continuation->next = NULL;
+	continuation->heap = heap;
+	continuation->target = target;
+	continuation->func = func;
+	continuation->data = data;
+	continuation->jobs = jobs;
+	continuation->counter = NULL;
+	continuation->result = 0;
+	if (target)
+	{
+		future_retain(target);
+	}
+	return continuation;
+}
+
+static void add_continuation(future_t* future, continuation_t* continuation)
+{
+	continuation_t* head = atomic_load_ptr((void**)&future->continuations);
+	while (head != future_completed)
+	{
+		continuation->next = head;
+		continuation_t* old = atomic_compare_and_exchange_ptr((void**)&future->continuations, head, continuation);
+		if (old == head)
+		{
+			return;
+		}
+		head = old;
+	}
+
+	continuation->result = future->result;
+	dispatch(continuation);
+}
+
+future_t* future_create(heap_t* heap)
+{
+	future_t* future = heap_alloc(heap, sizeof(future_t), 8);
+	future->heap = heap;
+	future->state = k_future_pending;
+	future->refs = 1;
+	future->result = 0;
+	future->continuations = NULL;
+	future->remaining = 0;
+	future->first_error = 0;
+	return future;
+}
+
+void future_retain(future_t* future)
+{
+	atomic_increment(&future->refs);
+}
+
+void future_release(future_t* future)
+{
+	if (future && atomic_decrement(&future->refs) == 1)
+	{
+		heap_free(future->heap, future);
+	}
+}
+
+void future_complete(future_t* future, int result)
+{
+	// A second completion would overwrite the result seen by waiters. Ignore it.
+	if (atomic_load(&future->state) == k_future_done)
+	{
+		assert(!"future completed twice");
+		return;
+	}
+
+	// A waiter may release the future as soon as it sees it complete, so hold a reference until done with it.
+	future_retain(future);
+	future->result = result;
+	if (atomic_exchange(&future->state, k_future_done) == k_future_pending_with_waiters)
+	{
+		futex_wake(&future->state, INT_MAX);
+	}
+
+	// The stack holds the newest continuation first; reverse it so they run in the order they were added.
+	continuation_t* continuation = atomic_exchange_ptr((void**)&future->continuations, future_completed);
+	if (continuation == future_completed)
+	{
+		// Completed concurrently by another thread, which dispatched the continuations.
+		assert(!"future completed twice");
+		future_release(future);
+		return;
+	}
+	continuation_t* ordered = NULL;
+	while (continuation)
+	{
+		continuation_t* next = continuation->next;
+		continuation->next = ordered;
+		ordered = continuation;
+		continuation = next;
+	}
+	while (ordered)
+	{
+		continuation_t* next = ordered->next;
+		ordered->result = result;
+		dispatch(ordered);
+		ordered = next;
+	}
+	future_release(future);
+}
+
+bool future_is_done(future_t* future)
+{
+	return atomic_load(&future->state) == k_future_done;
+}
+
+void future_wait(future_t* future)
+{
+	int state;
+	while ((state = atomic_load(&future->state)) != k_future_done)
+	{
+		// Flag that a waiter is sleeping, so completion only makes a wake call when needed.
+		if (state == k_future_pending)
+		{
+			atomic_compare_and_exchange(&future->state, k_future_pending, k_future_pending_with_waiters);
+		}
+		futex_wait(&future->state, k_future_pending_with_waiters);
+	}
+}
+
+void future_wait_job(future_t* future, job_system_t* jobs)
+{
+	if (future_is_done(future))
+	{
+		return;
+	}
+
+	// Wait on a counter released by a continuation, so the job is resumed on completion rather than polled.
+	job_counter_t counter = { 0 };
+	job_counter_increment(&counter);
+	continuation_t* continuation = continuation_create(future->heap, NULL, jobs, NULL, NULL);
+	continuation->counter = &counter;
+	add_continuation(future, continuation);
+	job_wait(jobs, &counter);
+}
+
+int future_get_result(future_t* future)
+{
+	future_wait(future);
+	return future->result;
+}
+
+future_t* future_then(future_t* future, job_system_t* jobs, future_func_t func, void* data)
+{
+	future_t* target = future_create(future->heap);
+	add_continuation(future, continuation_create(future->heap, target, jobs, func, data));
+	return target;
+}
+
+future_t* future_when_all(heap_t* heap, future_t** futures, int count)
+{
+	future_t* target = future_create(heap);
+	if (count == 0)
+	{
+		future_complete(target, 0);
+		return target;
+	}
+
+	target->remaining = count;
+	for (int i = 0; i < count; ++i)
+	{
+		add_continuation(futures[i], continuation_create(heap, target, NULL, NULL, NULL));
+	}
+	return target;
+}
+
+future_t* future_run(heap_t* heap, job_system_t* jobs, future_func_t func, void* data)
+{
+	future_t* target = future_create(heap);
+	job_run(jobs, continuation_job, continuation_create(heap, target, jobs, func, data), NULL);
+	return target;
+}
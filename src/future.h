@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Future with continuations
+// A lightweight completion object for asynchronous work: file operations, jobs and network events.
+// It holds an integer result, where zero generally indicates success.
+// Continuations chain further work onto a future without blocking, and futures can be combined with future_when_all().
+// No kernel object is created per future; waiting threads sleep on the future's state word.
+// Futures are reference counted: each function returning a future gives the caller a reference to release.
+
+typedef struct future_t future_t;
+
+typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+
+// Function run by a continuation or by future_run().
+// Receives the result of the future it continues (zero for future_run()),
+// and returns the result of the future it completes.
+typedef int (*future_func_t)(int result, void* data);
+
+// Create an incomplete future, allocated from heap.
+future_t* future_create(heap_t* heap);
+
+// Add a reference to a future.
+void future_retain(future_t* future);
+
+// Drop a reference to a future. It is freed with its last reference.
+void future_release(future_t* future);
+
+// Complete a future with a result, wake its waiters and dispatch its continuations.
+// Must be called exactly once per future; a second completion asserts and is otherwise ignored.
+void future_complete(future_t* future, int result);
+
+// If true, the future is complete.
+bool future_is_done(future_t* future);
+
+// Block until the future is complete.
+void future_wait(future_t* future);
+
+// Block until the future is complete without stalling the job system.
+// Called from a job, the job is suspended and its worker runs other jobs meanwhile;
+// completion resumes it, so no worker polls the future.
+void future_wait_job(future_t* future, job_system_t* jobs);
+
+// Wait for the future and get its result.
+int future_get_result(future_t* future);
+
+// Run func once future completes and return a future completed with func's return value.
+// If jobs is NULL, func runs on the thread that completes future, or immediately if it already has;
+// otherwise func is queued as a job.
+future_t* future_then(future_t* future, job_system_t* jobs, future_func_t func, void* data);
+
+// Return a future completed once all count futures are.
+// Its result is zero if every future succeeded, otherwise the first non-zero result found.
+future_t* future_when_all(heap_t* heap, future_t** futures, int count);
+
+// Run func as a job and return a future completed with its return value.
+future_t* future_run(heap_t* heap, job_system_t* jobs, future_func_t func, void* data);
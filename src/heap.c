@@ -1,7 +1,7 @@
 #include "heap.h"
 
 #include "debug.h"
-#include "mutex.h"
+#include "lock.h"
 #include "tlsf/tlsf.h"
 
 #include <stddef.h>
@@ -21,7 +21,7 @@ typedef struct heap_t
 	tlsf_t tlsf;
 	size_t grow_increment;
 	arena_t* arena;
-	mutex_t* mutex;
+	lock_t lock;
 } heap_t;
 
 heap_t* heap_create(size_t grow_increment)
@@ -36,7 +36,7 @@ heap_t* heap_create(size_t grow_increment)
 		return NULL;
 	}
 
-	heap->mutex = mutex_create();
+	lock_init(&heap->lock, "heap");
 	heap->grow_increment = grow_increment;
 	heap->tlsf = tlsf_create(heap + 1);
 	heap->arena = NULL;
@@ -46,7 +46,7 @@ heap_t* heap_create(size_t grow_increment)
 
 void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 {
-	mutex_lock(heap->mutex);
+	lock_acquire(&heap->lock);
 
 	void* address = tlsf_memalign(heap->tlsf, alignment, size);
 	if (!address)
@@ -62,6 +62,7 @@ void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 			debug_print(
 				k_print_error,
 				"OUT OF MEMORY!\n");
+			lock_release(&heap->lock);
 			return NULL;
 		}
 
@@ -73,16 +74,16 @@ void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 		address = tlsf_memalign(heap->tlsf, alignment, size);
 	}
 
-	mutex_unlock(heap->mutex);
+	lock_release(&heap->lock);
 
 	return address;
 }
 
 void heap_free(heap_t* heap, void* address)
 {
-	mutex_lock(heap->mutex);
+	lock_acquire(&heap->lock);
 	tlsf_free(heap->tlsf, address);
-	mutex_unlock(heap->mutex);
+	lock_release(&heap->lock);
 }
 
 void heap_destroy(heap_t* heap)
@@ -98,7 +99,7 @@ void heap_destroy(heap_t* heap)
 		arena = next;
 	}
 
-	mutex_destroy(heap->mutex);
+	lock_destroy(&heap->lock);
 
 	VirtualFree(heap, 0, MEM_RELEASE);
 }
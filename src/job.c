@@ -0,0 +1,741 @@
+#include "job.h"
+
+#include "atomic.h"
+#include "cpu_topology.h"
+#include "fiber.h"
+#include "heap.h"
+#include "lock.h"
+#include "queue.h"
+#include "semaphore.h"
+#include "thread.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#define job_thread_local __declspec(thread)
+#define job_noinline __declspec(noinline)
+#else
+#define job_thread_local _Thread_local
+#define job_noinline __attribute__((noinline))
+#endif
+
+enum
+{
+	k_job_cache_line = 64,
+	k_job_max_jobs = 4096,
+	k_job_spin_count = 64,
+	k_job_counter_spin_count = 16,
+	k_job_max_fibers = 128,
+	k_job_fiber_stack_size = 64 * 1024,
+};
+
+// What the next fiber to run must do with the one that switched to it.
+// A fiber can't publish itself before it has stopped running, or another worker could resume it too early.
+typedef enum job_pending_t
+{
+	k_job_pending_none,
+	k_job_pending_release,
+	k_job_pending_wait_counter,
+	k_job_pending_wait_poll,
+} job_pending_t;
+
+typedef struct job_t
+{
+	job_func_t func;
+	job_range_func_t range_func;
+	void* data;
+	int begin;
+	int end;
+	job_counter_t* counter;
+	job_t* next;
+} job_t;
+
+// A fiber from the pool. Idle fibers run the scheduling loop; suspended ones sit in a waiting job.
+typedef struct job_fiber_t
+{
+	fiber_t* fiber;
+	job_system_t* system;
+	job_poll_func_t poll;
+	void* poll_data;
+	job_fiber_t* next;
+} job_fiber_t;
+
+// Chase-Lev deque. The owning worker pushes and pops at the bottom; thieves take from the top.
+typedef struct job_deque_t
+{
+	job_t** jobs;
+	char pad0[k_job_cache_line - sizeof(job_t**)];
+	int top;
+	char pad1[k_job_cache_line - sizeof(int)];
+	int bottom;
+	char pad2[k_job_cache_line - sizeof(int)];
+} job_deque_t;
+
+typedef struct job_worker_t
+{
+	job_system_t* system;
+	int index;
+	thread_t* thread;
+	fiber_t* thread_fiber;
+	job_fiber_t* current_fiber;
+	job_pending_t pending;
+	job_fiber_t* pending_fiber;
+	job_counter_t* pending_counter;
+	job_deque_t deque;
+} job_worker_t;
+
+typedef struct job_system_t
+{
+	heap_t* heap;
+	int worker_count;
+	job_worker_t* workers;
+
+	// Jobs submitted from threads that are not workers.
+	queue_t* injected_jobs;
+
+	job_t* job_storage;
+	queue_t* free_jobs;
+
+	job_fiber_t* fiber_storage;
+	queue_t* free_fibers;
+	queue_t* ready_fibers;
+
+	// Fibers suspended in job_wait_until().
+	job_fiber_t* polled_fibers[k_job_max_fibers];
+	int polled_count;
+	lock_t polled_lock;
+
+	semaphore_t* work_available;
+	int sleepers;
+	int quit;
+} job_system_t;
+
+// The worker running on the current thread, if any.
+// Thread-local state is the one module-level variable here: a job must find its own deque.
+static job_thread_local job_worker_t* s_worker = NULL;
+
+static int worker_thread_func(void* user);
+static void fiber_func(void* data);
+
+// Indices wrap; compare them as a signed distance.
+static int index_diff(int a, int b)
+{
+	return (int)((unsigned int)a - (unsigned int)b);
+}
+
+static int index_add(int a, int b)
+{
+	return (int)((unsigned int)a + (unsigned int)b);
+}
+
+static bool deque_push(job_deque_t* deque, job_t* job)
+{
+	int bottom = deque->bottom;
+	int top = atomic_load(&deque->top);
+	if (index_diff(bottom, top) >= k_job_max_jobs)
+	{
+		return false;
+	}
+	deque->jobs[bottom & (k_job_max_jobs - 1)] = job;
+	atomic_store(&deque->bottom, index_add(bottom, 1));
+	return true;
+}
+
+static job_t* deque_pop(job_deque_t* deque)
+{
+	// The decrement is a full barrier, so thieves see the reservation before we read top.
+	int bottom = index_add(atomic_decrement(&deque->bottom), -1);
+	int top = atomic_load(&deque->top);
+	if (index_diff(bottom, top) < 0)
+	{
+		atomic_store(&deque->bottom, top);
+		return NULL;
+	}
+
+	job_t* job = deque->jobs[bottom & (k_job_max_jobs - 1)];
+	if (bottom != top)
+	{
+		return job;
+	}
+
+	// Last job: race thieves for it.
+	if (atomic_compare_and_exchange(&deque->top, top, index_add(top, 1)) != top)
+	{
+		job = NULL;
+	}
+	atomic_store(&deque->bottom, index_add(top, 1));
+	return job;
+}
+
+static job_t* deque_steal(job_deque_t* deque)
+{
+	int top = atomic_load(&deque->top);
+	int bottom = atomic_load(&deque->bottom);
+	if (index_diff(bottom, top) <= 0)
+	{
+		return NULL;
+	}
+
+	job_t* job = deque->jobs[top & (k_job_max_jobs - 1)];
+	if (atomic_compare_and_exchange(&deque->top, top, index_add(top, 1)) != top)
+	{
+		return NULL;
+	}
+	return job;
+}
+
+// Never inlined: a fiber may resume on another thread, so the thread-local address must not be cached across a switch.
+static job_noinline job_worker_t* current_worker(job_system_t* system)
+{
+	return (s_worker && s_worker->system == system) ? s_worker : NULL;
+}
+
+static job_t* find_job(job_system_t* system, job_worker_t* worker)
+{
+	job_t* job = NULL;
+	if (worker)
+	{
+		job = deque_pop(&worker->deque);
+	}
+	if (!job)
+	{
+		job = queue_try_pop(system->injected_jobs);
+	}
+
+	int start = worker ? worker->index + 1 : 0;
+	for (int i = 0; i < system->worker_count && !job; ++i)
+	{
+		job_worker_t* victim = &system->workers[(start + i) % system->worker_count];
+		if (victim != worker)
+		{
+			job = deque_steal(&victim->deque);
+		}
+	}
+	return job;
+}
+
+static void wake_worker(job_system_t* system)
+{
+	// Read with a full barrier so the check is ordered after the job was published.
+	if (atomic_compare_and_exchange(&system->sleepers, 0, 0) > 0)
+	{
+		semaphore_release(system->work_available);
+	}
+}
+
+static void execute_job(job_system_t* system, job_t* job);
+
+static void submit_job(job_system_t* system, job_t* job)
+{
+	job_worker_t* worker = current_worker(system);
+	if (worker && deque_push(&worker->deque, job))
+	{
+		wake_worker(system);
+	}
+	else if (queue_try_push(system->injected_jobs, job))
+	{
+		wake_worker(system);
+	}
+	else
+	{
+		execute_job(system, job);
+	}
+}
+
+// Held for a few instructions at a time. Counters are zero-initialized by their owners, so this is a
+// plain spin lock rather than a lock_t; it yields the thread if the holder was preempted.
+static void counter_lock(job_counter_t* counter)
+{
+	int spins = 0;
+	while (atomic_load(&counter->lock) != 0 || atomic_compare_and_exchange(&counter->lock, 0, 1) != 0)
+	{
+		if (++spins < k_job_counter_spin_count)
+		{
+			atomic_pause();
+		}
+		else
+		{
+			thread_sleep(0);
+		}
+	}
+}
+
+static void counter_unlock(job_counter_t* counter)
+{
+	atomic_store(&counter->lock, 0);
+}
+
+static void resume_fiber(job_system_t* system, job_fiber_t* fiber)
+{
+	// Every pool fiber fits in the ready queue, so this never blocks.
+	queue_push(system->ready_fibers, fiber);
+	wake_worker(system);
+}
+
+// Resume suspended fibers whose poll condition is now met.
+static void poll_fibers(job_system_t* system)
+{
+	if (atomic_load(&system->polled_count) == 0
+		|| !lock_try_acquire(&system->polled_lock))
+	{
+		return;
+	}
+	for (int i = 0; i < system->polled_count;)
+	{
+		job_fiber_t* fiber = system->polled_fibers[i];
+		if (fiber->poll(fiber->poll_data))
+		{
+			system->polled_fibers[i] = system->polled_fibers[--system->polled_count];
+			resume_fiber(system, fiber);
+		}
+		else
+		{
+			++i;
+		}
+	}
+	lock_release(&system->polled_lock);
+}
+
+static void counter_complete(job_system_t* system, job_counter_t* counter)
+{
+	if (!counter)
+	{
+		return;
+	}
+
+	// Decrements that can't reach zero need no lock.
+	int value = atomic_load(&counter->value);
+	while (value > 1)
+	{
+		int previous = atomic_compare_and_exchange(&counter->value, value, value - 1);
+		if (previous == value)
+		{
+			return;
+		}
+		value = previous;
+	}
+
+	// The last decrement is made under the lock, and job_wait() takes the lock before returning,
+	// so the counter's owner can't let it go out of scope while we still use it.
+	counter_lock(counter);
+	if (atomic_decrement(&counter->value) != 1)
+	{
+		counter_unlock(counter);
+		return;
+	}
+	job_t* waiters = counter->waiters;
+	counter->waiters = NULL;
+	job_fiber_t* fibers = counter->fibers;
+	counter->fibers = NULL;
+	counter_unlock(counter);
+
+	while (waiters)
+	{
+		job_t* next = waiters->next;
+		submit_job(system, waiters);
+		waiters = next;
+	}
+	while (fibers)
+	{
+		job_fiber_t* next = fibers->next;
+		resume_fiber(system, fibers);
+		fibers = next;
+	}
+}
+
+static void execute_job(job_system_t* system, job_t* job)
+{
+	if (job->range_func)
+	{
+		job->range_func(job->data, job->begin, job->end);
+	}
+	else
+	{
+		job->func(job->data);
+	}
+
+	job_counter_t* counter = job->counter;
+	queue_push(system->free_jobs, job);
+	counter_complete(system, counter);
+}
+
+static job_t* allocate_job(job_system_t* system)
+{
+	job_t* job = queue_try_pop(system->free_jobs);
+	while (!job)
+	{
+		// Pool exhausted: make progress on queued work until a job is released.
+		job_t* other = find_job(system, current_worker(system));
+		if (other)
+		{
+			execute_job(system, other);
+		}
+		else
+		{
+			thread_sleep(0);
+		}
+		job = queue_try_pop(system->free_jobs);
+	}
+	memset(job, 0, sizeof(*job));
+	return job;
+}
+
+// Publish the fiber that switched away, now that it is no longer running.
+static void complete_pending(job_worker_t* worker)
+{
+	job_system_t* system = worker->system;
+	job_fiber_t* fiber = worker->pending_fiber;
+	switch (worker->pending)
+	{
+	case k_job_pending_none:
+		break;
+	case k_job_pending_release:
+		queue_push(system->free_fibers, fiber);
+		break;
+	case k_job_pending_wait_counter:
+	{
+		job_counter_t* counter = worker->pending_counter;
+		counter_lock(counter);
+		if (atomic_load(&counter->value) != 0)
+		{
+			fiber->next = counter->fibers;
+			counter->fibers = fiber;
+			fiber = NULL;
+		}
+		counter_unlock(counter);
+		if (fiber)
+		{
+			resume_fiber(system, fiber);
+		}
+		break;
+	}
+	case k_job_pending_wait_poll:
+		lock_acquire(&system->polled_lock);
+		system->polled_fibers[system->polled_count] = fiber;
+		atomic_store(&system->polled_count, system->polled_count + 1);
+		lock_release(&system->polled_lock);
+		wake_worker(system);
+		break;
+	}
+	worker->pending = k_job_pending_none;
+	worker->pending_fiber = NULL;
+	worker->pending_counter = NULL;
+}
+
+// Switch the worker to another fiber, or back to its thread when target is NULL.
+// Returns once the current fiber is resumed, possibly on another worker.
+static void switch_fiber(job_worker_t* worker, job_fiber_t* target, job_pending_t pending, job_counter_t* counter)
+{
+	job_fiber_t* current = worker->current_fiber;
+	worker->pending = pending;
+	worker->pending_fiber = current;
+	worker->pending_counter = counter;
+	worker->current_fiber = target;
+	fiber_switch(current->fiber, target ? target->fiber : worker->thread_fiber);
+	complete_pending(current_worker(current->system));
+}
+
+job_system_t* job_system_create(heap_t* heap, int worker_count)
+{
+	job_system_t* system = heap_alloc(heap, sizeof(job_system_t), 8);
+	system->heap = heap;
+	system->worker_count = worker_count;
+	system->injected_jobs = queue_create(heap, k_job_max_jobs);
+	system->free_jobs = queue_create(heap, k_job_max_jobs);
+	system->job_storage = heap_alloc(heap, sizeof(job_t) * k_job_max_jobs, 8);
+	for (int i = 0; i < k_job_max_jobs; ++i)
+	{
+		queue_push(system->free_jobs, &system->job_storage[i]);
+	}
+	system->free_fibers = queue_create(heap, k_job_max_fibers);
+	system->ready_fibers = queue_create(heap, k_job_max_fibers);
+	system->fiber_storage = heap_alloc(heap, sizeof(job_fiber_t) * k_job_max_fibers, 8);
+	for (int i = 0; i < k_job_max_fibers; ++i)
+	{
+		job_fiber_t* fiber = &system->fiber_storage[i];
+		memset(fiber, 0, sizeof(*fiber));
+		fiber->system = system;
+		fiber->fiber = fiber_create(heap, k_job_fiber_stack_size, fiber_func, fiber);
+		queue_push(system->free_fibers, fiber);
+	}
+	system->polled_count = 0;
+	lock_init(&system->polled_lock, "job_polled_fibers");
+	system->work_available = semaphore_create(0, INT_MAX);
+	system->sleepers = 0;
+	system->quit = 0;
+
+	system->workers = heap_alloc(heap, sizeof(job_worker_t) * worker_count, k_job_cache_line);
+	for (int i = 0; i < worker_count; ++i)
+	{
+		job_worker_t* worker = &system->workers[i];
+		memset(worker, 0, sizeof(*worker));
+		worker->system = system;
+		worker->index = i;
+		worker->deque.jobs = heap_alloc(heap, sizeof(job_t*) * k_job_max_jobs, 8);
+	}
+	for (int i = 0; i < worker_count; ++i)
+	{
+		system->workers[i].thread = thread_create(worker_thread_func, &system->workers[i]);
+
+		char name[32];
+		snprintf(name, sizeof(name), "job_worker_%d", i);
+		thread_set_name(system->workers[i].thread, name);
+	}
+	return system;
+}
+
+void job_system_destroy(job_system_t* system)
+{
+	atomic_store(&system->quit, 1);
+	for (int i = 0; i < system->worker_count; ++i)
+	{
+		semaphore_release(system->work_available);
+	}
+	for (int i = 0; i < system->worker_count; ++i)
+	{
+		thread_destroy(system->workers[i].thread);
+		heap_free(system->heap, system->workers[i].deque.jobs);
+	}
+	heap_free(system->heap, system->workers);
+	for (int i = 0; i < k_job_max_fibers; ++i)
+	{
+		fiber_destroy(system->fiber_storage[i].fiber);
+	}
+	heap_free(system->heap, system->fiber_storage);
+	queue_destroy(system->ready_fibers);
+	queue_destroy(system->free_fibers);
+	semaphore_destroy(system->work_available);
+	queue_destroy(system->free_jobs);
+	queue_destroy(system->injected_jobs);
+	lock_destroy(&system->polled_lock);
+	heap_free(system->heap, system->job_storage);
+	heap_free(system->heap, system);
+}
+
+void job_system_set_placement(job_system_t* system, const cpu_placement_t* placement)
+{
+	for (int i = 0; i < system->worker_count; ++i)
+	{
+		uint64_t mask = i < placement->worker_count ? placement->worker_masks[i] : 0;
+		thread_set_affinity(system->workers[i].thread, mask);
+	}
+}
+
+int job_system_get_worker_count(job_system_t* system)
+{
+	return system->worker_count;
+}
+
+void job_run(job_system_t* system, job_func_t func, void* data, job_counter_t* counter)
+{
+	job_run_after(system, NULL, func, data, counter);
+}
+
+void job_run_after(job_system_t* system, job_counter_t* depends_on, job_func_t func, void* data, job_counter_t* counter)
+{
+	job_t* job = allocate_job(system);
+	job->func = func;
+	job->data = data;
+	job->counter = counter;
+	if (counter)
+	{
+		atomic_increment(&counter->value);
+	}
+
+	if (depends_on)
+	{
+		// Checked under the lock, so either the completing job sees us in the list or we see zero.
+		counter_lock(depends_on);
+		if (atomic_load(&depends_on->value) != 0)
+		{
+			job->next = depends_on->waiters;
+			depends_on->waiters = job;
+			counter_unlock(depends_on);
+			return;
+		}
+		counter_unlock(depends_on);
+	}
+
+	submit_job(system, job);
+}
+
+// Run one queued job on the calling thread, or yield if there is none.
+static void help_once(job_system_t* system, job_worker_t* worker)
+{
+	poll_fibers(system);
+	job_t* job = find_job(system, worker);
+	if (job)
+	{
+		execute_job(system, job);
+	}
+	else
+	{
+		thread_sleep(0);
+	}
+}
+
+void job_counter_increment(job_counter_t* counter)
+{
+	atomic_increment(&counter->value);
+}
+
+void job_counter_decrement(job_system_t* system, job_counter_t* counter)
+{
+	counter_complete(system, counter);
+}
+
+void job_wait(job_system_t* system, job_counter_t* counter)
+{
+	job_worker_t* worker = current_worker(system);
+	while (atomic_load(&counter->value) != 0)
+	{
+		job_fiber_t* next = worker ? queue_try_pop(system->free_fibers) : NULL;
+		if (next)
+		{
+			switch_fiber(worker, next, k_job_pending_wait_counter, counter);
+			worker = current_worker(system);
+		}
+		else
+		{
+			// Not a worker, or out of fibers: wait by running jobs on this stack.
+			help_once(system, worker);
+		}
+	}
+
+	// Zero may be seen before the job that reached it has released the lock. Wait for it to.
+	counter_lock(counter);
+	counter_unlock(counter);
+}
+
+void job_wait_until(job_system_t* system, job_poll_func_t poll, void* data)
+{
+	job_worker_t* worker = current_worker(system);
+	while (!poll(data))
+	{
+		job_fiber_t* next = worker ? queue_try_pop(system->free_fibers) : NULL;
+		if (next)
+		{
+			worker->current_fiber->poll = poll;
+			worker->current_fiber->poll_data = data;
+			switch_fiber(worker, next, k_job_pending_wait_poll, NULL);
+			worker = current_worker(system);
+		}
+		else
+		{
+			help_once(system, worker);
+		}
+	}
+}
+
+void job_parallel_for(job_system_t* system, int count, int batch_size, job_range_func_t func, void* data)
+{
+	if (batch_size <= 0)
+	{
+		batch_size = 1;
+	}
+
+	job_counter_t counter = { 0 };
+	for (int begin = 0; begin < count; begin += batch_size)
+	{
+		job_t* job = allocate_job(system);
+		job->range_func = func;
+		job->data = data;
+		job->begin = begin;
+		job->end = count - begin < batch_size ? count : begin + batch_size;
+		job->counter = &counter;
+		atomic_increment(&counter.value);
+		submit_job(system, job);
+	}
+	job_wait(system, &counter);
+}
+
+// Scheduling loop run by every pool fiber. Never returns; at shutdown it switches back to the worker's thread.
+static void fiber_func(void* data)
+{
+	job_fiber_t* self = data;
+	job_system_t* system = self->system;
+	complete_pending(current_worker(system));
+
+	while (true)
+	{
+		job_worker_t* worker = current_worker(system);
+		if (atomic_load(&system->quit))
+		{
+			switch_fiber(worker, NULL, k_job_pending_release, NULL);
+			continue;
+		}
+
+		// Suspended jobs go first: they are older than anything still queued.
+		job_fiber_t* ready = queue_try_pop(system->ready_fibers);
+		if (ready)
+		{
+			switch_fiber(worker, ready, k_job_pending_release, NULL);
+			continue;
+		}
+
+		job_t* job = NULL;
+		for (int i = 0; i < k_job_spin_count && !job; ++i)
+		{
+			poll_fibers(system);
+			job = find_job(system, worker);
+		}
+		if (job)
+		{
+			execute_job(system, job);
+			continue;
+		}
+
+		// Polled fibers have no one to wake us, so check on them periodically instead of sleeping.
+		// A millisecond apart, so a long wait doesn't keep every idle core busy.
+		if (atomic_load(&system->polled_count) > 0)
+		{
+			thread_sleep(1);
+			continue;
+		}
+
+		// Announce sleep before the final look, so a submitter either sees us or we see its work.
+		atomic_increment(&system->sleepers);
+		ready = queue_try_pop(system->ready_fibers);
+		if (ready)
+		{
+			atomic_decrement(&system->sleepers);
+			switch_fiber(worker, ready, k_job_pending_release, NULL);
+			continue;
+		}
+		job = find_job(system, worker);
+		if (job)
+		{
+			atomic_decrement(&system->sleepers);
+			execute_job(system, job);
+			continue;
+		}
+		if (!atomic_load(&system->quit) && atomic_load(&system->polled_count) == 0)
+		{
+			semaphore_acquire(system->work_available);
+		}
+		atomic_decrement(&system->sleepers);
+	}
+}
+
+static int worker_thread_func(void* user)
+{
+	job_worker_t* worker = user;
+	job_system_t* system = worker->system;
+	s_worker = worker;
+
+	// There are more fibers than workers, so one is always free at startup.
+	worker->thread_fiber = fiber_convert_thread(system->heap);
+	job_fiber_t* first = queue_pop(system->free_fibers);
+	worker->pending = k_job_pending_none;
+	worker->current_fiber = first;
+	fiber_switch(worker->thread_fiber, first->fiber);
+
+	// Back from the fiber that saw the quit flag.
+	complete_pending(worker);
+	fiber_convert_back(worker->thread_fiber);
+	s_worker = NULL;
+	return 0;
+}
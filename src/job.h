@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Work-stealing job system
+// A pool of worker threads, each with its own deque of jobs.
+// Idle workers steal from the others. Completion is tracked with counters,
+// and jobs can be held back until another counter reaches zero.
+// Jobs run on fibers: a job that waits is suspended and its worker runs other jobs meanwhile.
+
+typedef struct cpu_placement_t cpu_placement_t;
+typedef struct heap_t heap_t;
+
+// Handle to a job system.
+typedef struct job_system_t job_system_t;
+
+typedef struct job_t job_t;
+typedef struct job_fiber_t job_fiber_t;
+
+// Tracks completion of a group of jobs.
+// Zero-initialize before first use. The value is the number of unfinished jobs.
+typedef struct job_counter_t
+{
+	int value;
+	int lock;
+	job_t* waiters;
+	job_fiber_t* fibers;
+} job_counter_t;
+
+// Function run by a job.
+typedef void (*job_func_t)(void* data);
+
+// Returns true once the condition passed to job_wait_until() is met.
+typedef bool (*job_poll_func_t)(void* data);
+
+// Function run by each batch of job_parallel_for(), over items [begin, end).
+typedef void (*job_range_func_t)(void* data, int begin, int end);
+
+// Create a job system with the given number of worker threads.
+// Threads that are not workers may still submit and help while waiting.
+job_system_t* job_system_create(heap_t* heap, int worker_count);
+
+// Wait for the workers to finish their current jobs and destroy the system.
+// Queued jobs that have not started are dropped.
+void job_system_destroy(job_system_t* system);
+
+// Pin each worker thread to the matching worker processors of a placement.
+// Workers beyond the placement's worker count are left unrestricted.
+void job_system_set_placement(job_system_t* system, const cpu_placement_t* placement);
+
+// Get the number of worker threads.
+int job_system_get_worker_count(job_system_t* system);
+
+// Queue a job.
+// If counter is not NULL, it is incremented now and decremented when the job finishes.
+void job_run(job_system_t* system, job_func_t func, void* data, job_counter_t* counter);
+
+// Queue a job that may not start until depends_on reaches zero.
+// If counter is not NULL, it is incremented now and decremented when the job finishes.
+void job_run_after(job_system_t* system, job_counter_t* depends_on, job_func_t func, void* data, job_counter_t* counter);
+
+// Add one to a counter for work tracked outside the job system, e.g. I/O or a future.
+// Pair with job_counter_decrement() when the work completes.
+void job_counter_increment(job_counter_t* counter);
+
+// Take one from a counter, from any thread. At zero, its waiting jobs and fibers are released.
+void job_counter_decrement(job_system_t* system, job_counter_t* counter);
+
+// Block until counter reaches zero.
+// Inside a job, the job's fiber is suspended and the worker picks up other jobs.
+// Other threads run queued jobs while they wait.
+void job_wait(job_system_t* system, job_counter_t* counter);
+
+// Block until poll returns true, for conditions nothing signals when they are met.
+// Suspended fibers are polled by idle workers, which check every millisecond rather than sleep while any are waiting;
+// other threads poll in between queued jobs. If the condition's owner can signal it, wait on a counter instead.
+void job_wait_until(job_system_t* system, job_poll_func_t poll, void* data);
+
+// Run func over [0, count) split into batches of batch_size items, and wait for all of them.
+void job_parallel_for(job_system_t* system, int count, int batch_size, job_range_func_t func, void* data);
@@ -0,0 +1,117 @@
+#include "job_bench.h"
+
+#include "debug.h"
+#include "heap.h"
+#include "job.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <math.h>
+
+enum
+{
+	k_bench_parallel_items = 1 << 20,
+	k_bench_parallel_batch = 4096,
+	k_bench_empty_jobs = 100000,
+	k_bench_repetitions = 5,
+};
+
+typedef struct parallel_data_t
+{
+	float* values;
+} parallel_data_t;
+
+static void parallel_func(void* data, int begin, int end)
+{
+	parallel_data_t* parallel = data;
+	for (int i = begin; i < end; ++i)
+	{
+		float v = parallel->values[i];
+		for (int k = 0; k < 16; ++k)
+		{
+			v = sqrtf(v * v + 1.0f) * 0.5f;
+		}
+		parallel->values[i] = v;
+	}
+}
+
+static void empty_func(void* data)
+{
+}
+
+static double ticks_to_ms(uint64_t ticks)
+{
+	return (double)ticks * 1000.0 / (double)timer_get_ticks_per_second();
+}
+
+static void bench_report(const char* test, int threads, int items, uint64_t ticks, uint64_t baseline_ticks)
+{
+	double ms = ticks_to_ms(ticks);
+	double speedup = ticks ? (double)baseline_ticks / (double)ticks : 0.0;
+	debug_print(k_print_info, "job_bench test=%s threads=%d items=%d ms=%.3f ns_per_item=%.2f speedup=%.2f\n",
+		test, threads, items, ms, ms * 1000000.0 / items, speedup);
+}
+
+static uint64_t bench_parallel_for(job_system_t* system, parallel_data_t* data)
+{
+	uint64_t best = UINT64_MAX;
+	for (int r = 0; r < k_bench_repetitions; ++r)
+	{
+		uint64_t t0 = timer_get_ticks();
+		job_parallel_for(system, k_bench_parallel_items, k_bench_parallel_batch, parallel_func, data);
+		uint64_t t1 = timer_get_ticks();
+		best = __min(best, t1 - t0);
+	}
+	return best;
+}
+
+static uint64_t bench_empty_jobs(job_system_t* system)
+{
+	uint64_t best = UINT64_MAX;
+	for (int r = 0; r < k_bench_repetitions; ++r)
+	{
+		job_counter_t counter = { 0 };
+		uint64_t t0 = timer_get_ticks();
+		for (int i = 0; i < k_bench_empty_jobs; ++i)
+		{
+			job_run(system, empty_func, NULL, &counter);
+		}
+		job_wait(system, &counter);
+		uint64_t t1 = timer_get_ticks();
+		best = __min(best, t1 - t0);
+	}
+	return best;
+}
+
+void job_bench_run(heap_t* heap)
+{
+	parallel_data_t data;
+	data.values = heap_alloc(heap, sizeof(float) * k_bench_parallel_items, 64);
+	for (int i = 0; i < k_bench_parallel_items; ++i)
+	{
+		data.values[i] = (float)i;
+	}
+
+	uint64_t parallel_baseline = 0;
+	uint64_t empty_baseline = 0;
+	int max_threads = thread_get_processor_count();
+	for (int threads = 1; threads <= max_threads; ++threads)
+	{
+		// The calling thread also runs jobs while it waits.
+		job_system_t* system = job_system_create(heap, threads - 1);
+
+		uint64_t parallel_ticks = bench_parallel_for(system, &data);
+		uint64_t empty_ticks = bench_empty_jobs(system);
+		if (threads == 1)
+		{
+			parallel_baseline = parallel_ticks;
+			empty_baseline = empty_ticks;
+		}
+		bench_report("parallel_for", threads, k_bench_parallel_items, parallel_ticks, parallel_baseline);
+		bench_report("empty_jobs", threads, k_bench_empty_jobs, empty_ticks, empty_baseline);
+
+		job_system_destroy(system);
+	}
+
+	heap_free(heap, data.values);
+}
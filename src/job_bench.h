@@ -0,0 +1,12 @@
+#pragma once
+
+// Job system benchmark
+// Measures how job throughput and a parallel_for workload scale with thread count.
+
+typedef struct heap_t heap_t;
+
+// Run the job system benchmarks from one thread up to the processor count.
+// Each result is printed as a single line:
+//   job_bench test=<name> threads=<n> items=<n> ms=<f> ns_per_item=<f> speedup=<f>
+// Thread count includes the calling thread, which helps while it waits.
+void job_bench_run(heap_t* heap);
@@ -0,0 +1,198 @@
+#include "lock.h"
+
+#include "atomic.h"
+#include "futex.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <string.h>
+
+enum
+{
+	k_lock_free = 0,
+	k_lock_held = 1,
+	k_lock_held_with_sleepers = 2,
+
+	k_lock_spin_rounds = 10,
+	k_lock_max_backoff = 64,
+};
+
+// Profiling is process-wide, so every lock is registered in one list.
+// These are the only module-level variables; a zero-initialized lock_t is a valid, free lock.
+static lock_t s_registry_lock;
+static lock_t* s_registry = NULL;
+static int s_profiling = 0;
+
+static bool is_profiling()
+{
+	return atomic_load_explicit(&s_profiling, k_atomic_relaxed) != 0;
+}
+
+// Record an acquisition. Called with the lock held, so the statistics need no atomics.
+static void record_acquire(lock_t* lock, uint64_t wait_start)
+{
+	uint64_t now = timer_get_ticks();
+	lock->stats.acquisitions++;
+	if (wait_start)
+	{
+		uint64_t wait = now - wait_start;
+		lock->stats.contentions++;
+		lock->stats.wait_ticks += wait;
+		lock->stats.max_wait_ticks = __max(lock->stats.max_wait_ticks, wait);
+	}
+	lock->acquired_ticks = now;
+}
+
+void lock_init(lock_t* lock, const char* name)
+{
+	memset(lock, 0, sizeof(*lock));
+	lock->name = name;
+
+	if (lock != &s_registry_lock)
+	{
+		lock_acquire(&s_registry_lock);
+		lock->next = s_registry;
+		s_registry = lock;
+		lock_release(&s_registry_lock);
+	}
+}
+
+void lock_destroy(lock_t* lock)
+{
+	lock_acquire(&s_registry_lock);
+	for (lock_t** link = &s_registry; *link; link = &(*link)->next)
+	{
+		if (*link == lock)
+		{
+			*link = lock->next;
+			break;
+		}
+	}
+	lock_release(&s_registry_lock);
+}
+
+void lock_acquire(lock_t* lock)
+{
+	if (atomic_compare_and_exchange_explicit(&lock->state, k_lock_free, k_lock_held, k_atomic_acquire) == k_lock_free)
+	{
+		if (is_profiling())
+		{
+			record_acquire(lock, 0);
+		}
+		return;
+	}
+
+	// Timer ticks since startup; nonzero marks the acquisition as contended.
+	uint64_t wait_start = is_profiling() ? __max(timer_get_ticks(), 1) : 0;
+
+	// Spin with exponential backoff, in case the holder is about to release.
+	int backoff = 1;
+	for (int round = 0; round < k_lock_spin_rounds; ++round)
+	{
+		for (int i = 0; i < backoff; ++i)
+		{
+			atomic_pause();
+		}
+		if (atomic_load_explicit(&lock->state, k_atomic_relaxed) == k_lock_free
+			&& atomic_compare_and_exchange_explicit(&lock->state, k_lock_free, k_lock_held, k_atomic_acquire) == k_lock_free)
+		{
+			if (wait_start)
+			{
+				record_acquire(lock, wait_start);
+			}
+			return;
+		}
+		backoff = __min(backoff * 2, k_lock_max_backoff);
+	}
+
+	// Park. Taking the lock as held-with-sleepers is conservative: the release may wake no one.
+	while (atomic_exchange_explicit(&lock->state, k_lock_held_with_sleepers, k_atomic_acquire) != k_lock_free)
+	{
+		futex_wait(&lock->state, k_lock_held_with_sleepers);
+	}
+	if (wait_start)
+	{
+		record_acquire(lock, wait_start);
+	}
+}
+
+bool lock_try_acquire(lock_t* lock)
+{
+	if (atomic_compare_and_exchange_explicit(&lock->state, k_lock_free, k_lock_held, k_atomic_acquire) != k_lock_free)
+	{
+		return false;
+	}
+	if (is_profiling())
+	{
+		record_acquire(lock, 0);
+	}
+	return true;
+}
+
+void lock_release(lock_t* lock)
+{
+	if (lock->acquired_ticks)
+	{
+		uint64_t hold = timer_get_ticks() - lock->acquired_ticks;
+		lock->stats.hold_ticks += hold;
+		lock->stats.max_hold_ticks = __max(lock->stats.max_hold_ticks, hold);
+		lock->acquired_ticks = 0;
+	}
+
+	if (atomic_fetch_add_explicit(&lock->state, -1, k_atomic_release) != k_lock_held)
+	{
+		atomic_store_explicit(&lock->state, k_lock_free, k_atomic_release);
+		futex_wake(&lock->state, 1);
+	}
+}
+
+void lock_profile_start()
+{
+	lock_acquire(&s_registry_lock);
+	for (lock_t* lock = s_registry; lock; lock = lock->next)
+	{
+		lock_acquire(lock);
+		memset(&lock->stats, 0, sizeof(lock->stats));
+		lock_release(lock);
+	}
+	atomic_store(&s_profiling, 1);
+	lock_release(&s_registry_lock);
+}
+
+void lock_profile_stop()
+{
+	atomic_store(&s_profiling, 0);
+}
+
+void lock_profile_report(trace_t* trace)
+{
+	static const char* k_keys[] =
+	{
+		"acquisitions",
+		"contentions",
+		"wait_us",
+		"max_wait_us",
+		"hold_us",
+		"max_hold_us",
+	};
+
+	lock_acquire(&s_registry_lock);
+	for (lock_t* lock = s_registry; lock; lock = lock->next)
+	{
+		lock_acquire(lock);
+		lock_stats_t stats = lock->stats;
+		lock_release(lock);
+
+		int64_t values[_countof(k_keys)] =
+		{
+			stats.acquisitions,
+			stats.contentions,
+			(int64_t)timer_ticks_to_us(stats.wait_ticks),
+			(int64_t)timer_ticks_to_us(stats.max_wait_ticks),
+			(int64_t)timer_ticks_to_us(stats.hold_ticks),
+			(int64_t)timer_ticks_to_us(stats.max_hold_ticks),
+		};
+		trace_counter(trace, lock->name ? lock->name : "lock", k_keys, values, _countof(k_keys));
+	}
+	lock_release(&s_registry_lock);
+}
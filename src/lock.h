@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Adaptive lock for short critical sections
+// A non-recursive lock that spins with exponential backoff before parking the thread.
+// Uncontended acquire and release are a single atomic operation each.
+// While profiling is on, each lock records its wait time, hold time and contention,
+// and lock_profile_report() writes the totals to a trace.
+
+typedef struct trace_t trace_t;
+
+// Contention statistics for one lock. Times are in timer ticks.
+typedef struct lock_stats_t
+{
+	int64_t acquisitions;
+	int64_t contentions;
+	uint64_t wait_ticks;
+	uint64_t max_wait_ticks;
+	uint64_t hold_ticks;
+	uint64_t max_hold_ticks;
+} lock_stats_t;
+
+// Embed in the owning object and call lock_init() before use.
+typedef struct lock_t
+{
+	int state;
+	const char* name;
+	lock_stats_t stats;
+	uint64_t acquired_ticks;
+	struct lock_t* next;
+} lock_t;
+
+// Initialize a lock. The name is used for profiling and must outlive the lock.
+void lock_init(lock_t* lock, const char* name);
+
+// Destroy a lock. It must not be held.
+void lock_destroy(lock_t* lock);
+
+// Acquire the lock, spinning briefly and then sleeping until it is free.
+// The lock is not recursive: a thread must not acquire a lock it already holds.
+void lock_acquire(lock_t* lock);
+
+// Attempt to acquire the lock without waiting.
+// Returns true if the lock was acquired.
+bool lock_try_acquire(lock_t* lock);
+
+// Release a lock held by the calling thread.
+void lock_release(lock_t* lock);
+
+// Start recording contention statistics on all locks, clearing previous ones.
+void lock_profile_start();
+
+// Stop recording contention statistics.
+void lock_profile_stop();
+
+// Write the statistics of every initialized lock to a trace as counter events.
+// The trace must be capturing.
+void lock_profile_report(trace_t* trace);
@@ -1,10 +1,19 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 
+#include "cpu_topology.h"
 #include "debug.h"
+#include "ecs_bench.h"
 #include "fs.h"
+#include "fs_bench.h"
 #include "heap.h"
+#include "job_bench.h"
+#include "pack.h"
 #include "render.h"
+#include "sync_bench.h"
+#include "thread.h"
 #include "frogger_game.h"
 #include "timer.h"
 #include "wm.h"
@@ -86,13 +95,71 @@ int main(int argc, const char* argv[])
     timer_startup();
 
     heap_t* heap = heap_create(2 * 1024 * 1024);
+
+    // Headless benchmark modes run before any window, device or audio is created.
+    if (argc > 1 && strcmp(argv[1], "--bench-ecs") == 0)
+    {
+        ecs_bench_run(heap);
+        heap_destroy(heap);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-jobs") == 0)
+    {
+        job_bench_run(heap);
+        heap_destroy(heap);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-sync") == 0)
+    {
+        sync_bench_run(heap);
+        heap_destroy(heap);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-fs") == 0)
+    {
+        fs_bench_run(heap);
+        heap_destroy(heap);
+        return 0;
+    }
+
+    // Offline asset packing: --pack <source directory> <destination directory> [level]
+    if (argc > 3 && strcmp(argv[1], "--pack") == 0)
+    {
+        int level = argc > 4 ? atoi(argv[4]) : k_fs_compression_hc_max;
+        int packed = pack_directory(heap, argv[2], argv[3], level);
+        heap_destroy(heap);
+        return packed < 0 ? 1 : 0;
+    }
+
+    // Offline archive packing: --pack-archive <source directory> <archive> [level]
+    if (argc > 3 && strcmp(argv[1], "--pack-archive") == 0)
+    {
+        int level = argc > 4 ? atoi(argv[4]) : k_fs_compression_hc_max;
+        int packed = pack_archive(heap, argv[2], argv[3], level);
+        heap_destroy(heap);
+        return packed < 0 ? 1 : 0;
+    }
+
     fs_t* fs = fs_create(heap, 8);
     wm_window_t* window = wm_create(heap);
     render_t* render = render_create(heap, window);
+
+    // Give the game and render threads their own cores, away from the I/O threads.
+    cpu_topology_t topology;
+    cpu_topology_query(heap, &topology);
+    cpu_placement_t placement;
+    cpu_placement_default(&topology, &placement);
+    thread_set_current_name("main");
+    thread_set_current_affinity(placement.main_mask);
+    fs_set_placement(fs, &placement);
+    render_set_placement(render, &placement);
+
     imgui_info_t* imgui_info = SetUpImgui(heap);
 
     frogger_game_t* game = frogger_game_create(heap, fs, window, render, 2);
     engine_info_t* engine_info = heap_alloc(heap, sizeof(engine_info_t), 8);
+    memset(engine_info, 0, sizeof(*engine_info));
+    dataTransfer(imgui_info, engine_info);
 
     if (SDL_Init(SDL_INIT_AUDIO) < 0)
     {
@@ -1,5 +1,7 @@
 #include "mutex.h"
 
+#if defined(_WIN32)
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -22,3 +24,70 @@ void mutex_unlock(mutex_t* mutex)
 {
 	ReleaseMutex(mutex);
 }
+
+#else
+
+#include "atomic.h"
+#include "futex.h"
+
+#include <stdlib.h>
+
+// Futex mutex after Ulrich Drepper's "Futexes Are Tricky", made recursive with an owner and count.
+// State is 0 when unlocked, 1 when locked and 2 when locked with possible sleepers,
+// so an uncontended lock and unlock are one atomic operation each.
+typedef struct mutex_t
+{
+	int state;
+	int count;
+	void* owner;
+} mutex_t;
+
+// Each thread's copy has a distinct address, which serves as its owner id.
+static _Thread_local char s_thread_tag;
+
+mutex_t* mutex_create()
+{
+	// The heap locks a mutex, so this can't come from a heap.
+	return calloc(1, sizeof(mutex_t));
+}
+
+void mutex_destroy(mutex_t* mutex)
+{
+	free(mutex);
+}
+
+void mutex_lock(mutex_t* mutex)
+{
+	void* self = &s_thread_tag;
+	if (atomic_load_ptr_explicit(&mutex->owner, k_atomic_relaxed) == self)
+	{
+		++mutex->count;
+		return;
+	}
+
+	if (atomic_compare_and_exchange_explicit(&mutex->state, 0, 1, k_atomic_acquire) != 0)
+	{
+		while (atomic_exchange_explicit(&mutex->state, 2, k_atomic_acquire) != 0)
+		{
+			futex_wait(&mutex->state, 2);
+		}
+	}
+	atomic_store_ptr_explicit(&mutex->owner, self, k_atomic_relaxed);
+	mutex->count = 1;
+}
+
+void mutex_unlock(mutex_t* mutex)
+{
+	if (--mutex->count > 0)
+	{
+		return;
+	}
+	atomic_store_ptr_explicit(&mutex->owner, NULL, k_atomic_relaxed);
+	if (atomic_fetch_add_explicit(&mutex->state, -1, k_atomic_release) != 1)
+	{
+		atomic_store_explicit(&mutex->state, 0, k_atomic_release);
+		futex_wake(&mutex->state, 1);
+	}
+}
+
+#endif
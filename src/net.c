@@ -1,11 +1,15 @@
 #include "net.h"
 
+#include "atomic.h"
+#include "cpu_topology.h"
 #include "debug.h"
+#include "future.h"
 #include "heap.h"
-#include "mutex.h"
 #include "queue.h"
+#include "rwlock.h"
 #include "thread.h"
 #include "timer.h"
+#include "timer_wheel.h"
 
 #include <stdbool.h>
 
@@ -22,6 +26,7 @@ enum
 	k_max_entity_types = 32,
 	k_max_snapshots = 256,
 	k_max_entities = 32,
+	k_max_timers = 64,
 };
 
 typedef struct entity_type_t
@@ -81,6 +86,11 @@ typedef struct connection_t
 	queue_t* recv_queue;
 
 	uint32_t last_recv_ms;
+	timer_wheel_ref_t timeout_timer;
+
+	// Completed with zero on the first packet from the peer, or an error if it times out first.
+	future_t* established;
+	int established_completed;
 
 	entity_data_t entities[k_max_entities];
 } connection_t;
@@ -94,19 +104,28 @@ typedef struct net_t
 
 	SOCKET sock;
 	thread_t* recv_thread;
+	uint64_t thread_mask;
 
-	mutex_t* connections_mutex;
+	rwlock_t connections_lock;
 	connection_t connections[3];
 
+	timer_wheel_t* timers;
+
 	entity_type_t entity_types[k_max_entity_types];
 	entity_data_t entities[k_max_entities];
+	int entity_count;
+	int despawn_observer;
 	snapshot_t snapshots[k_max_snapshots];
 } net_t;
 
 static int recv_thread_func(void* user);
 static connection_t* find_or_create_connection(net_t* net, const net_address_t* address);
 
-static void timeout_old_connections(net_t* net);
+static void entities_despawned(ecs_t* ecs, ecs_event_t event, const ecs_entity_ref_t* entities, int count, void* user);
+static void connection_timed_out(void* data);
+static void disconnect(connection_t* connection);
+static future_t* claim_established(connection_t* connection);
+static void complete_established(future_t* established, int result);
 static void snapshot_entities(net_t* net);
 static void packet_send(connection_t* connection);
 static void packet_recv(connection_t* connection);
@@ -117,12 +136,14 @@ net_t* net_create(heap_t* heap, ecs_t* ecs)
 	memset(net, 0, sizeof(net_t));
 	net->heap = heap;
 	net->ecs = ecs;
+	net->despawn_observer = ecs_observer_add(ecs, k_ecs_event_despawn, 0, entities_despawned, net);
 
 	WSADATA data;
 	WSAStartup(MAKEWORD(2, 2), &data);
 
 	net->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	net->connections_mutex = mutex_create();
+	rwlock_init(&net->connections_lock);
+	net->timers = timer_wheel_create(heap, k_max_timers, NULL);
 
 	struct sockaddr_in address;
 	address.sin_family = AF_INET;
@@ -135,6 +156,7 @@ net_t* net_create(heap_t* heap, ecs_t* ecs)
 	debug_print(k_print_info, "Net bound port %d\n", ntohs(address.sin_port));
 
 	net->recv_thread = thread_create(recv_thread_func, net);
+	thread_set_name(net->recv_thread, "net_recv");
 
 	return net;
 }
@@ -142,17 +164,37 @@ net_t* net_create(heap_t* heap, ecs_t* ecs)
 void net_destroy(net_t* net)
 {
 	net_disconnect_all(net);
+	ecs_observer_remove(net->ecs, net->despawn_observer);
 	closesocket(net->sock);
 	thread_destroy(net->recv_thread);
+	timer_wheel_destroy(net->timers);
 	WSACleanup();
-	mutex_destroy(net->connections_mutex);
 	heap_free(net->heap, net);
 }
 
+void net_set_placement(net_t* net, const cpu_placement_t* placement)
+{
+	rwlock_write_acquire(&net->connections_lock);
+	net->thread_mask = placement->io_mask;
+	thread_set_affinity(net->recv_thread, net->thread_mask);
+	for (int i = 0; i < _countof(net->connections); ++i)
+	{
+		connection_t* c = &net->connections[i];
+		if (c->address.port)
+		{
+			thread_set_affinity(c->send_thread, net->thread_mask);
+		}
+	}
+	rwlock_write_release(&net->connections_lock);
+}
+
 void net_update(net_t* net)
 {
-	timeout_old_connections(net);
+	timer_wheel_update(net->timers);
 	snapshot_entities(net);
+
+	// Read access is enough: the receive thread only needs to write when a new peer appears.
+	rwlock_read_acquire(&net->connections_lock);
 	for (int i = 0; i < _countof(net->connections); ++i)
 	{
 		connection_t* c = &net->connections[i];
@@ -162,32 +204,39 @@ void net_update(net_t* net)
 			packet_recv(c);
 		}
 	}
+	rwlock_read_release(&net->connections_lock);
 	net->sequence++;
 }
 
-void net_connect(net_t* net, const net_address_t* address)
+future_t* net_connect(net_t* net, const net_address_t* address)
 {
-	find_or_create_connection(net, address);
+	connection_t* connection = find_or_create_connection(net, address);
+	if (!connection)
+	{
+		future_t* failed = future_create(net->heap);
+		future_complete(failed, -1);
+		return failed;
+	}
+	future_t* established = connection->established;
+	future_retain(established);
+	rwlock_read_release(&net->connections_lock);
+	return established;
 }
 
 void net_disconnect_all(net_t* net)
 {
-	mutex_lock(net->connections_mutex);
+	rwlock_write_acquire(&net->connections_lock);
 
 	for (int i = 0; i < _countof(net->connections); ++i)
 	{
 		connection_t* c = &net->connections[i];
 		if (c->address.port)
 		{
-			queue_push(c->send_queue, NULL);
-			thread_destroy(c->send_thread);
-			queue_destroy(c->send_queue);
-			queue_destroy(c->recv_queue);
+			disconnect(c);
 		}
 	}
-	memset(net->connections, 0, sizeof(net->connections));
 
-	mutex_unlock(net->connections_mutex);
+	rwlock_write_release(&net->connections_lock);
 }
 
 void net_state_register_entity_type(net_t* net, int type, uint64_t component_mask, uint64_t replicated_component_mask, net_configure_entity_callback_t configure_callback, void* configure_callback_data)
@@ -215,14 +264,12 @@ void net_state_register_entity_type(net_t* net, int type, uint64_t component_mas
 
 void net_state_register_entity_instance(net_t* net, int type, ecs_entity_ref_t entity)
 {
-	for (int i = 0; i < _countof(net->entities); ++i)
+	if (net->entity_count < _countof(net->entities))
 	{
-		if (!ecs_is_entity_ref_valid(net->ecs, net->entities[i].ref, true))
-		{
-			net->entities[i].ref = entity;
-			net->entities[i].type = type;
-			return;
-		}
+		net->entities[net->entity_count].ref = entity;
+		net->entities[net->entity_count].type = type;
+		net->entity_count++;
+		return;
 	}
 	debug_print(k_print_warning, "Out of space to register entity!\n");
 }
@@ -304,46 +351,73 @@ static int send_thread_func(void* user)
 	return 0;
 }
 
-static connection_t* find_or_create_connection(net_t* net, const net_address_t* address)
+static connection_t* find_connection(net_t* net, const net_address_t* address)
 {
-	connection_t* result = NULL;
-
-	mutex_lock(net->connections_mutex);
-
 	for (int i = 0; i < _countof(net->connections); ++i)
 	{
 		connection_t* c = &net->connections[i];
 		if (memcmp(&c->address, address, sizeof(net_address_t)) == 0)
 		{
-			result = c;
-			break;
+			return c;
 		}
 	}
-	if (!result)
+	return NULL;
+}
+
+// Add a connection to an address unless there is one already.
+// Returns false if every connection is taken.
+static bool create_connection(net_t* net, const net_address_t* address)
+{
+	rwlock_write_acquire(&net->connections_lock);
+
+	// Look again: the peer may have been added while the lock was released.
+	bool exists = find_connection(net, address) != NULL;
+	for (int i = 0; !exists && i < _countof(net->connections); ++i)
 	{
-		for (int i = 0; i < _countof(net->connections); ++i)
+		connection_t* c = &net->connections[i];
+		if (c->address.port == 0)
 		{
-			connection_t* c = &net->connections[i];
-			if (c->address.port == 0)
-			{
-				memcpy(&c->address, address, sizeof(*address));
-				c->net = net;
-				c->incoming_sequence = -1;
-				c->ack_sequence = -1;
-				c->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
-				c->send_queue = queue_create(net->heap, 3);
-				c->recv_queue = queue_create(net->heap, 3);
-				c->send_thread = thread_create(send_thread_func, c);
-
-				result = c;
-				break;
-			}
+			memcpy(&c->address, address, sizeof(*address));
+			c->net = net;
+			c->incoming_sequence = -1;
+			c->ack_sequence = -1;
+			c->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
+			c->send_queue = queue_create(net->heap, 3);
+			c->recv_queue = queue_create(net->heap, 3);
+			c->send_thread = thread_create(send_thread_func, c);
+			thread_set_name(c->send_thread, "net_send");
+			thread_set_affinity(c->send_thread, net->thread_mask);
+			c->timeout_timer = timer_wheel_schedule(net->timers, k_timeout_ms, 0, connection_timed_out, c);
+			c->established = future_create(net->heap);
+			c->established_completed = 0;
+			exists = true;
 		}
 	}
 
-	mutex_unlock(net->connections_mutex);
+	rwlock_write_release(&net->connections_lock);
+	return exists;
+}
+
+// Returns with the connections lock held for reading, so the connection can't be disconnected
+// while the caller uses it. Returns NULL, without the lock, if every connection is taken.
+static connection_t* find_or_create_connection(net_t* net, const net_address_t* address)
+{
+	while (true)
+	{
+		// Nearly every packet is from a known peer, so look it up without excluding other readers.
+		rwlock_read_acquire(&net->connections_lock);
+		connection_t* result = find_connection(net, address);
+		if (result)
+		{
+			return result;
+		}
+		rwlock_read_release(&net->connections_lock);
 
-	return result;
+		if (!create_connection(net, address))
+		{
+			return NULL;
+		}
+	}
 }
 
 static int recv_thread_func(void* user)
@@ -382,34 +456,93 @@ static int recv_thread_func(void* user)
 			continue;
 		}
 		connection->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
+		future_t* established = claim_established(connection);
 
 		queue_try_push(connection->recv_queue, packet);
+		rwlock_read_release(&net->connections_lock);
+
+		// Completed once the lock is released, so continuations run without it held.
+		complete_established(established, 0);
 	}
 
 	return 0;
 }
 
-static void timeout_old_connections(net_t* net)
+// Registrations are dropped as their entities despawn, so snapshots never need to validate them.
+// Removal keeps the remaining order so snapshots still line up with acknowledged ones.
+static void entities_despawned(ecs_t* ecs, ecs_event_t event, const ecs_entity_ref_t* entities, int count, void* user)
 {
-	mutex_lock(net->connections_mutex);
-
-	uint32_t now = timer_ticks_to_ms(timer_get_ticks());
-	for (int i = 0; i < _countof(net->connections); ++i)
+	net_t* net = user;
+	for (int e = 0; e < count; ++e)
 	{
-		connection_t* c = &net->connections[i];
-		if (c->address.port && c->last_recv_ms + k_timeout_ms < now)
+		for (int i = 0; i < net->entity_count; ++i)
 		{
-			debug_print(k_print_info, "Disconnecting old connection.\n");
-
-			queue_push(c->send_queue, NULL);
-			thread_destroy(c->send_thread);
-			queue_destroy(c->send_queue);
-			queue_destroy(c->recv_queue);
-			memset(c, 0, sizeof(*c));
+			if (memcmp(&net->entities[i].ref, &entities[e], sizeof(ecs_entity_ref_t)) == 0)
+			{
+				memmove(&net->entities[i], &net->entities[i + 1], sizeof(entity_data_t) * (net->entity_count - i - 1));
+				net->entity_count--;
+				break;
+			}
 		}
 	}
+}
+
+// The receive thread and a disconnect may race to complete the future, so only the first one claims it.
+// Called with the connections lock held. Returns the future with a reference added, or NULL if it was claimed.
+static future_t* claim_established(connection_t* connection)
+{
+	if (!connection->net
+		|| atomic_load_explicit(&connection->established_completed, k_atomic_relaxed) != 0
+		|| atomic_exchange(&connection->established_completed, 1) != 0)
+	{
+		return NULL;
+	}
+	future_retain(connection->established);
+	return connection->established;
+}
+
+// Complete a future returned by claim_established() and drop its reference.
+static void complete_established(future_t* established, int result)
+{
+	if (established)
+	{
+		future_complete(established, result);
+		future_release(established);
+	}
+}
+
+static void disconnect(connection_t* connection)
+{
+	timer_wheel_cancel(connection->net->timers, connection->timeout_timer);
+	complete_established(claim_established(connection), -1);
+	future_release(connection->established);
+	queue_push(connection->send_queue, NULL);
+	thread_destroy(connection->send_thread);
+	queue_destroy(connection->send_queue);
+	queue_destroy(connection->recv_queue);
+	memset(connection, 0, sizeof(*connection));
+}
+
+// Runs from net_update() when a connection's timeout is due.
+// Packets only record their arrival time, so the timer is pushed back here rather than on every packet.
+static void connection_timed_out(void* data)
+{
+	connection_t* c = data;
+	net_t* net = c->net;
+
+	// Read the arrival time before the clock, so a packet landing in between cannot appear to be from the future.
+	uint32_t last_recv_ms = c->last_recv_ms;
+	uint32_t idle_ms = timer_ticks_to_ms(timer_get_ticks()) - last_recv_ms;
+	if (idle_ms < (uint32_t)k_timeout_ms)
+	{
+		c->timeout_timer = timer_wheel_schedule(net->timers, (uint32_t)k_timeout_ms - idle_ms, 0, connection_timed_out, c);
+		return;
+	}
 
-	mutex_unlock(net->connections_mutex);
+	debug_print(k_print_info, "Disconnecting old connection.\n");
+	rwlock_write_acquire(&net->connections_lock);
+	disconnect(c);
+	rwlock_write_release(&net->connections_lock);
 }
 
 static void snapshot_entities(net_t* net)
@@ -419,7 +552,7 @@ static void snapshot_entities(net_t* net)
 
 	char* cur = snapshot->data;
 	const char* end = &snapshot->data[_countof(snapshot->data)];
-	for (int i = 0; i < _countof(net->entities) && ecs_is_entity_ref_valid(net->ecs, net->entities[i].ref, true); ++i)
+	for (int i = 0; i < net->entity_count; ++i)
 	{
 		int type = net->entities[i].type;
 		if (net->entity_types[type].replicated_size + sizeof(entity_packet_header_t) < (size_t)(end - cur))
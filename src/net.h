@@ -7,6 +7,8 @@
 
 typedef struct net_t net_t;
 
+typedef struct cpu_placement_t cpu_placement_t;
+typedef struct future_t future_t;
 typedef struct heap_t heap_t;
 
 typedef struct net_address_t
@@ -20,9 +22,14 @@ typedef void(*net_configure_entity_callback_t)(ecs_t* ecs, ecs_entity_ref_t enti
 net_t* net_create(heap_t* heap, ecs_t* ecs);
 void net_destroy(net_t* net);
 
+// Pin the network threads, including those of later connections, to the I/O processors of a placement.
+void net_set_placement(net_t* net, const cpu_placement_t* placement);
+
 void net_update(net_t* net);
 
-void net_connect(net_t* net, const net_address_t* address);
+// Start talking to a peer.
+// Returns a future completed with zero once the peer answers, or non-zero if the connection times out or fails.
+future_t* net_connect(net_t* net, const net_address_t* address);
 void net_disconnect_all(net_t* net);
 
 void net_state_register_entity_type(net_t* net, int type, uint64_t component_mask, uint64_t replicated_component_mask, net_configure_entity_callback_t configure_callback, void* configure_callback_data);
@@ -0,0 +1,405 @@
+#include "pack.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+enum
+{
+	k_pack_queue_capacity = 64,
+	// Files read ahead while earlier ones are compressed.
+	k_pack_in_flight = 16,
+	k_pack_max_path = 1024,
+	k_pack_initial_entries = 256,
+};
+
+typedef struct pack_file_t
+{
+	char source[k_pack_max_path];
+	char dest[k_pack_max_path];
+	fs_work_t* read;
+	fs_work_t* write;
+	bool read_failed;
+} pack_file_t;
+
+typedef struct pack_t
+{
+	heap_t* heap;
+	fs_t* fs;
+	int level;
+	const char* dest_root;
+
+	// Packing into an archive, files are compressed in memory and collected here rather than written out.
+	bool archive;
+	fs_archive_entry_t* entries;
+	int entry_count;
+	int entry_capacity;
+
+	// Ring of files in flight, oldest first.
+	pack_file_t files[k_pack_in_flight];
+	int first;
+	int count;
+
+	int packed;
+	bool failed;
+	uint64_t source_bytes;
+	uint64_t packed_bytes;
+} pack_t;
+
+static bool walk_directory(pack_t* pack, const char* source_dir, const char* dest_dir);
+
+// Queue the compressed write of a file once its read has landed.
+// For an archive, the file is compressed into memory instead, unless it is to be stored as is.
+static void start_write(pack_t* pack, pack_file_t* file)
+{
+	if (fs_work_get_result(file->read) != 0)
+	{
+		debug_print(k_print_error, "pack unable to read %s\n", file->source);
+		file->read_failed = true;
+		pack->failed = true;
+		return;
+	}
+	if (!pack->archive)
+	{
+		file->write = fs_write(pack->fs, file->dest, fs_work_get_buffer(file->read), fs_work_get_size(file->read), pack->level, k_fs_priority_normal);
+	}
+	else if (pack->level > k_fs_compression_none)
+	{
+		file->write = fs_compress(pack->fs, fs_work_get_buffer(file->read), fs_work_get_size(file->read), pack->heap, pack->level, k_fs_priority_normal);
+	}
+}
+
+// Add a file to the archive, compressed only where that makes it smaller. The entry takes its buffer.
+static void add_entry(pack_t* pack, pack_file_t* file)
+{
+	if (pack->entry_count == pack->entry_capacity)
+	{
+		fs_archive_entry_t* entries = heap_alloc(pack->heap, pack->entry_capacity * 2 * sizeof(fs_archive_entry_t), 8);
+		memcpy(entries, pack->entries, pack->entry_count * sizeof(fs_archive_entry_t));
+		heap_free(pack->heap, pack->entries);
+		pack->entries = entries;
+		pack->entry_capacity *= 2;
+	}
+
+	fs_archive_entry_t* entry = &pack->entries[pack->entry_count++];
+	size_t path_size = strlen(file->dest) + 1;
+	char* path = heap_alloc(pack->heap, path_size, 8);
+	memcpy(path, file->dest, path_size);
+	entry->path = path;
+	entry->data = fs_work_get_buffer(file->read);
+	entry->data_size = fs_work_get_size(file->read);
+	entry->compressed = false;
+
+	if (file->write && fs_work_get_result(file->write) == 0 && fs_work_get_size(file->write) < entry->data_size)
+	{
+		heap_free(pack->heap, (void*)entry->data);
+		entry->data = fs_work_get_buffer(file->write);
+		entry->data_size = fs_work_get_size(file->write);
+		entry->compressed = true;
+	}
+	else if (file->write)
+	{
+		heap_free(pack->heap, fs_work_get_buffer(file->write));
+	}
+
+	pack->source_bytes += fs_work_get_size(file->read);
+	pack->packed_bytes += entry->data_size;
+	pack->packed++;
+}
+
+static void start_ready_writes(pack_t* pack)
+{
+	for (int i = 0; i < pack->count; ++i)
+	{
+		pack_file_t* file = &pack->files[(pack->first + i) % k_pack_in_flight];
+		if (!file->write && !file->read_failed && fs_work_is_done(file->read))
+		{
+			start_write(pack, file);
+		}
+	}
+}
+
+// Finish the oldest file in flight.
+static void retire_file(pack_t* pack)
+{
+	pack_file_t* file = &pack->files[pack->first];
+	if (!file->write && !file->read_failed)
+	{
+		start_write(pack, file);
+	}
+
+	if (pack->archive)
+	{
+		if (!file->read_failed)
+		{
+			add_entry(pack, file);
+		}
+		else
+		{
+			heap_free(pack->heap, fs_work_get_buffer(file->read));
+		}
+		fs_work_destroy(file->write);
+	}
+	else if (file->write)
+	{
+		if (fs_work_get_result(file->write) == 0)
+		{
+			fs_mapping_t* packed = fs_map(pack->fs, file->dest, k_fs_map_hint_none);
+			pack->source_bytes += fs_work_get_size(file->write);
+			pack->packed_bytes += fs_mapping_get_size(packed);
+			pack->packed++;
+			fs_unmap(packed);
+		}
+		else
+		{
+			debug_print(k_print_error, "pack unable to write %s\n", file->dest);
+			pack->failed = true;
+		}
+		fs_work_destroy(file->write);
+	}
+
+	if (!pack->archive)
+	{
+		heap_free(pack->heap, fs_work_get_buffer(file->read));
+	}
+	fs_work_destroy(file->read);
+	file->read = NULL;
+	file->write = NULL;
+	pack->first = (pack->first + 1) % k_pack_in_flight;
+	pack->count--;
+}
+
+static void pack_file(pack_t* pack, const char* source, const char* dest)
+{
+	if (pack->count == k_pack_in_flight)
+	{
+		retire_file(pack);
+	}
+
+	pack_file_t* file = &pack->files[(pack->first + pack->count) % k_pack_in_flight];
+	snprintf(file->source, sizeof(file->source), "%s", source);
+	snprintf(file->dest, sizeof(file->dest), "%s", dest);
+	file->read = fs_read(pack->fs, source, pack->heap, false, false, k_fs_priority_normal);
+	file->write = NULL;
+	file->read_failed = false;
+	pack->count++;
+
+	start_ready_writes(pack);
+}
+
+static bool visit_entry(pack_t* pack, const char* source_dir, const char* dest_dir, const char* name, bool is_directory)
+{
+	if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+	{
+		return true;
+	}
+
+	char source[k_pack_max_path];
+	char dest[k_pack_max_path];
+	snprintf(source, sizeof(source), "%s/%s", source_dir, name);
+	if (is_directory)
+	{
+		// Do not pack our own output when it is written inside the source tree.
+		if (strcmp(source, pack->dest_root) == 0)
+		{
+			return true;
+		}
+		snprintf(dest, sizeof(dest), dest_dir[0] ? "%s/%s" : "%s%s", dest_dir, name);
+		return walk_directory(pack, source, dest);
+	}
+
+	// Archive entries are named by their path relative to the source directory.
+	if (pack->archive)
+	{
+		snprintf(dest, sizeof(dest), dest_dir[0] ? "%s/%s" : "%s%s", dest_dir, name);
+		if (strcmp(source, pack->dest_root) != 0)
+		{
+			pack_file(pack, source, dest);
+		}
+		return true;
+	}
+
+	snprintf(dest, sizeof(dest), "%s/%s.lz4", dest_dir, name);
+	pack_file(pack, source, dest);
+	return true;
+}
+
+#if defined(_WIN32)
+
+static bool make_directory(const char* path)
+{
+	wchar_t wide_path[k_pack_max_path];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return false;
+	}
+	return CreateDirectory(wide_path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+static bool walk_directory(pack_t* pack, const char* source_dir, const char* dest_dir)
+{
+	char pattern[k_pack_max_path];
+	snprintf(pattern, sizeof(pattern), "%s/*", source_dir);
+	wchar_t wide_pattern[k_pack_max_path];
+	if ((!pack->archive && !make_directory(dest_dir)) ||
+		MultiByteToWideChar(CP_UTF8, 0, pattern, -1, wide_pattern, _countof(wide_pattern)) <= 0)
+	{
+		debug_print(k_print_error, "pack unable to create %s\n", dest_dir);
+		return false;
+	}
+
+	WIN32_FIND_DATA data;
+	HANDLE find = FindFirstFile(wide_pattern, &data);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		debug_print(k_print_error, "pack unable to list %s\n", source_dir);
+		return false;
+	}
+
+	bool ok = true;
+	do
+	{
+		char name[k_pack_max_path];
+		if (WideCharToMultiByte(CP_UTF8, 0, data.cFileName, -1, name, sizeof(name), NULL, NULL) <= 0)
+		{
+			ok = false;
+			continue;
+		}
+		ok = visit_entry(pack, source_dir, dest_dir, name, (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) && ok;
+	} while (FindNextFile(find, &data));
+
+	FindClose(find);
+	return ok;
+}
+
+#else
+
+static bool make_directory(const char* path)
+{
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+static bool walk_directory(pack_t* pack, const char* source_dir, const char* dest_dir)
+{
+	if (!pack->archive && !make_directory(dest_dir))
+	{
+		debug_print(k_print_error, "pack unable to create %s\n", dest_dir);
+		return false;
+	}
+
+	DIR* dir = opendir(source_dir);
+	if (!dir)
+	{
+		debug_print(k_print_error, "pack unable to list %s\n", source_dir);
+		return false;
+	}
+
+	bool ok = true;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		char path[k_pack_max_path];
+		snprintf(path, sizeof(path), "%s/%s", source_dir, entry->d_name);
+		struct stat info;
+		if (stat(path, &info) != 0)
+		{
+			ok = false;
+			continue;
+		}
+		ok = visit_entry(pack, source_dir, dest_dir, entry->d_name, S_ISDIR(info.st_mode)) && ok;
+	}
+
+	closedir(dir);
+	return ok;
+}
+
+#endif
+
+// Walk the source tree, then finish the files still in flight.
+static bool pack_tree(pack_t* pack, const char* source_dir, const char* dest_dir)
+{
+	bool ok = walk_directory(pack, source_dir, dest_dir);
+	while (pack->count > 0)
+	{
+		retire_file(pack);
+	}
+	return ok && !pack->failed;
+}
+
+static void pack_report(pack_t* pack, uint64_t ticks)
+{
+	double ms = (double)ticks * 1000.0 / (double)timer_get_ticks_per_second();
+	double ratio = pack->packed_bytes ? (double)pack->source_bytes / (double)pack->packed_bytes : 0.0;
+	debug_print(k_print_info, "pack files=%d source_kb=%llu packed_kb=%llu ratio=%.2f ms=%.1f\n",
+		pack->packed, pack->source_bytes / 1024, pack->packed_bytes / 1024, ratio, ms);
+}
+
+static pack_t* pack_create(heap_t* heap, int level, const char* dest_root)
+{
+	pack_t* pack = heap_alloc(heap, sizeof(pack_t), 8);
+	memset(pack, 0, sizeof(*pack));
+	pack->heap = heap;
+	pack->fs = fs_create(heap, k_pack_queue_capacity);
+	pack->level = level;
+	pack->dest_root = dest_root;
+	return pack;
+}
+
+static void pack_destroy(pack_t* pack)
+{
+	fs_destroy(pack->fs);
+	heap_free(pack->heap, pack);
+}
+
+int pack_directory(heap_t* heap, const char* source_dir, const char* dest_dir, int level)
+{
+	pack_t* pack = pack_create(heap, __max(level, k_fs_compression_fast), dest_dir);
+	uint64_t t0 = timer_get_ticks();
+	bool ok = pack_tree(pack, source_dir, dest_dir);
+	pack_report(pack, timer_get_ticks() - t0);
+
+	int result = ok ? pack->packed : -1;
+	pack_destroy(pack);
+	return result;
+}
+
+int pack_archive(heap_t* heap, const char* source_dir, const char* archive_path, int level)
+{
+	pack_t* pack = pack_create(heap, level, archive_path);
+	pack->archive = true;
+	pack->entry_capacity = k_pack_initial_entries;
+	pack->entries = heap_alloc(heap, pack->entry_capacity * sizeof(fs_archive_entry_t), 8);
+
+	uint64_t t0 = timer_get_ticks();
+	bool ok = pack_tree(pack, source_dir, "");
+	if (ok && fs_archive_write(pack->fs, archive_path, pack->entries, pack->entry_count) != 0)
+	{
+		debug_print(k_print_error, "pack unable to write %s\n", archive_path);
+		ok = false;
+	}
+	pack_report(pack, timer_get_ticks() - t0);
+
+	for (int i = 0; i < pack->entry_count; ++i)
+	{
+		heap_free(heap, (void*)pack->entries[i].path);
+		heap_free(heap, (void*)pack->entries[i].data);
+	}
+	heap_free(heap, pack->entries);
+
+	int result = ok ? pack->packed : -1;
+	pack_destroy(pack);
+	return result;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+// Asset packer
+// Pre-compresses a directory tree of assets offline, for files written once and read many times.
+// Each file is compressed with LZ4HC into a mirror of the tree, with ".lz4" appended to its name,
+// ready to be loaded with fs_read() and use_compression at full LZ4 decompression speed.
+// Run from the command line as: --pack <source directory> <destination directory> [level]
+// or, to pack the tree into a single archive for fs_archive_open(): --pack-archive <source directory> <archive> [level]
+
+typedef struct heap_t heap_t;
+
+// Compress every file under source_dir into dest_dir at an fs compression level.
+// Prints a summary line:
+//   pack files=<n> source_kb=<n> packed_kb=<n> ratio=<f> ms=<f>
+// Returns the number of files packed, or -1 if the tree could not be walked or any file failed.
+int pack_directory(heap_t* heap, const char* source_dir, const char* dest_dir, int level);
+
+// Pack every file under source_dir into one archive, each named by its path relative to source_dir.
+// Files are compressed at an fs compression level where that makes them smaller, and stored as is otherwise;
+// with k_fs_compression_none nothing is compressed. Prints the same summary line as pack_directory().
+// Returns the number of files packed, or -1 on any failure.
+int pack_archive(heap_t* heap, const char* source_dir, const char* archive_path, int level);
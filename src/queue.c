@@ -1,76 +1,212 @@
+#include "queue.h"
+
 #include "atomic.h"
 #include "heap.h"
 #include "semaphore.h"
 
+#include <limits.h>
+
+// Bounded multi-producer/multi-consumer ring buffer after Dmitry Vyukov.
+// Each cell carries a sequence number that tells producers and consumers
+// whether it is ready for them, so the fast path is a single CAS.
+// Semaphores are only touched when a thread must park on a full or empty queue.
+
+enum
+{
+	k_queue_cache_line = 64,
+};
+
+typedef struct queue_cell_t
+{
+	int sequence;
+	void* item;
+} queue_cell_t;
+
 typedef struct queue_t
 {
 	heap_t* heap;
-	semaphore_t* used_items;
-	semaphore_t* free_items;
-	void** items;
-	int capacity;
-	int head_index;
+	queue_cell_t* cells;
+	int mask;
+
+	semaphore_t* items_available;
+	semaphore_t* space_available;
+	int pop_waiters;
+	int push_waiters;
+
+	char pad0[k_queue_cache_line];
 	int tail_index;
+	char pad1[k_queue_cache_line - sizeof(int)];
+	int head_index;
+	char pad2[k_queue_cache_line - sizeof(int)];
 } queue_t;
 
+// Counters wrap; do arithmetic unsigned and compare as a signed distance.
+static int sequence_add(int a, int b)
+{
+	return (int)((unsigned int)a + (unsigned int)b);
+}
+
+static int sequence_diff(int a, int b)
+{
+	return (int)((unsigned int)a - (unsigned int)b);
+}
+
+static bool try_pop_item(queue_t* queue, void** item);
+
+// Read with a full barrier, so a waiter count is never read ahead of the preceding cell update.
+static int load_fenced(int* address)
+{
+	return atomic_compare_and_exchange(address, 0, 0);
+}
+
 queue_t* queue_create(heap_t* heap, int capacity)
 {
-	queue_t* queue = heap_alloc(heap, sizeof(queue_t), 8);
-	queue->items = heap_alloc(heap, sizeof(void*) * capacity, 8);
-	queue->used_items = semaphore_create(0, capacity);
-	queue->free_items = semaphore_create(capacity, capacity);
+	int size = 1;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	queue_t* queue = heap_alloc(heap, sizeof(queue_t), k_queue_cache_line);
 	queue->heap = heap;
-	queue->capacity = capacity;
-	queue->head_index = 0;
+	queue->cells = heap_alloc(heap, sizeof(queue_cell_t) * size, k_queue_cache_line);
+	queue->mask = size - 1;
+	for (int i = 0; i < size; ++i)
+	{
+		queue->cells[i].sequence = i;
+		queue->cells[i].item = NULL;
+	}
+	queue->items_available = semaphore_create(0, INT_MAX);
+	queue->space_available = semaphore_create(0, INT_MAX);
+	queue->pop_waiters = 0;
+	queue->push_waiters = 0;
 	queue->tail_index = 0;
+	queue->head_index = 0;
 	return queue;
 }
 
 void queue_destroy(queue_t* queue)
 {
-	semaphore_destroy(queue->used_items);
-	semaphore_destroy(queue->free_items);
-	heap_free(queue->heap, queue->items);
+	semaphore_destroy(queue->items_available);
+	semaphore_destroy(queue->space_available);
+	heap_free(queue->heap, queue->cells);
 	heap_free(queue->heap, queue);
 }
 
 void queue_push(queue_t* queue, void* item)
 {
-	semaphore_acquire(queue->free_items);
-	int index = atomic_increment(&queue->tail_index) % queue->capacity;
-	queue->items[index] = item;
-	semaphore_release(queue->used_items);
+	while (!queue_try_push(queue, item))
+	{
+		// Announce the wait before the final retry; a pop either sees us or frees the slot we see.
+		atomic_increment(&queue->push_waiters);
+		if (queue_try_push(queue, item))
+		{
+			atomic_decrement(&queue->push_waiters);
+			break;
+		}
+		semaphore_acquire(queue->space_available);
+		atomic_decrement(&queue->push_waiters);
+	}
 }
 
 void* queue_pop(queue_t* queue)
 {
-	semaphore_acquire(queue->used_items);
-	int index = atomic_increment(&queue->head_index) % queue->capacity;
-	void* item = queue->items[index];
-	semaphore_release(queue->free_items);
-	return item;
+	while (true)
+	{
+		void* item;
+		if (try_pop_item(queue, &item))
+		{
+			return item;
+		}
+
+		atomic_increment(&queue->pop_waiters);
+		if (try_pop_item(queue, &item))
+		{
+			atomic_decrement(&queue->pop_waiters);
+			return item;
+		}
+		semaphore_acquire(queue->items_available);
+		atomic_decrement(&queue->pop_waiters);
+	}
 }
 
 bool queue_try_push(queue_t* queue, void* item)
 {
-	if (semaphore_try_acquire(queue->free_items))
+	int pos = atomic_load(&queue->tail_index);
+	queue_cell_t* cell;
+	while (true)
+	{
+		cell = &queue->cells[pos & queue->mask];
+		int diff = sequence_diff(atomic_load(&cell->sequence), pos);
+		if (diff == 0)
+		{
+			int old = atomic_compare_and_exchange(&queue->tail_index, pos, sequence_add(pos, 1));
+			if (old == pos)
+			{
+				break;
+			}
+			pos = old;
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = atomic_load(&queue->tail_index);
+		}
+	}
+
+	cell->item = item;
+	atomic_store(&cell->sequence, sequence_add(pos, 1));
+
+	if (load_fenced(&queue->pop_waiters) > 0)
 	{
-		int index = atomic_increment(&queue->tail_index) % queue->capacity;
-		queue->items[index] = item;
-		semaphore_release(queue->used_items);
-		return true;
+		semaphore_release(queue->items_available);
 	}
-	return false;
+	return true;
 }
 
-void* queue_try_pop(queue_t* queue)
+static bool try_pop_item(queue_t* queue, void** item)
 {
-	if (semaphore_try_acquire(queue->used_items))
+	int pos = atomic_load(&queue->head_index);
+	queue_cell_t* cell;
+	while (true)
+	{
+		cell = &queue->cells[pos & queue->mask];
+		int diff = sequence_diff(atomic_load(&cell->sequence), sequence_add(pos, 1));
+		if (diff == 0)
+		{
+			int old = atomic_compare_and_exchange(&queue->head_index, pos, sequence_add(pos, 1));
+			if (old == pos)
+			{
+				break;
+			}
+			pos = old;
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = atomic_load(&queue->head_index);
+		}
+	}
+
+	*item = cell->item;
+	atomic_store(&cell->sequence, sequence_add(pos, queue->mask + 1));
+
+	if (load_fenced(&queue->push_waiters) > 0)
 	{
-		int index = atomic_increment(&queue->head_index) % queue->capacity;
-		void* item = queue->items[index];
-		semaphore_release(queue->free_items);
-		return item;
+		semaphore_release(queue->space_available);
 	}
-	return NULL;
+	return true;
+}
+
+void* queue_try_pop(queue_t* queue)
+{
+	void* item = NULL;
+	try_pop_item(queue, &item);
+	return item;
 }
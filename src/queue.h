@@ -3,6 +3,7 @@
 #include <stdbool.h>
 
 // Thread-safe Queue container
+// Lock-free when neither full nor empty; threads only block in the OS to wait for space or items.
 
 // Handle to a thread-safe queue.
 typedef struct queue_t queue_t;
@@ -10,6 +11,7 @@ typedef struct queue_t queue_t;
 typedef struct heap_t heap_t;
 
 // Create a queue with the defined capacity.
+// Capacity is rounded up to a power of two.
 queue_t* queue_create(heap_t* heap, int capacity);
 
 // Destroy a previously created queue.
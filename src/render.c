@@ -1,9 +1,11 @@
 #include "render.h"
 
+#include "cpu_topology.h"
 #include "ecs.h"
 #include "gpu.h"
 #include "heap.h"
-#include "queue.h"
+#include "semaphore.h"
+#include "spsc_ring.h"
 #include "thread.h"
 #include "wm.h"
 
@@ -13,12 +15,15 @@
 enum
 {
 	k_render_max_drawables = 512,
+	k_render_ring_capacity = 1024 * 1024,
+	k_render_max_queued_frames = 2,
 };
 
 typedef enum command_type_t
 {
 	k_command_frame_done,
 	k_command_model,
+	k_command_exit,
 } command_type_t;
 
 typedef struct model_command_t
@@ -35,6 +40,11 @@ typedef struct frame_done_command_t
 	command_type_t type;
 } frame_done_command_t;
 
+typedef struct exit_command_t
+{
+	command_type_t type;
+} exit_command_t;
+
 typedef struct draw_instance_t
 {
 	ecs_entity_ref_t entity;
@@ -64,7 +74,11 @@ typedef struct render_t
 	wm_window_t* window;
 	thread_t* thread;
 	gpu_t* gpu;
-	queue_t* queue;
+
+	// Commands are written into and read out of the ring in place.
+	// Frame slots keep the game from running too far ahead of the render thread.
+	spsc_ring_t* ring;
+	semaphore_t* frame_slots;
 
 	int frame_counter;
 	int gpu_frame_count;
@@ -88,41 +102,56 @@ render_t* render_create(heap_t* heap, wm_window_t* window)
 	render_t* render = heap_alloc(heap, sizeof(render_t), 8);
 	render->heap = heap;
 	render->window = window;
-	render->queue = queue_create(heap, 3);
+	render->ring = spsc_ring_create(heap, k_render_ring_capacity);
+	render->frame_slots = semaphore_create(k_render_max_queued_frames, k_render_max_queued_frames);
 	render->frame_counter = 0;
 	render->instance_count = 0;
 	render->mesh_count = 0;
 	render->shader_count = 0;
 	render->thread = thread_create(render_thread_func, render);
+	thread_set_name(render->thread, "render");
 	return render;
 }
 
 void render_destroy(render_t* render)
 {
-	queue_push(render->queue, NULL);
+	exit_command_t* command = spsc_ring_write_begin(render->ring, sizeof(exit_command_t));
+	command->type = k_command_exit;
+	spsc_ring_write_end(render->ring);
+	spsc_ring_signal(render->ring);
 	thread_destroy(render->thread);
-	queue_destroy(render->queue);
+	spsc_ring_destroy(render->ring);
+	semaphore_destroy(render->frame_slots);
 	heap_free(render->heap, render);
 }
 
+void render_set_placement(render_t* render, const cpu_placement_t* placement)
+{
+	thread_set_affinity(render->thread, placement->render_mask);
+}
+
 void render_push_model(render_t* render, ecs_entity_ref_t* entity, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform)
 {
-	model_command_t* command = heap_alloc(render->heap, sizeof(model_command_t), 8);
+	// Uniform data is stored directly after the command.
+	model_command_t* command = spsc_ring_write_begin(render->ring, sizeof(model_command_t) + uniform->size);
 	command->type = k_command_model;
 	command->entity = *entity;
 	command->mesh = mesh;
 	command->shader = shader;
 	command->uniform_buffer.size = uniform->size;
-	command->uniform_buffer.data = heap_alloc(render->heap, uniform->size, 8);
+	command->uniform_buffer.data = command + 1;
 	memcpy(command->uniform_buffer.data, uniform->data, uniform->size);
-	queue_push(render->queue, command);
+	spsc_ring_write_end(render->ring);
 }
 
 void render_push_done(render_t* render)
 {
-	frame_done_command_t* command = heap_alloc(render->heap, sizeof(frame_done_command_t), 8);
+	semaphore_acquire(render->frame_slots);
+
+	frame_done_command_t* command = spsc_ring_write_begin(render->ring, sizeof(frame_done_command_t));
 	command->type = k_command_frame_done;
-	queue_push(render->queue, command);
+	spsc_ring_write_end(render->ring);
+	spsc_ring_signal(render->ring);
 }
 
 static int render_thread_func(void* user)
@@ -139,9 +168,11 @@ static int render_thread_func(void* user)
 
 	while (true)
 	{
-		command_type_t* type = queue_pop(render->queue);
-		if (!type)
+		size_t size = 0;
+		command_type_t* type = spsc_ring_read_begin(render->ring, &size);
+		if (*type == k_command_exit)
 		{
+			spsc_ring_read_end(render->ring);
 			break;
 		}
 
@@ -160,6 +191,8 @@ static int render_thread_func(void* user)
 			destroy_stale_data(render);
 			++render->frame_counter;
 			frame_index = render->frame_counter % render->gpu_frame_count;
+
+			semaphore_release(render->frame_slots);
 		}
 		else if (*type == k_command_model)
 		{
@@ -168,8 +201,6 @@ static int render_thread_func(void* user)
 			draw_mesh_t* mesh = create_or_get_mesh_for_model_command(render, command);
 			draw_instance_t* instance = create_or_get_instance_for_model_command(render, command, shader->shader);
 
-			heap_free(render->heap, command->uniform_buffer.data);
-
 			if (last_pipeline != shader->pipeline)
 			{
 				gpu_cmd_pipeline_bind(render->gpu, cmdbuf, shader->pipeline);
@@ -184,7 +215,7 @@ static int render_thread_func(void* user)
 			gpu_cmd_draw(render->gpu, cmdbuf);
 		}
 
-		heap_free(render->heap, type);
+		spsc_ring_read_end(render->ring);
 	}
 
 	gpu_wait_until_idle(render->gpu);
@@ -4,6 +4,7 @@
 
 typedef struct render_t render_t;
 
+typedef struct cpu_placement_t cpu_placement_t;
 typedef struct ecs_entity_ref_t ecs_entity_ref_t;
 typedef struct gpu_mesh_info_t gpu_mesh_info_t;
 typedef struct gpu_shader_info_t gpu_shader_info_t;
@@ -17,8 +18,13 @@ render_t* render_create(heap_t* heap, wm_window_t* window);
 // Destroy a render system.
 void render_destroy(render_t* render);
 
+// Pin the render thread to the render processors of a placement.
+void render_set_placement(render_t* render, const cpu_placement_t* placement);
+
 // Push a model onto a queue of items to be rendered.
+// The command and its uniform data are copied into a ring shared with the render thread.
 void render_push_model(render_t* render, ecs_entity_ref_t* entity, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform);
 
 // Push an end-of-frame marker on a queue of items to be rendered.
+// Wakes the render thread. Blocks if the render thread is too many frames behind.
 void render_push_done(render_t* render);
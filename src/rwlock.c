@@ -0,0 +1,117 @@
+#include "rwlock.h"
+
+#include "atomic.h"
+#include "futex.h"
+
+#include <limits.h>
+#include <string.h>
+
+enum
+{
+	k_rwlock_writer = -1,
+	k_rwlock_spin_count = 64,
+};
+
+// Spin a little before sleeping, in case the lock is about to be released.
+static bool keep_spinning(int* spins)
+{
+	if (++*spins < k_rwlock_spin_count)
+	{
+		atomic_pause();
+		return true;
+	}
+	return false;
+}
+
+// Sleepers read a wake counter before checking their condition,
+// so a wake in between changes the counter and makes futex_wait return at once.
+static void wake(int* counter, int* waiting, int count)
+{
+	if (atomic_load_explicit(waiting, k_atomic_seq_cst) > 0)
+	{
+		atomic_increment(counter);
+		futex_wake(counter, count);
+	}
+}
+
+void rwlock_init(rwlock_t* lock)
+{
+	memset(lock, 0, sizeof(*lock));
+}
+
+void rwlock_read_acquire(rwlock_t* lock)
+{
+	int spins = 0;
+	while (true)
+	{
+		int state = atomic_load_explicit(&lock->state, k_atomic_relaxed);
+		if (state != k_rwlock_writer && atomic_load_explicit(&lock->writers_waiting, k_atomic_relaxed) == 0)
+		{
+			if (atomic_compare_and_exchange_explicit(&lock->state, state, state + 1, k_atomic_acquire) == state)
+			{
+				return;
+			}
+			continue;
+		}
+		if (keep_spinning(&spins))
+		{
+			continue;
+		}
+
+		atomic_increment(&lock->readers_waiting);
+		int seen = atomic_load_explicit(&lock->reader_wake, k_atomic_seq_cst);
+		if (atomic_load_explicit(&lock->state, k_atomic_seq_cst) == k_rwlock_writer
+			|| atomic_load_explicit(&lock->writers_waiting, k_atomic_seq_cst) > 0)
+		{
+			futex_wait(&lock->reader_wake, seen);
+		}
+		atomic_decrement(&lock->readers_waiting);
+	}
+}
+
+void rwlock_read_release(rwlock_t* lock)
+{
+	if (atomic_fetch_add_explicit(&lock->state, -1, k_atomic_seq_cst) == 1)
+	{
+		// Last reader out hands the lock to a waiting writer.
+		wake(&lock->writer_wake, &lock->writers_waiting, 1);
+	}
+}
+
+void rwlock_write_acquire(rwlock_t* lock)
+{
+	if (atomic_compare_and_exchange_explicit(&lock->state, 0, k_rwlock_writer, k_atomic_acquire) == 0)
+	{
+		return;
+	}
+
+	// Counted as waiting from here on, which stops new readers from entering.
+	atomic_increment(&lock->writers_waiting);
+	int spins = 0;
+	while (atomic_compare_and_exchange_explicit(&lock->state, 0, k_rwlock_writer, k_atomic_acquire) != 0)
+	{
+		if (keep_spinning(&spins))
+		{
+			continue;
+		}
+		int seen = atomic_load_explicit(&lock->writer_wake, k_atomic_seq_cst);
+		if (atomic_load_explicit(&lock->state, k_atomic_seq_cst) != 0)
+		{
+			futex_wait(&lock->writer_wake, seen);
+		}
+	}
+	atomic_decrement(&lock->writers_waiting);
+}
+
+bool rwlock_try_write_acquire(rwlock_t* lock)
+{
+	return atomic_compare_and_exchange_explicit(&lock->state, 0, k_rwlock_writer, k_atomic_acquire) == 0;
+}
+
+void rwlock_write_release(rwlock_t* lock)
+{
+	atomic_store_explicit(&lock->state, 0, k_atomic_seq_cst);
+	// Prefer the next writer; readers that wake and find it waiting go back to sleep.
+	wake(&lock->writer_wake, &lock->writers_waiting, 1);
+	wake(&lock->reader_wake, &lock->readers_waiting, INT_MAX);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Reader-writer lock
+// Any number of readers, or one writer. Waiting writers hold back new readers,
+// so a steady stream of reads can't starve a write.
+// Neither side makes a system call unless it has to sleep or wake a sleeper.
+// Not recursive, and a reader must not upgrade to a writer.
+
+// Embed in the owning object and zero-initialize, or call rwlock_init(), before use.
+typedef struct rwlock_t
+{
+	// Number of active readers, or -1 while a writer holds the lock.
+	int state;
+	int writers_waiting;
+	int readers_waiting;
+	// Bumped on every wake, so sleepers can't miss one.
+	int writer_wake;
+	int reader_wake;
+} rwlock_t;
+
+// Initialize a reader-writer lock.
+void rwlock_init(rwlock_t* lock);
+
+// Acquire the lock for reading. Blocks while a writer holds or waits for it.
+void rwlock_read_acquire(rwlock_t* lock);
+
+// Release a read acquisition.
+void rwlock_read_release(rwlock_t* lock);
+
+// Acquire the lock for writing. Blocks until all readers and other writers are gone.
+void rwlock_write_acquire(rwlock_t* lock);
+
+// Attempt to acquire the lock for writing without waiting.
+// Returns true if the lock was acquired.
+bool rwlock_try_write_acquire(rwlock_t* lock);
+
+// Release a write acquisition.
+void rwlock_write_release(rwlock_t* lock);
@@ -1,5 +1,7 @@
 #include "semaphore.h"
 
+#if defined(_WIN32)
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -29,3 +31,83 @@ void semaphore_release(semaphore_t* semaphore)
 {
 	ReleaseSemaphore(semaphore, 1, NULL);
 }
+
+#else
+
+#include "atomic.h"
+#include "futex.h"
+
+#include <stdlib.h>
+
+// Futex semaphore. Sleepers are counted so a release only enters the kernel when someone is waiting.
+typedef struct semaphore_t
+{
+	int count;
+	int max_count;
+	int waiters;
+} semaphore_t;
+
+semaphore_t* semaphore_create(int initial_count, int max_count)
+{
+	semaphore_t* semaphore = calloc(1, sizeof(semaphore_t));
+	semaphore->count = initial_count;
+	semaphore->max_count = max_count;
+	return semaphore;
+}
+
+void semaphore_destroy(semaphore_t* semaphore)
+{
+	free(semaphore);
+}
+
+void semaphore_acquire(semaphore_t* semaphore)
+{
+	while (!semaphore_try_acquire(semaphore))
+	{
+		// The kernel rechecks the count after we are counted, so a release either sees us or we see it.
+		atomic_increment(&semaphore->waiters);
+		futex_wait(&semaphore->count, 0);
+		atomic_fetch_add_explicit(&semaphore->waiters, -1, k_atomic_relaxed);
+	}
+}
+
+bool semaphore_try_acquire(semaphore_t* semaphore)
+{
+	int count = atomic_load_explicit(&semaphore->count, k_atomic_relaxed);
+	while (count > 0)
+	{
+		int old = atomic_compare_and_exchange_explicit(&semaphore->count, count, count - 1, k_atomic_acquire);
+		if (old == count)
+		{
+			return true;
+		}
+		count = old;
+	}
+	return false;
+}
+
+void semaphore_release(semaphore_t* semaphore)
+{
+	int count = atomic_load_explicit(&semaphore->count, k_atomic_relaxed);
+	while (true)
+	{
+		// Like ReleaseSemaphore, releasing past the maximum does nothing.
+		if (count >= semaphore->max_count)
+		{
+			return;
+		}
+		int old = atomic_compare_and_exchange(&semaphore->count, count, count + 1);
+		if (old == count)
+		{
+			break;
+		}
+		count = old;
+	}
+
+	if (atomic_load_explicit(&semaphore->waiters, k_atomic_seq_cst) > 0)
+	{
+		futex_wake(&semaphore->count, 1);
+	}
+}
+
+#endif
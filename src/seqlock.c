@@ -0,0 +1,33 @@
+#include "seqlock.h"
+
+#include "atomic.h"
+
+int seqlock_read_begin(seqlock_t* lock)
+{
+	int sequence = atomic_load_explicit(&lock->sequence, k_atomic_acquire);
+	while (sequence & 1)
+	{
+		atomic_pause();
+		sequence = atomic_load_explicit(&lock->sequence, k_atomic_acquire);
+	}
+	return sequence;
+}
+
+bool seqlock_read_retry(seqlock_t* lock, int sequence)
+{
+	// Keep the reads of the data from moving past the second look at the sequence.
+	atomic_fence(k_atomic_acquire);
+	return atomic_load_explicit(&lock->sequence, k_atomic_relaxed) != sequence;
+}
+
+void seqlock_write_begin(seqlock_t* lock)
+{
+	atomic_store_explicit(&lock->sequence, lock->sequence + 1, k_atomic_relaxed);
+	// Keep the writes to the data from moving ahead of the odd sequence.
+	atomic_fence(k_atomic_release);
+}
+
+void seqlock_write_end(seqlock_t* lock)
+{
+	atomic_store_explicit(&lock->sequence, lock->sequence + 1, k_atomic_release);
+}
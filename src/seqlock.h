@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Sequence lock
+// For small, read-mostly data with a single writer at a time.
+// Readers never block the writer or each other: they copy the data and retry
+// if a write overlapped the copy. Writes never wait.
+
+// Embed next to the data it guards and zero-initialize before use.
+typedef struct seqlock_t
+{
+	// Odd while a write is in progress.
+	int sequence;
+} seqlock_t;
+
+// Begin reading. Returns a sequence number to pass to seqlock_read_retry().
+// Waits while a write is in progress.
+int seqlock_read_begin(seqlock_t* lock);
+
+// Finish reading. Returns true if a write overlapped the read and it must be repeated.
+bool seqlock_read_retry(seqlock_t* lock, int sequence);
+
+// Begin writing. Writers must be serialized by the caller.
+void seqlock_write_begin(seqlock_t* lock);
+
+// Finish writing.
+void seqlock_write_end(seqlock_t* lock);
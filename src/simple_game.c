@@ -3,6 +3,7 @@
 #include "debug.h"
 #include "ecs.h"
 #include "fs.h"
+#include "future.h"
 #include "gpu.h"
 #include "heap.h"
 #include "net.h"
@@ -97,7 +98,7 @@ simple_game_t* simple_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, r
 		net_address_t server;
 		if (net_string_to_address(argv[1], &server))
 		{
-			net_connect(game->net, &server);
+			future_release(net_connect(game->net, &server));
 		}
 		else
 		{
@@ -133,8 +134,8 @@ void simple_game_update(simple_game_t* game)
 
 static void load_resources(simple_game_t* game)
 {
-	game->vertex_shader_work = fs_read(game->fs, "shaders/triangle.vert.spv", game->heap, false, false);
-	game->fragment_shader_work = fs_read(game->fs, "shaders/triangle.frag.spv", game->heap, false, false);
+	game->vertex_shader_work = fs_read(game->fs, "shaders/triangle.vert.spv", game->heap, false, false, k_fs_priority_critical);
+	game->fragment_shader_work = fs_read(game->fs, "shaders/triangle.frag.spv", game->heap, false, false, k_fs_priority_critical);
 	game->cube_shader = (gpu_shader_info_t)
 	{
 		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
@@ -0,0 +1,202 @@
+#include "spsc_ring.h"
+
+#include "atomic.h"
+#include "heap.h"
+#include "semaphore.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+
+enum
+{
+	k_ring_cache_line = 64,
+	k_ring_alignment = 8,
+};
+
+static const uint32_t k_ring_wrap_marker = UINT32_MAX;
+
+// Precedes every record. A wrap marker tells the consumer to skip to the start of the buffer.
+typedef struct ring_header_t
+{
+	uint32_t size;
+	uint32_t pad;
+} ring_header_t;
+
+typedef struct spsc_ring_t
+{
+	heap_t* heap;
+	char* buffer;
+	int capacity;
+	int mask;
+
+	semaphore_t* data_available;
+	semaphore_t* space_available;
+	int reader_waiting;
+	int writer_waiting;
+
+	// Producer-owned.
+	char pad0[k_ring_cache_line];
+	int tail;
+	int write_tail;
+
+	// Consumer-owned.
+	char pad1[k_ring_cache_line - 2 * sizeof(int)];
+	int head;
+	int read_head;
+	char pad2[k_ring_cache_line - 2 * sizeof(int)];
+} spsc_ring_t;
+
+// Positions wrap; do arithmetic unsigned and compare as a signed distance.
+static int position_add(int a, int b)
+{
+	return (int)((unsigned int)a + (unsigned int)b);
+}
+
+static int position_diff(int a, int b)
+{
+	return (int)((unsigned int)a - (unsigned int)b);
+}
+
+static int record_size(size_t size)
+{
+	size_t record = sizeof(ring_header_t) + size;
+	return (int)((record + (k_ring_alignment - 1)) & ~(size_t)(k_ring_alignment - 1));
+}
+
+spsc_ring_t* spsc_ring_create(heap_t* heap, size_t capacity)
+{
+	int size = k_ring_cache_line;
+	while ((size_t)size < capacity && size < INT_MAX / 2)
+	{
+		size <<= 1;
+	}
+
+	spsc_ring_t* ring = heap_alloc(heap, sizeof(spsc_ring_t), k_ring_cache_line);
+	ring->heap = heap;
+	ring->buffer = heap_alloc(heap, size, k_ring_cache_line);
+	ring->capacity = size;
+	ring->mask = size - 1;
+	ring->data_available = semaphore_create(0, INT_MAX);
+	ring->space_available = semaphore_create(0, INT_MAX);
+	ring->reader_waiting = 0;
+	ring->writer_waiting = 0;
+	ring->tail = 0;
+	ring->write_tail = 0;
+	ring->head = 0;
+	ring->read_head = 0;
+	return ring;
+}
+
+void spsc_ring_destroy(spsc_ring_t* ring)
+{
+	semaphore_destroy(ring->data_available);
+	semaphore_destroy(ring->space_available);
+	heap_free(ring->heap, ring->buffer);
+	heap_free(ring->heap, ring);
+}
+
+// Park the calling thread until the watched position moves away from the value it last saw.
+// The flag is raised before the position is checked again, so the other side either
+// observes the flag and wakes us, or we observe its update and never sleep.
+static void wait_for_change(int* waiting, int* position, int seen, semaphore_t* semaphore)
+{
+	atomic_compare_and_exchange(waiting, 0, 1);
+	if (atomic_load(position) == seen)
+	{
+		semaphore_acquire(semaphore);
+	}
+	else
+	{
+		// If the flag was already taken, a wake is in flight and will be absorbed by a later wait.
+		atomic_compare_and_exchange(waiting, 1, 0);
+	}
+}
+
+static void wake_waiter(int* waiting, semaphore_t* semaphore)
+{
+	if (atomic_compare_and_exchange(waiting, 1, 0) == 1)
+	{
+		semaphore_release(semaphore);
+	}
+}
+
+void* spsc_ring_write_begin(spsc_ring_t* ring, size_t size)
+{
+	int record = record_size(size);
+	assert(record <= ring->capacity);
+
+	int tail = ring->tail;
+	while (true)
+	{
+		int head = atomic_load(&ring->head);
+		int available = ring->capacity - position_diff(tail, head);
+		int offset = tail & ring->mask;
+		int contiguous = ring->capacity - offset;
+
+		if (record > contiguous && contiguous <= available)
+		{
+			// Not enough room before the end of the buffer; skip to the start.
+			ring_header_t* marker = (ring_header_t*)&ring->buffer[offset];
+			marker->size = k_ring_wrap_marker;
+			tail = position_add(tail, contiguous);
+			atomic_store(&ring->tail, tail);
+			continue;
+		}
+		if (record <= contiguous && record <= available)
+		{
+			break;
+		}
+		// A full ring must not wait on a consumer that is itself waiting for a signal.
+		spsc_ring_signal(ring);
+		wait_for_change(&ring->writer_waiting, &ring->head, head, ring->space_available);
+	}
+
+	ring_header_t* header = (ring_header_t*)&ring->buffer[tail & ring->mask];
+	header->size = (uint32_t)size;
+	ring->write_tail = position_add(tail, record);
+	return header + 1;
+}
+
+void spsc_ring_write_end(spsc_ring_t* ring)
+{
+	atomic_store(&ring->tail, ring->write_tail);
+}
+
+void spsc_ring_signal(spsc_ring_t* ring)
+{
+	wake_waiter(&ring->reader_waiting, ring->data_available);
+}
+
+void* spsc_ring_read_begin(spsc_ring_t* ring, size_t* size)
+{
+	while (true)
+	{
+		int head = ring->head;
+		int tail = atomic_load(&ring->tail);
+		if (head == tail)
+		{
+			wait_for_change(&ring->reader_waiting, &ring->tail, tail, ring->data_available);
+			continue;
+		}
+
+		int offset = head & ring->mask;
+		ring_header_t* header = (ring_header_t*)&ring->buffer[offset];
+		if (header->size == k_ring_wrap_marker)
+		{
+			atomic_store(&ring->head, position_add(head, ring->capacity - offset));
+			wake_waiter(&ring->writer_waiting, ring->space_available);
+			continue;
+		}
+
+		ring->read_head = position_add(head, record_size(header->size));
+		*size = header->size;
+		return header + 1;
+	}
+}
+
+void spsc_ring_read_end(spsc_ring_t* ring)
+{
+	atomic_store(&ring->head, ring->read_head);
+	wake_waiter(&ring->writer_waiting, ring->space_available);
+}
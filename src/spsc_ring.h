@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+// Single-producer/single-consumer ring buffer of variable-size records.
+// The producer writes each record in place and the consumer reads it in place.
+// Neither side makes a system call unless the ring is full or empty.
+// The consumer only sleeps until the producer calls spsc_ring_signal(),
+// so records are handed over in batches, e.g. one frame at a time.
+
+// Handle to a ring buffer.
+typedef struct spsc_ring_t spsc_ring_t;
+
+typedef struct heap_t heap_t;
+
+// Create a ring buffer.
+// Capacity is in bytes and is rounded up to a power of two.
+spsc_ring_t* spsc_ring_create(heap_t* heap, size_t capacity);
+
+// Destroy a previously created ring buffer.
+void spsc_ring_destroy(spsc_ring_t* ring);
+
+// Reserve space for a record of the given size and return a pointer to it.
+// The memory is 8-byte aligned. Blocks while the ring is full.
+// Must be followed by spsc_ring_write_end(). Producer thread only.
+void* spsc_ring_write_begin(spsc_ring_t* ring, size_t size);
+
+// Publish the record reserved by spsc_ring_write_begin(). Producer thread only.
+void spsc_ring_write_end(spsc_ring_t* ring);
+
+// Wake the consumer if it is waiting for records. Producer thread only.
+void spsc_ring_signal(spsc_ring_t* ring);
+
+// Return a pointer to the oldest published record and its size.
+// Blocks while the ring is empty, until the producer calls spsc_ring_signal().
+// Must be followed by spsc_ring_read_end(). Consumer thread only.
+void* spsc_ring_read_begin(spsc_ring_t* ring, size_t* size);
+
+// Release the record returned by spsc_ring_read_begin(). Consumer thread only.
+void spsc_ring_read_end(spsc_ring_t* ring);
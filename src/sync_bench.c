@@ -0,0 +1,563 @@
+#include "sync_bench.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "event.h"
+#include "heap.h"
+#include "lock.h"
+#include "mutex.h"
+#include "queue.h"
+#include "rwlock.h"
+#include "semaphore.h"
+#include "seqlock.h"
+#include "thread.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+enum
+{
+	k_bench_ops = 1000000,
+	k_bench_repetitions = 5,
+
+	k_bench_max_threads = 64,
+	k_bench_contended_ops = 100000,
+	k_bench_contended_batch = 1000,
+
+	k_bench_handoffs = 20000,
+
+	k_bench_queue_items = 200000,
+	k_bench_queue_capacity = 1024,
+
+	k_bench_event_rounds = 200,
+};
+
+#if defined(_WIN32)
+static const char* k_bench_backend = "win32";
+#else
+static const char* k_bench_backend = "posix";
+#endif
+
+// State shared by the threads of one contended test.
+typedef struct contended_shared_t
+{
+	void (*run)(struct contended_shared_t* shared, int count);
+	int counter;
+	int spin;
+	mutex_t* mutex;
+	lock_t lock;
+	rwlock_t rwlock;
+	event_t* start;
+	int ops_per_thread;
+	uint64_t* samples;
+} contended_shared_t;
+
+typedef struct bench_thread_t
+{
+	void* shared;
+	int index;
+	thread_t* thread;
+} bench_thread_t;
+
+typedef struct handoff_data_t
+{
+	semaphore_t* ping;
+	semaphore_t* pong;
+} handoff_data_t;
+
+typedef struct queue_shared_t
+{
+	queue_t* queue;
+	event_t* start;
+	int items_per_producer;
+	int claimed;
+	int total;
+	uint64_t* samples;
+} queue_shared_t;
+
+typedef struct event_shared_t
+{
+	event_t* event;
+	semaphore_t* go;
+	semaphore_t* ready;
+	semaphore_t* done;
+	uint64_t signal_ticks;
+	int waiters;
+	uint64_t* samples;
+} event_shared_t;
+
+static double ticks_to_ns(double ticks)
+{
+	return ticks * 1000000000.0 / (double)timer_get_ticks_per_second();
+}
+
+static int compare_ticks(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void bench_report(const char* test, int ops, uint64_t ticks)
+{
+	debug_print(k_print_info, "sync_bench test=%s threads=1 ops=%d ns_per_op=%.2f\n",
+		test, ops, ticks_to_ns((double)ticks) / ops);
+}
+
+// Report throughput plus percentiles of the samples, each given in ticks per sample_ops operations.
+static void bench_report_samples(const char* test, int threads, int ops, uint64_t ticks, uint64_t* samples, int count, int sample_ops)
+{
+	qsort(samples, count, sizeof(uint64_t), compare_ticks);
+	double scale = 1.0 / sample_ops;
+	debug_print(k_print_info,
+		"sync_bench test=%s threads=%d ops=%d ns_per_op=%.2f p50_ns=%.1f p90_ns=%.1f p99_ns=%.1f max_ns=%.1f\n",
+		test, threads, ops, ticks_to_ns((double)ticks) / ops,
+		ticks_to_ns(samples[count / 2] * scale),
+		ticks_to_ns(samples[count * 9 / 10] * scale),
+		ticks_to_ns(samples[count * 99 / 100] * scale),
+		ticks_to_ns(samples[count - 1] * scale));
+}
+
+// Pin each benchmark thread to its own processor, so runs are comparable.
+static void place_thread(thread_t* thread, int index)
+{
+	int processors = __min(thread_get_processor_count(), k_bench_max_threads);
+	thread_set_affinity(thread, 1ull << (index % processors));
+}
+
+// Each test body runs ops iterations and is timed as the best of several repetitions.
+#define BENCH(test, ops, setup, body) \
+	do \
+	{ \
+		uint64_t best = UINT64_MAX; \
+		for (int r = 0; r < k_bench_repetitions; ++r) \
+		{ \
+			setup; \
+			uint64_t t0 = timer_get_ticks(); \
+			for (int i = 0; i < (ops); ++i) \
+			{ \
+				body; \
+			} \
+			uint64_t t1 = timer_get_ticks(); \
+			best = __min(best, t1 - t0); \
+		} \
+		bench_report(test, ops, best); \
+	} while (0)
+
+static void uncontended_tests()
+{
+	int value = 0;
+	BENCH("atomic_increment", k_bench_ops, value = 0, atomic_increment(&value));
+	BENCH("atomic_compare_and_exchange", k_bench_ops, value = 0, atomic_compare_and_exchange(&value, i, i + 1));
+	BENCH("atomic_load_store", k_bench_ops, value = 0, atomic_store(&value, atomic_load(&value) + 1));
+
+	mutex_t* mutex = mutex_create();
+	BENCH("mutex_lock_unlock", k_bench_ops, (void)0, mutex_lock(mutex); mutex_unlock(mutex));
+	mutex_lock(mutex);
+	BENCH("mutex_lock_unlock_recursive", k_bench_ops, (void)0, mutex_lock(mutex); mutex_unlock(mutex));
+	mutex_unlock(mutex);
+	mutex_destroy(mutex);
+
+	lock_t lock;
+	lock_init(&lock, "sync_bench");
+	BENCH("lock_acquire_release", k_bench_ops, (void)0, lock_acquire(&lock); lock_release(&lock));
+	lock_profile_start();
+	BENCH("lock_acquire_release_profiled", k_bench_ops, (void)0, lock_acquire(&lock); lock_release(&lock));
+	lock_profile_stop();
+	lock_destroy(&lock);
+
+	rwlock_t rwlock;
+	rwlock_init(&rwlock);
+	BENCH("rwlock_read_acquire_release", k_bench_ops, (void)0, rwlock_read_acquire(&rwlock); rwlock_read_release(&rwlock));
+	BENCH("rwlock_write_acquire_release", k_bench_ops, (void)0, rwlock_write_acquire(&rwlock); rwlock_write_release(&rwlock));
+
+	seqlock_t seqlock = { 0 };
+	BENCH("seqlock_read", k_bench_ops, (void)0, int s = seqlock_read_begin(&seqlock); seqlock_read_retry(&seqlock, s));
+	BENCH("seqlock_write", k_bench_ops, (void)0, seqlock_write_begin(&seqlock); seqlock_write_end(&seqlock));
+
+	semaphore_t* semaphore = semaphore_create(0, INT_MAX);
+	BENCH("semaphore_release_acquire", k_bench_ops, (void)0, semaphore_release(semaphore); semaphore_acquire(semaphore));
+	BENCH("semaphore_try_acquire_empty", k_bench_ops, (void)0, semaphore_try_acquire(semaphore));
+	semaphore_destroy(semaphore);
+
+	event_t* event = event_create();
+	BENCH("event_is_raised", k_bench_ops, (void)0, event_is_raised(event));
+	event_signal(event);
+	BENCH("event_wait_raised", k_bench_ops, (void)0, event_wait(event));
+	event_destroy(event);
+
+	BENCH("timer_get_ticks", k_bench_ops, (void)0, timer_get_ticks());
+}
+
+// Contended increments of one counter, one function per synchronization strategy.
+
+static void run_atomic_increment(contended_shared_t* shared, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		atomic_increment(&shared->counter);
+	}
+}
+
+static void run_atomic_cas_loop(contended_shared_t* shared, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		int value = atomic_load_explicit(&shared->counter, k_atomic_relaxed);
+		int old;
+		while ((old = atomic_compare_and_exchange(&shared->counter, value, value + 1)) != value)
+		{
+			value = old;
+		}
+	}
+}
+
+static void run_mutex(contended_shared_t* shared, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		mutex_lock(shared->mutex);
+		shared->counter++;
+		mutex_unlock(shared->mutex);
+	}
+}
+
+static void run_lock(contended_shared_t* shared, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		lock_acquire(&shared->lock);
+		shared->counter++;
+		lock_release(&shared->lock);
+	}
+}
+
+static void run_rwlock_write(contended_shared_t* shared, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		rwlock_write_acquire(&shared->rwlock);
+		shared->counter++;
+		rwlock_write_release(&shared->rwlock);
+	}
+}
+
+// Test-and-set spinlock: every attempt writes the cache line.
+static void run_spinlock_tas(contended_shared_t* shared, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		while (atomic_exchange_explicit(&shared->spin, 1, k_atomic_acquire) != 0)
+		{
+		}
+		shared->counter++;
+		atomic_store_explicit(&shared->spin, 0, k_atomic_release);
+	}
+}
+
+// Test-and-test-and-set spinlock: waits with plain reads and exponential backoff.
+static void run_spinlock_ttas(contended_shared_t* shared, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		int backoff = 1;
+		while (atomic_load_explicit(&shared->spin, k_atomic_relaxed) != 0
+			|| atomic_exchange_explicit(&shared->spin, 1, k_atomic_acquire) != 0)
+		{
+			for (int j = 0; j < backoff; ++j)
+			{
+				atomic_pause();
+			}
+			backoff = __min(backoff * 2, 64);
+		}
+		shared->counter++;
+		atomic_store_explicit(&shared->spin, 0, k_atomic_release);
+	}
+}
+
+static int contended_thread_func(void* user)
+{
+	bench_thread_t* thread = user;
+	contended_shared_t* shared = thread->shared;
+	event_wait(shared->start);
+
+	int batches = shared->ops_per_thread / k_bench_contended_batch;
+	uint64_t* samples = &shared->samples[thread->index * batches];
+	for (int b = 0; b < batches; ++b)
+	{
+		uint64_t t0 = timer_get_ticks();
+		shared->run(shared, k_bench_contended_batch);
+		samples[b] = timer_get_ticks() - t0;
+	}
+	return 0;
+}
+
+// If trace is not NULL, lock contention is profiled during the test and reported to it.
+static void contended_test(heap_t* heap, const char* test, void (*run)(contended_shared_t*, int), int threads, trace_t* trace)
+{
+	contended_shared_t shared = { 0 };
+	shared.run = run;
+	shared.mutex = mutex_create();
+	lock_init(&shared.lock, test);
+	rwlock_init(&shared.rwlock);
+	shared.start = event_create();
+	shared.ops_per_thread = k_bench_contended_ops;
+
+	int batches = k_bench_contended_ops / k_bench_contended_batch;
+	shared.samples = heap_alloc(heap, sizeof(uint64_t) * batches * threads, 8);
+
+	bench_thread_t workers[k_bench_max_threads];
+	for (int i = 0; i < threads; ++i)
+	{
+		workers[i].shared = &shared;
+		workers[i].index = i;
+		workers[i].thread = thread_create(contended_thread_func, &workers[i]);
+		place_thread(workers[i].thread, i);
+	}
+
+	if (trace)
+	{
+		lock_profile_start();
+	}
+	uint64_t t0 = timer_get_ticks();
+	event_signal(shared.start);
+	for (int i = 0; i < threads; ++i)
+	{
+		thread_destroy(workers[i].thread);
+	}
+	uint64_t t1 = timer_get_ticks();
+	if (trace)
+	{
+		lock_profile_stop();
+		lock_profile_report(trace);
+	}
+
+	int ops = k_bench_contended_ops * threads;
+	if (shared.counter != ops)
+	{
+		debug_print(k_print_error, "sync_bench test=%s lost updates: counter=%d expected=%d\n", test, shared.counter, ops);
+	}
+	bench_report_samples(test, threads, ops, t1 - t0, shared.samples, batches * threads, k_bench_contended_batch);
+
+	heap_free(heap, shared.samples);
+	event_destroy(shared.start);
+	lock_destroy(&shared.lock);
+	mutex_destroy(shared.mutex);
+}
+
+static int handoff_thread_func(void* user)
+{
+	handoff_data_t* data = user;
+	for (int i = 0; i < k_bench_handoffs; ++i)
+	{
+		semaphore_acquire(data->ping);
+		semaphore_release(data->pong);
+	}
+	return 0;
+}
+
+// Round trips between two threads; each one costs two wakes.
+static void handoff_test(heap_t* heap)
+{
+	handoff_data_t data;
+	data.ping = semaphore_create(0, 1);
+	data.pong = semaphore_create(0, 1);
+	uint64_t* samples = heap_alloc(heap, sizeof(uint64_t) * k_bench_handoffs, 8);
+
+	thread_t* thread = thread_create(handoff_thread_func, &data);
+	place_thread(thread, 1);
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_handoffs; ++i)
+	{
+		uint64_t start = timer_get_ticks();
+		semaphore_release(data.ping);
+		semaphore_acquire(data.pong);
+		samples[i] = timer_get_ticks() - start;
+	}
+	uint64_t t1 = timer_get_ticks();
+	thread_destroy(thread);
+
+	bench_report_samples("semaphore_handoff_round_trip", 2, k_bench_handoffs, t1 - t0, samples, k_bench_handoffs, 1);
+
+	heap_free(heap, samples);
+	semaphore_destroy(data.ping);
+	semaphore_destroy(data.pong);
+}
+
+// Items carry the tick they were pushed at, so consumers can measure queueing latency.
+static int queue_producer_func(void* user)
+{
+	bench_thread_t* thread = user;
+	queue_shared_t* shared = thread->shared;
+	event_wait(shared->start);
+	for (int i = 0; i < shared->items_per_producer; ++i)
+	{
+		queue_push(shared->queue, (void*)(uintptr_t)timer_get_ticks());
+	}
+	return 0;
+}
+
+static int queue_consumer_func(void* user)
+{
+	bench_thread_t* thread = user;
+	queue_shared_t* shared = thread->shared;
+	event_wait(shared->start);
+
+	// Claim an item before popping, so consumers never block on a queue that won't be refilled.
+	int index;
+	while ((index = atomic_increment(&shared->claimed)) < shared->total)
+	{
+		uint64_t pushed = (uint64_t)(uintptr_t)queue_pop(shared->queue);
+		shared->samples[index] = timer_get_ticks() - pushed;
+	}
+	return 0;
+}
+
+static void queue_test(heap_t* heap, const char* test, int producers, int consumers)
+{
+	queue_shared_t shared = { 0 };
+	shared.queue = queue_create(heap, k_bench_queue_capacity);
+	shared.start = event_create();
+	shared.items_per_producer = k_bench_queue_items / producers;
+	shared.total = shared.items_per_producer * producers;
+	shared.samples = heap_alloc(heap, sizeof(uint64_t) * shared.total, 8);
+
+	bench_thread_t threads[2 * k_bench_max_threads];
+	int count = producers + consumers;
+	for (int i = 0; i < count; ++i)
+	{
+		threads[i].shared = &shared;
+		threads[i].index = i;
+		threads[i].thread = thread_create(i < producers ? queue_producer_func : queue_consumer_func, &threads[i]);
+		place_thread(threads[i].thread, i);
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	event_signal(shared.start);
+	for (int i = 0; i < count; ++i)
+	{
+		thread_destroy(threads[i].thread);
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	bench_report_samples(test, count, shared.total, t1 - t0, shared.samples, shared.total, 1);
+
+	heap_free(heap, shared.samples);
+	event_destroy(shared.start);
+	queue_destroy(shared.queue);
+}
+
+static int event_waiter_func(void* user)
+{
+	bench_thread_t* thread = user;
+	event_shared_t* shared = thread->shared;
+	for (int round = 0; round < k_bench_event_rounds; ++round)
+	{
+		semaphore_acquire(shared->go);
+		event_t* event = shared->event;
+		semaphore_release(shared->ready);
+		event_wait(event);
+		shared->samples[round * shared->waiters + thread->index] = timer_get_ticks() - shared->signal_ticks;
+		semaphore_release(shared->done);
+	}
+	return 0;
+}
+
+// Time from event_signal() until each sleeping waiter runs again.
+static void event_test(heap_t* heap, int waiters)
+{
+	event_shared_t shared = { 0 };
+	shared.go = semaphore_create(0, INT_MAX);
+	shared.ready = semaphore_create(0, INT_MAX);
+	shared.done = semaphore_create(0, INT_MAX);
+	shared.waiters = waiters;
+	shared.samples = heap_alloc(heap, sizeof(uint64_t) * k_bench_event_rounds * waiters, 8);
+
+	bench_thread_t threads[k_bench_max_threads];
+	for (int i = 0; i < waiters; ++i)
+	{
+		threads[i].shared = &shared;
+		threads[i].index = i;
+		threads[i].thread = thread_create(event_waiter_func, &threads[i]);
+		place_thread(threads[i].thread, i + 1);
+	}
+
+	uint64_t total = 0;
+	for (int round = 0; round < k_bench_event_rounds; ++round)
+	{
+		shared.event = event_create();
+		for (int i = 0; i < waiters; ++i)
+		{
+			semaphore_release(shared.go);
+		}
+		for (int i = 0; i < waiters; ++i)
+		{
+			semaphore_acquire(shared.ready);
+		}
+		// Give the waiters time to fall asleep, so this measures a real wake.
+		thread_sleep(1);
+
+		atomic_store_64((int64_t*)&shared.signal_ticks, (int64_t)timer_get_ticks());
+		uint64_t t0 = timer_get_ticks();
+		event_signal(shared.event);
+		for (int i = 0; i < waiters; ++i)
+		{
+			semaphore_acquire(shared.done);
+		}
+		total += timer_get_ticks() - t0;
+		event_destroy(shared.event);
+	}
+	for (int i = 0; i < waiters; ++i)
+	{
+		thread_destroy(threads[i].thread);
+	}
+
+	bench_report_samples("event_wake", waiters, k_bench_event_rounds * waiters, total,
+		shared.samples, k_bench_event_rounds * waiters, 1);
+
+	heap_free(heap, shared.samples);
+	semaphore_destroy(shared.go);
+	semaphore_destroy(shared.ready);
+	semaphore_destroy(shared.done);
+}
+
+void sync_bench_run(heap_t* heap)
+{
+	int max_threads = __min(__max(thread_get_processor_count(), 2), k_bench_max_threads);
+	debug_print(k_print_info, "sync_bench backend=%s processors=%d\n", k_bench_backend, thread_get_processor_count());
+
+	uncontended_tests();
+
+	// The profiled lock test writes each lock's contention statistics to this trace.
+	trace_t* trace = trace_create(heap, 256);
+	trace_capture_start(trace, "sync_bench_locks.json");
+	for (int threads = 1; threads <= max_threads; threads *= 2)
+	{
+		contended_test(heap, "contended_atomic_increment", run_atomic_increment, threads, NULL);
+		contended_test(heap, "contended_atomic_cas_loop", run_atomic_cas_loop, threads, NULL);
+		contended_test(heap, "contended_mutex", run_mutex, threads, NULL);
+		contended_test(heap, "contended_lock", run_lock, threads, NULL);
+		contended_test(heap, "contended_lock_profiled", run_lock, threads, trace);
+		contended_test(heap, "contended_rwlock_write", run_rwlock_write, threads, NULL);
+		contended_test(heap, "contended_spinlock_tas", run_spinlock_tas, threads, NULL);
+		contended_test(heap, "contended_spinlock_ttas", run_spinlock_ttas, threads, NULL);
+	}
+	trace_capture_stop(trace);
+	trace_destroy(trace);
+
+	handoff_test(heap);
+
+	queue_test(heap, "queue_spsc", 1, 1);
+	for (int threads = 2; threads <= max_threads; threads *= 2)
+	{
+		queue_test(heap, "queue_mpsc", threads, 1);
+		queue_test(heap, "queue_mpmc", threads, threads);
+	}
+
+	for (int threads = 1; threads <= max_threads; threads *= 2)
+	{
+		event_test(heap, threads);
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Synchronization primitive benchmark
+// Measures the cost of the thread, mutex, lock, rwlock, seqlock, semaphore, event, queue, atomic and timer primitives.
+// Contended tests run at every power of two thread count up to the processor count,
+// with each thread pinned to its own processor so results can be compared across backends.
+
+typedef struct heap_t heap_t;
+
+// Run the synchronization benchmarks.
+// A header line names the backend, then each result is printed as a single line:
+//   sync_bench test=<name> threads=<n> ops=<n> ns_per_op=<f> [p50_ns=<f> p90_ns=<f> p99_ns=<f> max_ns=<f>]
+// Percentiles are given for contended batches, handoff round trips, queue latency and event wake latency.
+// The contended_lock_profiled tests also write each lock's contention statistics to sync_bench_locks.json,
+// a Chrome trace of counter events.
+void sync_bench_run(heap_t* heap);
@@ -1,7 +1,14 @@
+#if !defined(_WIN32)
+// For thread naming and affinity; must precede every system header.
+#define _GNU_SOURCE
+#endif
+
 #include "thread.h"
 
 #include "debug.h"
 
+#if defined(_WIN32)
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -30,3 +37,183 @@ void thread_sleep(uint32_t ms)
 {
 	Sleep(ms);
 }
+
+int thread_get_processor_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+void thread_set_name(thread_t* thread, const char* name)
+{
+	wchar_t wide_name[64];
+	if (MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, _countof(wide_name)) > 0)
+	{
+		SetThreadDescription((HANDLE)thread, wide_name);
+	}
+}
+
+void thread_set_current_name(const char* name)
+{
+	thread_set_name((thread_t*)GetCurrentThread(), name);
+}
+
+bool thread_get_current_name(char* name, size_t size)
+{
+	name[0] = '\0';
+	PWSTR wide_name = NULL;
+	if (FAILED(GetThreadDescription(GetCurrentThread(), &wide_name)))
+	{
+		return false;
+	}
+	WideCharToMultiByte(CP_UTF8, 0, wide_name, -1, name, (int)size, NULL, NULL);
+	LocalFree(wide_name);
+	return name[0] != '\0';
+}
+
+static DWORD_PTR affinity_mask(uint64_t processor_mask)
+{
+	if (!processor_mask)
+	{
+		DWORD_PTR process_mask = 0;
+		DWORD_PTR system_mask = 0;
+		GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+		return process_mask;
+	}
+	return (DWORD_PTR)processor_mask;
+}
+
+bool thread_set_affinity(thread_t* thread, uint64_t processor_mask)
+{
+	return SetThreadAffinityMask((HANDLE)thread, affinity_mask(processor_mask)) != 0;
+}
+
+bool thread_set_current_affinity(uint64_t processor_mask)
+{
+	return SetThreadAffinityMask(GetCurrentThread(), affinity_mask(processor_mask)) != 0;
+}
+
+#else
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// pthreads has no handle that carries an int exit code, so keep one alongside.
+typedef struct thread_t
+{
+	pthread_t handle;
+	int (*function)(void*);
+	void* data;
+	int result;
+} thread_t;
+
+static void* thread_start(void* user)
+{
+	thread_t* thread = user;
+	thread->result = thread->function(thread->data);
+	return NULL;
+}
+
+thread_t* thread_create(int (*function)(void*), void* data)
+{
+	thread_t* thread = calloc(1, sizeof(thread_t));
+	thread->function = function;
+	thread->data = data;
+	if (pthread_create(&thread->handle, NULL, thread_start, thread) != 0)
+	{
+		debug_print(k_print_warning, "Thread failed to create!\n");
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+int thread_destroy(thread_t* thread)
+{
+	pthread_join(thread->handle, NULL);
+	int code = thread->result;
+	free(thread);
+	return code;
+}
+
+void thread_sleep(uint32_t ms)
+{
+	if (ms == 0)
+	{
+		// Match Sleep(0): give up the rest of the time slice.
+		sched_yield();
+		return;
+	}
+	struct timespec duration = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+	while (nanosleep(&duration, &duration) != 0)
+	{
+	}
+}
+
+int thread_get_processor_count()
+{
+	return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+// Linux limits thread names to 15 characters plus the terminator.
+static void set_name(pthread_t handle, const char* name)
+{
+	char short_name[16];
+	strncpy(short_name, name, sizeof(short_name) - 1);
+	short_name[sizeof(short_name) - 1] = '\0';
+	pthread_setname_np(handle, short_name);
+}
+
+void thread_set_name(thread_t* thread, const char* name)
+{
+	set_name(thread->handle, name);
+}
+
+void thread_set_current_name(const char* name)
+{
+	set_name(pthread_self(), name);
+}
+
+bool thread_get_current_name(char* name, size_t size)
+{
+	char full_name[16];
+	name[0] = '\0';
+	if (size == 0 || pthread_getname_np(pthread_self(), full_name, sizeof(full_name)) != 0)
+	{
+		return false;
+	}
+	strncpy(name, full_name, size - 1);
+	name[size - 1] = '\0';
+	return name[0] != '\0';
+}
+
+static bool set_affinity(pthread_t handle, uint64_t processor_mask)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int i = 0; i < 64; ++i)
+	{
+		if (!processor_mask || (processor_mask & (1ull << i)))
+		{
+			CPU_SET(i, &set);
+		}
+	}
+	return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+}
+
+bool thread_set_affinity(thread_t* thread, uint64_t processor_mask)
+{
+	return set_affinity(thread->handle, processor_mask);
+}
+
+bool thread_set_current_affinity(uint64_t processor_mask)
+{
+	return set_affinity(pthread_self(), processor_mask);
+}
+
+#endif
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // Threading support.
@@ -13,8 +15,29 @@ thread_t* thread_create(int (*function)(void*), void* data);
 
 // Waits for a thread to complete and destroys it.
 // Returns the thread's exit code.
-int thread_destroy(thread);
+int thread_destroy(thread_t* thread);
 
 // Puts the calling thread to sleep for the specified number of milliseconds.
 // Thread will sleep for *approximately* the specified time.
 void thread_sleep(uint32_t ms);
+
+// Get the number of logical processors available to the process.
+int thread_get_processor_count();
+
+// Name a thread, for debuggers, profilers and trace output.
+// Names longer than 15 characters are truncated on Linux.
+void thread_set_name(thread_t* thread, const char* name);
+
+// Name the calling thread, e.g. the main thread, which has no thread_t.
+void thread_set_current_name(const char* name);
+
+// Copy the calling thread's name into name.
+// Returns false, leaving name empty, if the thread has not been named.
+bool thread_get_current_name(char* name, size_t size);
+
+// Restrict a thread to the logical processors whose bits are set in processor_mask.
+// A mask of zero leaves the thread unrestricted. Returns false if the mask was rejected.
+bool thread_set_affinity(thread_t* thread, uint64_t processor_mask);
+
+// Restrict the calling thread to the logical processors in processor_mask.
+bool thread_set_current_affinity(uint64_t processor_mask);
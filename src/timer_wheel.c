@@ -0,0 +1,330 @@
+#include "timer_wheel.h"
+
+#include "heap.h"
+#include "job.h"
+#include "lock.h"
+#include "timer.h"
+
+#include <string.h>
+
+enum
+{
+	k_wheel_levels = 4,
+	k_wheel_slot_bits = 8,
+	k_wheel_slots = 1 << k_wheel_slot_bits,
+	k_wheel_slot_mask = k_wheel_slots - 1,
+};
+
+typedef struct timer_list_t timer_list_t;
+
+typedef struct timer_entry_t
+{
+	struct timer_entry_t* next;
+	struct timer_entry_t* prev;
+	timer_list_t* list;
+	uint64_t expires_ms;
+	uint32_t period_ms;
+	timer_wheel_func_t func;
+	void* data;
+	bool job;
+	int sequence;
+} timer_entry_t;
+
+typedef struct timer_list_t
+{
+	timer_entry_t* first;
+	timer_entry_t* last;
+} timer_list_t;
+
+typedef struct timer_wheel_t
+{
+	heap_t* heap;
+	job_system_t* jobs;
+	lock_t lock;
+
+	// Every millisecond up to and including this one has been moved to the expired list.
+	uint64_t current_ms;
+	int pending_count;
+
+	timer_list_t slots[k_wheel_levels][k_wheel_slots];
+	timer_list_t expired;
+
+	timer_entry_t* entries;
+	timer_entry_t* free_entries;
+	int capacity;
+} timer_wheel_t;
+
+static uint64_t now_ms()
+{
+	return timer_ticks_to_us(timer_get_ticks()) / 1000;
+}
+
+// A timer always expires on a later update than the one in progress, so callbacks cannot starve it.
+static uint64_t expiry_from_now(timer_wheel_t* wheel, uint32_t delay_ms)
+{
+	return __max(now_ms() + delay_ms, wheel->current_ms + 1);
+}
+
+static void list_append(timer_list_t* list, timer_entry_t* entry)
+{
+	entry->list = list;
+	entry->next = NULL;
+	entry->prev = list->last;
+	if (list->last)
+	{
+		list->last->next = entry;
+	}
+	else
+	{
+		list->first = entry;
+	}
+	list->last = entry;
+}
+
+static void list_remove(timer_entry_t* entry)
+{
+	timer_list_t* list = entry->list;
+	if (entry->prev)
+	{
+		entry->prev->next = entry->next;
+	}
+	else
+	{
+		list->first = entry->next;
+	}
+	if (entry->next)
+	{
+		entry->next->prev = entry->prev;
+	}
+	else
+	{
+		list->last = entry->prev;
+	}
+	entry->list = NULL;
+}
+
+// File an entry by how far away it expires: level n holds timers due within 2^(8 * (n + 1)) ms.
+// Slots of the upper levels are emptied into the levels below as time reaches them.
+static void insert_entry(timer_wheel_t* wheel, timer_entry_t* entry)
+{
+	if (entry->expires_ms <= wheel->current_ms)
+	{
+		list_append(&wheel->expired, entry);
+		return;
+	}
+
+	uint64_t delta = entry->expires_ms - wheel->current_ms;
+	for (int level = 0; level < k_wheel_levels - 1; ++level)
+	{
+		if (delta < (1ull << (k_wheel_slot_bits * (level + 1))))
+		{
+			int slot = (int)(entry->expires_ms >> (k_wheel_slot_bits * level)) & k_wheel_slot_mask;
+			list_append(&wheel->slots[level][slot], entry);
+			return;
+		}
+	}
+
+	// Beyond the top level's range, park the entry in the furthest slot; it is refiled when reached.
+	uint64_t expires = __min(entry->expires_ms, wheel->current_ms + UINT32_MAX);
+	int slot = (int)(expires >> (k_wheel_slot_bits * (k_wheel_levels - 1))) & k_wheel_slot_mask;
+	list_append(&wheel->slots[k_wheel_levels - 1][slot], entry);
+}
+
+// Refile every entry of a slot into the levels below it.
+static void cascade(timer_wheel_t* wheel, int level, int slot)
+{
+	timer_entry_t* entry = wheel->slots[level][slot].first;
+	wheel->slots[level][slot].first = NULL;
+	wheel->slots[level][slot].last = NULL;
+	while (entry)
+	{
+		timer_entry_t* next = entry->next;
+		insert_entry(wheel, entry);
+		entry = next;
+	}
+}
+
+static void advance(timer_wheel_t* wheel, uint64_t now)
+{
+	// Nothing can expire in an empty wheel, so there is no need to step through the gap.
+	if (wheel->pending_count == 0)
+	{
+		wheel->current_ms = __max(wheel->current_ms, now);
+		return;
+	}
+
+	while (wheel->current_ms < now)
+	{
+		wheel->current_ms++;
+
+		// Upper level slots are refiled as the level below wraps around to zero.
+		for (int level = 1; level < k_wheel_levels; ++level)
+		{
+			if ((wheel->current_ms & ((1ull << (k_wheel_slot_bits * level)) - 1)) != 0)
+			{
+				break;
+			}
+			cascade(wheel, level, (int)(wheel->current_ms >> (k_wheel_slot_bits * level)) & k_wheel_slot_mask);
+		}
+
+		timer_list_t* slot = &wheel->slots[0][wheel->current_ms & k_wheel_slot_mask];
+		while (slot->first)
+		{
+			timer_entry_t* entry = slot->first;
+			list_remove(entry);
+			list_append(&wheel->expired, entry);
+		}
+	}
+}
+
+static timer_entry_t* resolve_ref(timer_wheel_t* wheel, timer_wheel_ref_t ref)
+{
+	if (ref.index < 0 || ref.index >= wheel->capacity)
+	{
+		return NULL;
+	}
+	timer_entry_t* entry = &wheel->entries[ref.index];
+	return (entry->list && entry->sequence == ref.sequence) ? entry : NULL;
+}
+
+static void free_entry(timer_wheel_t* wheel, timer_entry_t* entry)
+{
+	// Invalidate outstanding references; sequence zero is reserved for failed schedules.
+	entry->sequence = entry->sequence + 1 > 0 ? entry->sequence + 1 : 1;
+	entry->next = wheel->free_entries;
+	wheel->free_entries = entry;
+	wheel->pending_count--;
+}
+
+static timer_wheel_ref_t schedule(timer_wheel_t* wheel, uint32_t delay_ms, uint32_t period_ms, timer_wheel_func_t func, void* data, bool job)
+{
+	timer_wheel_ref_t ref = { 0 };
+
+	lock_acquire(&wheel->lock);
+	timer_entry_t* entry = wheel->free_entries;
+	if (entry)
+	{
+		wheel->free_entries = entry->next;
+		wheel->pending_count++;
+
+		entry->expires_ms = expiry_from_now(wheel, delay_ms);
+		entry->period_ms = period_ms;
+		entry->func = func;
+		entry->data = data;
+		entry->job = job;
+		insert_entry(wheel, entry);
+
+		ref.index = (int)(entry - wheel->entries);
+		ref.sequence = entry->sequence;
+	}
+	lock_release(&wheel->lock);
+
+	return ref;
+}
+
+timer_wheel_t* timer_wheel_create(heap_t* heap, int capacity, job_system_t* jobs)
+{
+	timer_wheel_t* wheel = heap_alloc(heap, sizeof(timer_wheel_t), 8);
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->heap = heap;
+	wheel->jobs = jobs;
+	lock_init(&wheel->lock, "timer_wheel");
+	wheel->current_ms = now_ms();
+
+	wheel->capacity = capacity;
+	wheel->entries = heap_alloc(heap, sizeof(timer_entry_t) * capacity, 8);
+	memset(wheel->entries, 0, sizeof(timer_entry_t) * capacity);
+	for (int i = capacity - 1; i >= 0; --i)
+	{
+		wheel->entries[i].sequence = 1;
+		wheel->entries[i].next = wheel->free_entries;
+		wheel->free_entries = &wheel->entries[i];
+	}
+
+	return wheel;
+}
+
+void timer_wheel_destroy(timer_wheel_t* wheel)
+{
+	lock_destroy(&wheel->lock);
+	heap_free(wheel->heap, wheel->entries);
+	heap_free(wheel->heap, wheel);
+}
+
+timer_wheel_ref_t timer_wheel_schedule(timer_wheel_t* wheel, uint32_t delay_ms, uint32_t period_ms, timer_wheel_func_t func, void* data)
+{
+	return schedule(wheel, delay_ms, period_ms, func, data, false);
+}
+
+timer_wheel_ref_t timer_wheel_schedule_job(timer_wheel_t* wheel, uint32_t delay_ms, uint32_t period_ms, timer_wheel_func_t func, void* data)
+{
+	return schedule(wheel, delay_ms, period_ms, func, data, wheel->jobs != NULL);
+}
+
+bool timer_wheel_reschedule(timer_wheel_t* wheel, timer_wheel_ref_t ref, uint32_t delay_ms)
+{
+	lock_acquire(&wheel->lock);
+	timer_entry_t* entry = resolve_ref(wheel, ref);
+	if (entry)
+	{
+		list_remove(entry);
+		entry->expires_ms = expiry_from_now(wheel, delay_ms);
+		insert_entry(wheel, entry);
+	}
+	lock_release(&wheel->lock);
+	return entry != NULL;
+}
+
+bool timer_wheel_cancel(timer_wheel_t* wheel, timer_wheel_ref_t ref)
+{
+	lock_acquire(&wheel->lock);
+	timer_entry_t* entry = resolve_ref(wheel, ref);
+	if (entry)
+	{
+		list_remove(entry);
+		free_entry(wheel, entry);
+	}
+	lock_release(&wheel->lock);
+	return entry != NULL;
+}
+
+void timer_wheel_update(timer_wheel_t* wheel)
+{
+	lock_acquire(&wheel->lock);
+	advance(wheel, now_ms());
+
+	// Take one timer at a time, so callbacks can cancel any timer that has not run yet.
+	while (wheel->expired.first)
+	{
+		timer_entry_t* entry = wheel->expired.first;
+		list_remove(entry);
+
+		timer_wheel_func_t func = entry->func;
+		void* data = entry->data;
+		bool job = entry->job;
+
+		if (entry->period_ms)
+		{
+			// Repeat relative to the last expiry so the period does not drift.
+			entry->expires_ms = __max(entry->expires_ms + entry->period_ms, wheel->current_ms + 1);
+			insert_entry(wheel, entry);
+		}
+		else
+		{
+			free_entry(wheel, entry);
+		}
+
+		lock_release(&wheel->lock);
+		if (job)
+		{
+			job_run(wheel->jobs, func, data, NULL);
+		}
+		else
+		{
+			func(data);
+		}
+		lock_acquire(&wheel->lock);
+	}
+
+	lock_release(&wheel->lock);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hierarchical timer wheel
+// Schedules callbacks to run after a delay, optionally repeating.
+// Four levels of 256 slots at millisecond resolution cover any 32-bit delay.
+// Scheduling and cancelling are O(1); timer_wheel_update() advances time and dispatches
+// expired timers, either directly on the updating thread or as jobs.
+// All functions are thread-safe, and callbacks may schedule or cancel timers.
+
+typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+
+// Handle to a timer wheel.
+typedef struct timer_wheel_t timer_wheel_t;
+
+// Identifies a scheduled timer. Stays safe to use after the timer has expired or been cancelled.
+typedef struct timer_wheel_ref_t
+{
+	int index;
+	int sequence;
+} timer_wheel_ref_t;
+
+// Function run when a timer expires.
+typedef void (*timer_wheel_func_t)(void* data);
+
+// Create a timer wheel with room for capacity pending timers.
+// Timers scheduled with timer_wheel_schedule_job() are run on jobs, which may be NULL if there are none.
+timer_wheel_t* timer_wheel_create(heap_t* heap, int capacity, job_system_t* jobs);
+
+// Destroy a timer wheel. Pending timers are dropped without running.
+void timer_wheel_destroy(timer_wheel_t* wheel);
+
+// Run func on the thread calling timer_wheel_update() once delay_ms has elapsed.
+// If period_ms is not zero, the timer then repeats at that interval until cancelled.
+// Returns a reference with a zero sequence if the wheel is full.
+timer_wheel_ref_t timer_wheel_schedule(timer_wheel_t* wheel, uint32_t delay_ms, uint32_t period_ms, timer_wheel_func_t func, void* data);
+
+// As timer_wheel_schedule(), but func is queued on the wheel's job system when the timer expires.
+timer_wheel_ref_t timer_wheel_schedule_job(timer_wheel_t* wheel, uint32_t delay_ms, uint32_t period_ms, timer_wheel_func_t func, void* data);
+
+// Move a pending timer to expire delay_ms from now.
+// Returns false if the timer has already expired or been cancelled.
+bool timer_wheel_reschedule(timer_wheel_t* wheel, timer_wheel_ref_t ref, uint32_t delay_ms);
+
+// Cancel a pending timer.
+// Returns false if the timer has already expired or been cancelled.
+bool timer_wheel_cancel(timer_wheel_t* wheel, timer_wheel_ref_t ref);
+
+// Advance the wheel to the current time and dispatch every timer that expired.
+// Callbacks are run without the wheel's lock held.
+void timer_wheel_update(timer_wheel_t* wheel);
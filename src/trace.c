@@ -1,7 +1,8 @@
 #include "trace.h"
 #include "heap.h"
+#include "lock.h"
 #include "queue.h"
-#include "mutex.h"
+#include "thread.h"
 #include "timer_object.h"
 
 #define WIN32_LEAN_AND_MEAN
@@ -11,6 +12,11 @@
 #include <string.h>
 #include <windows.h>
 
+enum
+{
+	k_trace_max_threads = 64,
+};
+
 // The event struct that stores information for an event
 typedef struct event_t
 {
@@ -27,12 +33,15 @@ typedef struct trace_t
 {
 	heap_t* heap;
 	queue_t* queue;
-	mutex_t* mutex;
+	lock_t lock;
 	size_t event_capacity;
 	timer_object_t* timer;
 	char* path;
 	char* buffer;
 	bool capture;
+	// Threads whose name has been written to the current capture.
+	DWORD named_threads[k_trace_max_threads];
+	int named_thread_count;
 } trace_t;
 
 trace_t* trace_create(heap_t* heap, int event_capacity)
@@ -40,11 +49,12 @@ trace_t* trace_create(heap_t* heap, int event_capacity)
 	trace_t* trace = heap_alloc(heap, sizeof(trace_t), 8);
 	trace->heap = heap;
 	trace->queue = queue_create(heap, event_capacity);
-	trace->mutex = mutex_create(heap);
+	lock_init(&trace->lock, "trace");
 	trace->event_capacity = (size_t)event_capacity;
 	trace->timer = timer_object_create(heap, NULL);
 	trace->buffer = calloc(trace->event_capacity * 256, sizeof(char));
 	trace->capture = false;
+	trace->named_thread_count = 0;
 	return trace;
 }
 
@@ -53,11 +63,39 @@ void trace_destroy(trace_t* trace)
 	queue_push(trace->queue, NULL);
 	queue_destroy(trace->queue);
 	timer_object_destroy(trace->timer);
-	mutex_destroy(trace->mutex);
+	lock_destroy(&trace->lock);
 	free(trace->buffer);
 	heap_free(trace->heap, trace);
 }
 
+// Write a thread_name metadata event the first time the calling thread appears in a capture,
+// so viewers label its track. Called with the trace lock held.
+static void name_current_thread(trace_t* trace)
+{
+	DWORD tid = GetCurrentThreadId();
+	for (int i = 0; i < trace->named_thread_count; ++i)
+	{
+		if (trace->named_threads[i] == tid)
+		{
+			return;
+		}
+	}
+	if (trace->named_thread_count >= k_trace_max_threads)
+	{
+		return;
+	}
+	trace->named_threads[trace->named_thread_count++] = tid;
+
+	char name[64];
+	if (!thread_get_current_name(name, sizeof(name)))
+	{
+		snprintf(name, sizeof(name), "thread %d", (int)tid);
+	}
+	char event_string[128];
+	snprintf(event_string, sizeof(event_string), "\t\t{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":\"%d\",\"args\":{\"name\":\"%s\"}},\n", (int)tid, name);
+	strncat_s(trace->buffer, trace->event_capacity * 256, event_string, strlen(event_string));
+}
+
 void trace_duration_push(trace_t* trace, const char* name)
 {
 	timer_object_update(trace->timer);
@@ -81,9 +119,10 @@ void trace_duration_push(trace_t* trace, const char* name)
 		char event_string[128];
 		snprintf(event_string, sizeof(event_string), "\t\t{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%d\"},\n", event->name, event->ph, event->pid, event->tid, event->ts);
 		
-		mutex_lock(trace->mutex);
-		strncat_s(trace->buffer, strlen(trace->buffer) + strlen(event_string) + 1, event_string, strlen(event_string));
-		mutex_unlock(trace->mutex);
+		lock_acquire(&trace->lock);
+		name_current_thread(trace);
+		strncat_s(trace->buffer, trace->event_capacity * 256, event_string, strlen(event_string));
+		lock_release(&trace->lock);
 	}
 }
 
@@ -102,15 +141,43 @@ void trace_duration_pop(trace_t* trace)
 		char event_string[128];
 		snprintf(event_string, sizeof(event_string), "\t\t{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%d\"},\n", event->name, event->ph, event->pid, event->tid, event->ts);
 		
-		mutex_lock(trace->mutex);
+		lock_acquire(&trace->lock);
+		name_current_thread(trace);
 		strncat_s(trace->buffer, trace->event_capacity * 256, event_string, strlen(event_string));
-		mutex_unlock(trace->mutex);
+		lock_release(&trace->lock);
 	}
 
 	free(event->name);
 	heap_free(event->heap, event);
 }
 
+void trace_counter(trace_t* trace, const char* name, const char** keys, const int64_t* values, int count)
+{
+	if (!trace->capture)
+	{
+		return;
+	}
+	timer_object_update(trace->timer);
+
+	char event_string[512];
+	int length = snprintf(event_string, sizeof(event_string), "\t\t{\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"tid\":\"%d\",\"ts\":\"%d\",\"args\":{",
+		name, (int)GetCurrentThreadId(), (int)timer_object_get_ms(trace->timer));
+	for (int i = 0; i < count && length < (int)sizeof(event_string); ++i)
+	{
+		length += snprintf(event_string + length, sizeof(event_string) - length, "%s\"%s\":%lld",
+			i ? "," : "", keys[i], (long long)values[i]);
+	}
+	if (length < (int)sizeof(event_string))
+	{
+		snprintf(event_string + length, sizeof(event_string) - length, "}},\n");
+	}
+
+	lock_acquire(&trace->lock);
+	name_current_thread(trace);
+	strncat_s(trace->buffer, trace->event_capacity * 256, event_string, strlen(event_string));
+	lock_release(&trace->lock);
+}
+
 void trace_capture_start(trace_t* trace, const char* path)
 {
 	trace->path = calloc(strlen(path) + 1, sizeof(char));
@@ -120,9 +187,10 @@ void trace_capture_start(trace_t* trace, const char* path)
 	}
 	char* start_string = "{\n\t\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
 	
-	mutex_lock(trace->mutex);
+	lock_acquire(&trace->lock);
 	strncat_s(trace->buffer, strlen(trace->buffer) + strlen(start_string) + 1, start_string, strlen(start_string));
-	mutex_unlock(trace->mutex);
+	trace->named_thread_count = 0;
+	lock_release(&trace->lock);
 	trace->capture = true;
 }
 
@@ -130,13 +198,14 @@ void trace_capture_stop(trace_t* trace)
 {
 	trace->capture = false;
 	char* end_string = "\t]\n";
-	mutex_lock(trace->mutex);
+	lock_acquire(&trace->lock);
 	strncat_s(trace->buffer, strlen(trace->buffer) + strlen(end_string) + 1, end_string, strlen(end_string));
 
 	// The same logic as file_write() from fs.c
 	wchar_t wide_path[1024];
 	if (MultiByteToWideChar(CP_UTF8, 0, trace->path, -1, wide_path, sizeof(wide_path)) <= 0)
 	{
+		lock_release(&trace->lock);
 		return;
 	}
 
@@ -144,15 +213,18 @@ void trace_capture_stop(trace_t* trace)
 		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (handle == INVALID_HANDLE_VALUE)
 	{
+		lock_release(&trace->lock);
 		return;
 	}
 
 	DWORD bytes_written = 0;
 	if (!WriteFile(handle, trace->buffer, (DWORD)strlen(trace->buffer), NULL, NULL))
 	{
+		CloseHandle(handle);
+		lock_release(&trace->lock);
 		return;
 	}
 																											
 	CloseHandle(handle);
-	mutex_unlock(trace->mutex);
+	lock_release(&trace->lock);
 }
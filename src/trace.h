@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 typedef struct heap_t heap_t;
 
 typedef struct trace_t trace_t;
@@ -18,6 +20,10 @@ void trace_duration_push(trace_t* trace, const char* name);
 // End tracing the currently active duration on the current thread.
 void trace_duration_pop(trace_t* trace);
 
+// Record a counter event with a set of named values, e.g. statistics gathered elsewhere.
+// Only recorded while capturing.
+void trace_counter(trace_t* trace, const char* name, const char** keys, const int64_t* values, int count);
+
 // Start recording trace events.
 // A Chrome trace file will be written to path.
 void trace_capture_start(trace_t* trace, const char* path);
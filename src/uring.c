@@ -0,0 +1,233 @@
+#include "uring.h"
+
+#include "atomic.h"
+#include "heap.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct uring_t
+{
+	heap_t* heap;
+	int fd;
+
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+
+	// Shared with the kernel, which consumes submissions at sq_head and produces completions at cq_tail.
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	struct io_uring_cqe* cqes;
+	unsigned cq_mask;
+
+	// Operations queued since the last submit.
+	unsigned queued;
+} uring_t;
+
+uring_t* uring_create(heap_t* heap, int entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	uring_t* ring = heap_alloc(heap, sizeof(uring_t), 8);
+	memset(ring, 0, sizeof(*ring));
+	ring->heap = heap;
+	ring->fd = fd;
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	// Newer kernels map both rings with one call.
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->sq_ring_size = ring->cq_ring_size = __max(ring->sq_ring_size, ring->cq_ring_size);
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+	{
+		close(fd);
+		heap_free(heap, ring);
+		return NULL;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->cq_ring = ring->sq_ring;
+	}
+	else
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		{
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		close(fd);
+		heap_free(heap, ring);
+		return NULL;
+	}
+
+	char* sq = ring->sq_ring;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_entries = *(unsigned*)(sq + params.sq_off.ring_entries);
+
+	char* cq = ring->cq_ring;
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+
+	return ring;
+}
+
+void uring_destroy(uring_t* ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+	{
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	heap_free(ring->heap, ring);
+}
+
+static struct io_uring_sqe* get_sqe(uring_t* ring)
+{
+	unsigned head = (unsigned)atomic_load_explicit((int*)ring->sq_head, k_atomic_acquire);
+	unsigned tail = *ring->sq_tail + ring->queued;
+	if (tail - head >= ring->sq_entries)
+	{
+		return NULL;
+	}
+
+	unsigned index = tail & ring->sq_mask;
+	ring->sq_array[index] = index;
+	ring->queued++;
+
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static bool prep_rw(uring_t* ring, int op, int fd, const void* buffer, uint32_t size, int64_t offset, uint64_t user_data)
+{
+	struct io_uring_sqe* sqe = get_sqe(ring);
+	if (!sqe)
+	{
+		return false;
+	}
+	sqe->opcode = (uint8_t)op;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = size;
+	sqe->off = (uint64_t)offset;
+	sqe->user_data = user_data;
+	return true;
+}
+
+bool uring_prep_read(uring_t* ring, int fd, void* buffer, uint32_t size, int64_t offset, uint64_t user_data)
+{
+	return prep_rw(ring, IORING_OP_READ, fd, buffer, size, offset, user_data);
+}
+
+bool uring_prep_write(uring_t* ring, int fd, const void* buffer, uint32_t size, int64_t offset, uint64_t user_data)
+{
+	return prep_rw(ring, IORING_OP_WRITE, fd, buffer, size, offset, user_data);
+}
+
+int uring_submit(uring_t* ring, int wait_count)
+{
+	// Publish the queued entries to the kernel in one store.
+	unsigned tail = *ring->sq_tail + ring->queued;
+	atomic_store_explicit((int*)ring->sq_tail, (int)tail, k_atomic_release);
+	ring->queued = 0;
+
+	// Include any entries a previous call left unconsumed.
+	unsigned count = tail - (unsigned)atomic_load_explicit((int*)ring->sq_head, k_atomic_acquire);
+	unsigned flags = wait_count > 0 ? IORING_ENTER_GETEVENTS : 0;
+	int result;
+	do
+	{
+		result = (int)syscall(__NR_io_uring_enter, ring->fd, count, wait_count, flags, NULL, 0);
+	} while (result < 0 && errno == EINTR);
+
+	return result < 0 ? -errno : result;
+}
+
+bool uring_pop_completion(uring_t* ring, uint64_t* user_data, int* result)
+{
+	unsigned head = *ring->cq_head;
+	unsigned tail = (unsigned)atomic_load_explicit((int*)ring->cq_tail, k_atomic_acquire);
+	if (head == tail)
+	{
+		return false;
+	}
+
+	struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+	*user_data = cqe->user_data;
+	*result = cqe->res;
+	atomic_store_explicit((int*)ring->cq_head, (int)(head + 1), k_atomic_release);
+	return true;
+}
+
+#else
+
+uring_t* uring_create(heap_t* heap, int entries)
+{
+	return NULL;
+}
+
+void uring_destroy(uring_t* ring)
+{
+}
+
+bool uring_prep_read(uring_t* ring, int fd, void* buffer, uint32_t size, int64_t offset, uint64_t user_data)
+{
+	return false;
+}
+
+bool uring_prep_write(uring_t* ring, int fd, const void* buffer, uint32_t size, int64_t offset, uint64_t user_data)
+{
+	return false;
+}
+
+int uring_submit(uring_t* ring, int wait_count)
+{
+	return -1;
+}
+
+bool uring_pop_completion(uring_t* ring, uint64_t* user_data, int* result)
+{
+	return false;
+}
+
+#endif
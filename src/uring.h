@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Asynchronous I/O ring
+// A thin wrapper over the Linux io_uring system calls.
+// Operations are queued with the uring_prep functions, handed to the kernel in one batch by uring_submit(),
+// and their results collected with uring_pop_completion().
+// A ring is not thread-safe; it is meant to be driven by a single thread.
+
+typedef struct heap_t heap_t;
+
+// Handle to a ring.
+typedef struct uring_t uring_t;
+
+// Create a ring with room for at least entries queued operations.
+// Returns NULL if io_uring is not available, as on Windows or older kernels.
+uring_t* uring_create(heap_t* heap, int entries);
+
+// Destroy a ring. Operations still in flight are abandoned.
+void uring_destroy(uring_t* ring);
+
+// Queue a read of size bytes at offset in fd. A negative offset reads from the current position.
+// Returns false if the submission queue is full.
+bool uring_prep_read(uring_t* ring, int fd, void* buffer, uint32_t size, int64_t offset, uint64_t user_data);
+
+// Queue a write of size bytes at offset in fd.
+// Returns false if the submission queue is full.
+bool uring_prep_write(uring_t* ring, int fd, const void* buffer, uint32_t size, int64_t offset, uint64_t user_data);
+
+// Submit every queued operation and block until at least wait_count operations have completed.
+// Returns the number of operations submitted, or a negative error code.
+int uring_submit(uring_t* ring, int wait_count);
+
+// Pop one completed operation: the user data it was queued with,
+// and its result, a byte count or a negative error code.
+// Returns false if no completions are ready.
+bool uring_pop_completion(uring_t* ring, uint64_t* user_data, int* result);